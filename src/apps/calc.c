@@ -1,16 +1,14 @@
 #include <stddef.h>
 #include <stdint.h>
 #include "../fs.h"
+#include "../disk/bcache.h"
+#include "../disk/blkq.h"
+#include "../cpu/kbd.h"
 
 #define CALC_BUF_SIZE 128
 static char calc_buf[CALC_BUF_SIZE];
 static size_t calc_buf_len;
 
-extern const char kbdus[128];
-extern const char kbdus_shift[128];
-extern volatile int shift_pressed;
-extern uint8_t inb(uint16_t port);
-
 static void calc_prompt(void (*terminal_write)(const char*)) {
     terminal_write("\nCalc> ");
     calc_buf_len = 0;
@@ -53,9 +51,12 @@ static void calc_log(const char *expr, int result) {
     log_entry[idx++] = '\n';
     log_entry[idx] = 0;
 
-    // Create log file if doesn't exist
+    // Create log file if doesn't exist. Kept raw: appending to a
+    // compressed file rewrites its whole last cluster
     fs_create("calc.log", NULL);
-    fs_write("calc.log",NULL, log_entry, idx);
+    fs_append("calc.log", NULL, log_entry, idx);
+    // Fire-and-forget: the loop below dispatches the queued writes when idle
+    bcache_writeback_async();
 }
 
 void calc_app(void (*terminal_clear)(), void (*terminal_write)(const char*)) {
@@ -65,46 +66,41 @@ void calc_app(void (*terminal_clear)(), void (*terminal_write)(const char*)) {
 
     int running = 1;
     while (running) {
-        if (inb(0x64) & 0x01) {
-            uint8_t sc = inb(0x60);
-
-            // Shift key logic
-            if (sc == 0x2A || sc == 0x36) { shift_pressed = 1; continue; }
-            if (sc == 0xAA || sc == 0xB6) { shift_pressed = 0; continue; }
-
-            if (!(sc & 0x80)) { // key press
-                char c = shift_pressed ? kbdus_shift[sc] : kbdus[sc];
-                if (c == 27) { // ESC
-                    running = 0;
-                    continue;
-                }
-                if (c == '\b' && calc_buf_len > 0) {
-                    calc_buf_len--;
-                    terminal_write("\b \b");
-                } else if (c == '\n') {
-                    calc_buf[calc_buf_len] = '\0';
-                    int result = calc_parse_and_compute(calc_buf);
-                    char out[32];
-                    int idx = 0;
-                    int r = result;
-                    if (r < 0) { out[idx++] = '-'; r = -r; }
-                    int digits[10], n = 0;
-                    do { digits[n++] = r % 10; r /= 10; } while (r);
-                    for (int i = n-1; i >= 0; i--) out[idx++] = '0' + digits[i];
-                    out[idx] = '\0';
-                    terminal_write("\n = ");
-                    terminal_write(out);
-                    calc_log(calc_buf, result); // log each calculation to persistent file
-                    calc_prompt(terminal_write);
-                    calc_buf_len = 0;
-                } else if (c && calc_buf_len < CALC_BUF_SIZE-1) {
-                    calc_buf[calc_buf_len++] = c;
-                    char out[2] = {c, '\0'};
-                    terminal_write(out);
-                }
+        int c = kbd_poll();
+        if (c < 0) {
+            fs_idle();
+            blk_idle();
+            kbd_wait();
+            continue;
+        }
+        if (c == 27) { // ESC
+            running = 0;
+        } else if (c == '\b') {
+            if (calc_buf_len > 0) {
+                calc_buf_len--;
+                terminal_write("\b \b");
             }
+        } else if (c == '\n') {
+            calc_buf[calc_buf_len] = '\0';
+            int result = calc_parse_and_compute(calc_buf);
+            char out[32];
+            int idx = 0;
+            int r = result;
+            if (r < 0) { out[idx++] = '-'; r = -r; }
+            int digits[10], n = 0;
+            do { digits[n++] = r % 10; r /= 10; } while (r);
+            for (int i = n-1; i >= 0; i--) out[idx++] = '0' + digits[i];
+            out[idx] = '\0';
+            terminal_write("\n = ");
+            terminal_write(out);
+            calc_log(calc_buf, result); // log each calculation to persistent file
+            calc_prompt(terminal_write);
+            calc_buf_len = 0;
+        } else if (calc_buf_len < CALC_BUF_SIZE-1) {
+            calc_buf[calc_buf_len++] = c;
+            char out[2] = {c, '\0'};
+            terminal_write(out);
         }
-        for (volatile int i = 0; i < 50000; i++); // Small delay
     }
     terminal_clear();
     terminal_write("Exiting Calc App.\n");
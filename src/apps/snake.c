@@ -1,6 +1,8 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "snake.h"
+#include "../cpu/kbd.h"
+#include "../cpu/timer.h"
 
 // VGA definitions must match those in kernel.c
 #define VGA_TEXT_BUFFER ((volatile uint16_t*)0xB8000)
@@ -10,6 +12,7 @@
 #define SNAKE_WIDTH 40
 #define SNAKE_HEIGHT 20
 #define SNAKE_MAXLEN 100
+#define SNAKE_TICK_MS 120
 
 typedef struct {
     int x, y;
@@ -21,10 +24,6 @@ static Point food;
 static int dx, dy;
 static int game_over;
 
-// Extern keyboard mappings from kernel.c
-extern const char kbdus[128];
-extern uint8_t inb(uint16_t port);
-
 static void snake_draw() {
     // Clear screen
     for (size_t y = 0; y < SNAKE_HEIGHT; y++)
@@ -109,24 +108,25 @@ static void snake_update() {
 }
 
 void snake_game(void (*terminal_clear)(), void (*terminal_write)(const char*)) {
+    struct timer tick;
     snake_init();
+    timer_setup(&tick, NULL, NULL);
+    timer_start(&tick, SNAKE_TICK_MS, SNAKE_TICK_MS);
     while (!game_over) {
         snake_draw();
-        // Poll keyboard
-        if (inb(0x64) & 0x01) {
-            uint8_t sc = inb(0x60);
-            if (!(sc & 0x80)) {
-                char c = kbdus[sc];
-                snake_handle_input(c);
-            }
-        }
+        // Apply every key queued since the last tick
+        int c;
+        while ((c = kbd_poll()) >= 0)
+            snake_handle_input(c);
         snake_update();
 
-        // Delay
-        for (volatile int i = 0; i < 2000000; i++);
+        // One step per tick whatever the CPU speed; halted in between
+        timer_wait(&tick);
     }
+    timer_cancel(&tick);
     terminal_clear();
     terminal_write("Game Over! Press any key to return.\n");
-    // Wait for key
-    while (!(inb(0x64) & 0x01));
+    // Wait for a key pressed after the game ended
+    kbd_flush();
+    kbd_getc();
 }
\ No newline at end of file
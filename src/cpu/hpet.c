@@ -0,0 +1,162 @@
+#include "hpet.h"
+#include "../mm/paging.h"
+#include <stddef.h>
+
+#define MULTIBOOT2_TAG_END      0
+#define MULTIBOOT2_TAG_ACPI_OLD 14      // Copy of an ACPI 1.0 RSDP
+#define MULTIBOOT2_TAG_ACPI_NEW 15      // Copy of an ACPI 2.0+ RSDP
+
+#define BIOS_EBDA_SEG   0x40E           // Real-mode segment of the EBDA
+#define BIOS_ROM_START  0xE0000
+#define BIOS_ROM_END    0x100000
+
+#define HPET_MMIO_SIZE      0x400
+#define HPET_REG_CAP        0x000       // Period (fs) in the high dword
+#define HPET_REG_CONFIG     0x010
+#define HPET_REG_COUNTER    0x0F0
+#define HPET_CAP_64BIT      (1u << 13)
+#define HPET_CFG_ENABLE     0x01
+#define HPET_MAX_PERIOD     100000000   // The spec caps a tick at 100 ns
+
+struct acpi_rsdp {
+    char sig[8];                // "RSD PTR "
+    uint8_t checksum;           // Over the first 20 bytes
+    char oem[6];
+    uint8_t revision;           // 2+ has the XSDT fields
+    uint32_t rsdt;
+    uint32_t length;
+    uint64_t xsdt;
+    uint8_t ext_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed));
+
+struct acpi_sdt {
+    char sig[4];
+    uint32_t length;            // Including this header
+    uint8_t revision;
+    uint8_t checksum;
+    char oem[6];
+    char oem_table[8];
+    uint32_t oem_revision;
+    uint32_t creator;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
+struct acpi_hpet {
+    struct acpi_sdt hdr;
+    uint32_t block_id;
+    uint8_t space_id;           // Generic address: 0 is system memory
+    uint8_t bit_width;
+    uint8_t bit_offset;
+    uint8_t access_size;
+    uint64_t address;
+    uint8_t number;
+    uint16_t min_tick;
+    uint8_t attributes;
+} __attribute__((packed));
+
+static volatile uint32_t *hpet_regs = NULL;
+static uint32_t hpet_period = 0;
+
+static int acpi_checksum_ok(const void *p, uint32_t len) {
+    const uint8_t *b = p;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < len; i++)
+        sum += b[i];
+    return sum == 0;
+}
+
+static int acpi_sig(const char *a, const char *b, int n) {
+    for (int i = 0; i < n; i++)
+        if (a[i] != b[i]) return 0;
+    return 1;
+}
+
+static const struct acpi_rsdp *acpi_scan(uint32_t start, uint32_t end) {
+    for (uint32_t a = start; a + sizeof(struct acpi_rsdp) <= end; a += 16) {
+        const struct acpi_rsdp *r = (const struct acpi_rsdp *)a;
+        if (acpi_sig(r->sig, "RSD PTR ", 8) && acpi_checksum_ok(r, 20))
+            return r;
+    }
+    return NULL;
+}
+
+static const struct acpi_rsdp *acpi_find_rsdp(uint32_t mb2_addr) {
+    const struct acpi_rsdp *found = NULL;
+    if (mb2_addr) {
+        uint32_t size = *(uint32_t *)mb2_addr;
+        uint32_t tag_addr = mb2_addr + 8;
+        while (tag_addr < mb2_addr + size) {
+            uint32_t type = *(uint32_t *)tag_addr;
+            uint32_t tagsize = *(uint32_t *)(tag_addr + 4);
+            if (type == MULTIBOOT2_TAG_END) break;
+            // Prefer the 2.0 copy; GRUB may pass both
+            if (type == MULTIBOOT2_TAG_ACPI_NEW)
+                return (const struct acpi_rsdp *)(tag_addr + 8);
+            if (type == MULTIBOOT2_TAG_ACPI_OLD)
+                found = (const struct acpi_rsdp *)(tag_addr + 8);
+            tag_addr += ((tagsize + 7) & ~7);
+        }
+    }
+    if (found) return found;
+    // Hidden from gcc, which treats pointers into the first page as bogus
+    uint32_t bda = BIOS_EBDA_SEG;
+    __asm__ ("" : "+r"(bda));
+    uint32_t ebda = (uint32_t)*(volatile uint16_t *)bda << 4;
+    if (ebda >= 0x80000 && ebda < 0xA0000 && (found = acpi_scan(ebda, ebda + 1024)))
+        return found;
+    return acpi_scan(BIOS_ROM_START, BIOS_ROM_END);
+}
+
+static const struct acpi_sdt *acpi_find_table(const struct acpi_rsdp *rsdp, const char *sig) {
+    // Tables above 4 GiB aren't reachable without PAE
+    int xsdt = rsdp->revision >= 2 && rsdp->xsdt && rsdp->xsdt < 0x100000000ull;
+    const struct acpi_sdt *root = xsdt ? (const struct acpi_sdt *)(uint32_t)rsdp->xsdt
+                                       : (const struct acpi_sdt *)rsdp->rsdt;
+    if (!root || !acpi_checksum_ok(root, root->length)) return NULL;
+    uint32_t entry = xsdt ? 8 : 4;
+    uint32_t n = (root->length - sizeof(*root)) / entry;
+    const uint8_t *list = (const uint8_t *)(root + 1);
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t addr = xsdt ? *(const uint64_t *)(list + i * 8) : *(const uint32_t *)(list + i * 4);
+        if (!addr || addr >= 0x100000000ull) continue;
+        const struct acpi_sdt *t = (const struct acpi_sdt *)(uint32_t)addr;
+        if (acpi_sig(t->sig, sig, 4) && acpi_checksum_ok(t, t->length))
+            return t;
+    }
+    return NULL;
+}
+
+int hpet_init(uint32_t mb2_addr) {
+    const struct acpi_rsdp *rsdp = acpi_find_rsdp(mb2_addr);
+    if (!rsdp) return -1;
+    const struct acpi_hpet *t = (const struct acpi_hpet *)acpi_find_table(rsdp, "HPET");
+    if (!t || t->space_id != 0 || !t->address || t->address >= 0x100000000ull)
+        return -1;
+
+    volatile uint32_t *regs = mmio_map((uint32_t)t->address, HPET_MMIO_SIZE);
+    uint32_t cap = regs[HPET_REG_CAP / 4];
+    uint32_t period = regs[HPET_REG_CAP / 4 + 1];
+    // A 32-bit counter wraps within minutes; the TSC does better then
+    if (!(cap & HPET_CAP_64BIT) || !period || period > HPET_MAX_PERIOD)
+        return -1;
+    // Only the free-running counter is used, no comparators or legacy routing
+    regs[HPET_REG_CONFIG / 4] |= HPET_CFG_ENABLE;
+    hpet_regs = regs;
+    hpet_period = period;
+    return 0;
+}
+
+// The two halves are read separately, so retry if the high one moved
+uint64_t hpet_read() {
+    uint32_t hi, lo;
+    do {
+        hi = hpet_regs[HPET_REG_COUNTER / 4 + 1];
+        lo = hpet_regs[HPET_REG_COUNTER / 4];
+    } while (hi != hpet_regs[HPET_REG_COUNTER / 4 + 1]);
+    return ((uint64_t)hi << 32) | lo;
+}
+
+uint32_t hpet_period_fs() {
+    return hpet_period;
+}
@@ -0,0 +1,15 @@
+#ifndef HPET_H
+#define HPET_H
+
+#include <stdint.h>
+
+// Find the HPET through the ACPI tables (the RSDP copy GRUB passes in the
+// Multiboot2 info, else the BIOS areas) and start its main counter.
+// -1 if there is none or it only has a 32-bit counter
+int hpet_init(uint32_t mb2_addr);
+// Main counter; only valid after hpet_init succeeded
+uint64_t hpet_read();
+// Femtoseconds per counter tick, 0 without an HPET
+uint32_t hpet_period_fs();
+
+#endif
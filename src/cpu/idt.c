@@ -0,0 +1,68 @@
+#include <stddef.h>
+#include "idt.h"
+#include "pic.h"
+
+#define IDT_ENTRIES 48              // 32 exceptions + 16 IRQs
+#define IDT_GATE_INT32 0x8E         // Present, ring 0, 32-bit interrupt gate
+
+struct idt_entry {
+    uint16_t base_lo;
+    uint16_t sel;
+    uint8_t zero;
+    uint8_t flags;
+    uint16_t base_hi;
+} __attribute__((packed));
+
+struct idt_ptr {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed));
+
+extern uint32_t isr_stub_table[IDT_ENTRIES];
+extern void terminal_write(const char *str);
+
+static struct idt_entry idt[IDT_ENTRIES];
+static irq_handler_t irq_handlers[16];
+
+void idt_init() {
+    uint16_t cs;
+    // Keep whatever code segment the bootloader left us in
+    __asm__ volatile ("mov %%cs, %0" : "=r"(cs));
+    for (int i = 0; i < IDT_ENTRIES; i++) {
+        idt[i].base_lo = isr_stub_table[i] & 0xFFFF;
+        idt[i].base_hi = (isr_stub_table[i] >> 16) & 0xFFFF;
+        idt[i].sel = cs;
+        idt[i].zero = 0;
+        idt[i].flags = IDT_GATE_INT32;
+    }
+    struct idt_ptr ptr = { sizeof(idt) - 1, (uint32_t)(uintptr_t)idt };
+    __asm__ volatile ("lidt %0" : : "m"(ptr));
+    pic_remap();
+}
+
+void irq_install(uint8_t irq, irq_handler_t handler) {
+    irq_handlers[irq] = handler;
+    pic_unmask(irq);
+}
+
+// Called from isr_common with the saved register frame
+void isr_dispatch(struct isr_frame *frame) {
+    if (frame->vector < PIC_VECTOR_BASE) {
+        char msg[] = "\nCPU exception 0x00 - halted\n";
+        msg[17] = "0123456789ABCDEF"[(frame->vector >> 4) & 0xF];
+        msg[18] = "0123456789ABCDEF"[frame->vector & 0xF];
+        terminal_write(msg);
+        while (1) __asm__ volatile ("cli; hlt");
+    }
+
+    uint8_t irq = frame->vector - PIC_VECTOR_BASE;
+    // Spurious IRQ 7/15: no EOI for the line itself (the master still
+    // needs one for a spurious slave interrupt)
+    if ((irq == 7 || irq == 15) && !pic_in_service(irq)) {
+        if (irq == 15) pic_eoi(0);
+        return;
+    }
+    if (irq_handlers[irq])
+        irq_handlers[irq](frame);
+    pic_eoi(irq);
+}
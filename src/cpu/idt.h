@@ -0,0 +1,20 @@
+#ifndef IDT_H
+#define IDT_H
+
+#include <stdint.h>
+
+// Register state pushed by the stubs in isr.s
+struct isr_frame {
+    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;   // pusha
+    uint32_t vector, err_code;
+    uint32_t eip, cs, eflags;                          // pushed by the CPU
+};
+
+typedef void (*irq_handler_t)(struct isr_frame *frame);
+
+// Load the IDT and remap the PIC; interrupts stay disabled until sti
+void idt_init();
+// Register a handler for a hardware IRQ and unmask it at the PIC
+void irq_install(uint8_t irq, irq_handler_t handler);
+
+#endif
@@ -0,0 +1,106 @@
+; Interrupt entry stubs for PulseOS
+; - Vectors 0-31 are CPU exceptions, 32-47 the remapped PIC IRQs
+; - Every stub leaves the same frame: vector, error code (0 if the CPU
+;   pushes none), then isr_common saves the GPRs and calls isr_dispatch
+
+SECTION .text
+extern isr_dispatch
+
+%macro ISR_NOERR 1
+isr_stub_%1:
+    push dword 0
+    push dword %1
+    jmp isr_common
+%endmacro
+
+%macro ISR_ERR 1
+isr_stub_%1:
+    push dword %1
+    jmp isr_common
+%endmacro
+
+ISR_NOERR 0
+ISR_NOERR 1
+ISR_NOERR 2
+ISR_NOERR 3
+ISR_NOERR 4
+ISR_NOERR 5
+ISR_NOERR 6
+ISR_NOERR 7
+ISR_ERR   8
+ISR_NOERR 9
+ISR_ERR   10
+ISR_ERR   11
+ISR_ERR   12
+ISR_ERR   13
+ISR_ERR   14
+ISR_NOERR 15
+ISR_NOERR 16
+ISR_ERR   17
+ISR_NOERR 18
+ISR_NOERR 19
+ISR_NOERR 20
+ISR_ERR   21
+ISR_NOERR 22
+ISR_NOERR 23
+ISR_NOERR 24
+ISR_NOERR 25
+ISR_NOERR 26
+ISR_NOERR 27
+ISR_NOERR 28
+ISR_ERR   29
+ISR_ERR   30
+ISR_NOERR 31
+ISR_NOERR 32
+ISR_NOERR 33
+ISR_NOERR 34
+ISR_NOERR 35
+ISR_NOERR 36
+ISR_NOERR 37
+ISR_NOERR 38
+ISR_NOERR 39
+ISR_NOERR 40
+ISR_NOERR 41
+ISR_NOERR 42
+ISR_NOERR 43
+ISR_NOERR 44
+ISR_NOERR 45
+ISR_NOERR 46
+ISR_NOERR 47
+
+; With SSE enabled (isr_fxsave set by mem_init) the x87/SSE registers are
+; saved below the frame, so handlers may use the SSE mem/str functions
+isr_common:
+    pusha
+    cld
+    mov ebx, esp            ; struct isr_frame *, kept across the call
+    cmp dword [isr_fxsave], 0
+    je .dispatch
+    sub esp, 512
+    and esp, ~15
+    fxsave [esp]
+.dispatch:
+    push ebx
+    call isr_dispatch
+    add esp, 4
+    cmp dword [isr_fxsave], 0
+    je .restored
+    fxrstor [esp]
+.restored:
+    mov esp, ebx
+    popa
+    add esp, 8              ; Drop vector and error code
+    iret
+
+SECTION .data
+global isr_fxsave
+isr_fxsave: dd 0
+
+global isr_stub_table
+isr_stub_table:
+    dd isr_stub_0, isr_stub_1, isr_stub_2, isr_stub_3, isr_stub_4, isr_stub_5, isr_stub_6, isr_stub_7
+    dd isr_stub_8, isr_stub_9, isr_stub_10, isr_stub_11, isr_stub_12, isr_stub_13, isr_stub_14, isr_stub_15
+    dd isr_stub_16, isr_stub_17, isr_stub_18, isr_stub_19, isr_stub_20, isr_stub_21, isr_stub_22, isr_stub_23
+    dd isr_stub_24, isr_stub_25, isr_stub_26, isr_stub_27, isr_stub_28, isr_stub_29, isr_stub_30, isr_stub_31
+    dd isr_stub_32, isr_stub_33, isr_stub_34, isr_stub_35, isr_stub_36, isr_stub_37, isr_stub_38, isr_stub_39
+    dd isr_stub_40, isr_stub_41, isr_stub_42, isr_stub_43, isr_stub_44, isr_stub_45, isr_stub_46, isr_stub_47
@@ -0,0 +1,139 @@
+#include "kbd.h"
+#include "idt.h"
+
+#define KBD_DATA        0x60
+#define KBD_STATUS      0x64
+#define KBD_STAT_OUT    0x01        // Output buffer full
+#define KBD_STAT_IN     0x02        // Input buffer full, controller busy
+#define KBD_STAT_AUX    0x20        // The byte waiting is from the mouse
+#define KBD_CFG_IRQ1    0x01        // Controller config: keyboard interrupt
+#define KBD_RING_SIZE   256         // uint8_t indices wrap on their own
+
+const char kbdus[128] = {
+    /* 0x00 */ 0, 27, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', '\b',
+    /* 0x0F */ '\t', 'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p', '[', ']', '\n',
+    /* 0x1D */ 0, 'a', 's', 'd', 'f', 'g', 'h', 'j', 'k', 'l', ';', '\'', '`',
+    /* 0x2A */ 0, '\\', 'z', 'x', 'c', 'v', 'b', 'n', 'm', ',', '.', '/', 0,
+    '*', 0, ' ', 0,
+    /* 0x39 - 0x7F */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+const char kbdus_shift[128] = {
+    /* 0x00 */ 0, 27, '!', '@', '#', '$', '%', '^', '&', '*', '(', ')', '_', '+', '\b',
+    /* 0x0F */ '\t', 'Q', 'W', 'E', 'R', 'T', 'Y', 'U', 'I', 'O', 'P', '{', '}', '\n',
+    /* 0x1D */ 0, 'A', 'S', 'D', 'F', 'G', 'H', 'J', 'K', 'L', ':', '"', '~',
+    /* 0x2A */ 0, '|', 'Z', 'X', 'C', 'V', 'B', 'N', 'M', '<', '>', '?', 0,
+    '*', 0, ' ', 0,
+    /* 0x39 - 0x7F */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+// Single producer (IRQ1) and single consumer (whoever is reading keys):
+// only the IRQ writes head and only the reader writes tail, so neither
+// side needs to mask interrupts. A full ring drops the new scancode.
+static uint8_t kbd_ring[KBD_RING_SIZE];
+static volatile uint8_t kbd_head, kbd_tail;
+
+// Translation state, owned by the consumer
+static int kbd_shift;
+static int kbd_extended;
+
+static inline void outb(uint16_t port, uint8_t val) {
+    __asm__ volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+static inline uint8_t inb(uint16_t port) {
+    uint8_t ret;
+    __asm__ volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+static void kbd_irq(struct isr_frame *frame) {
+    (void)frame;
+    uint8_t status = inb(KBD_STATUS);
+    if (!(status & KBD_STAT_OUT) || (status & KBD_STAT_AUX))
+        return;
+    uint8_t sc = inb(KBD_DATA);
+    uint8_t head = kbd_head;
+    if ((uint8_t)(head + 1) == kbd_tail)
+        return;
+    kbd_ring[head] = sc;
+    // The slot must be written before the reader can see it
+    __asm__ volatile ("" : : : "memory");
+    kbd_head = head + 1;
+}
+
+static void kbd_ctl_wait() {
+    for (int i = 0; i < 100000 && (inb(KBD_STATUS) & KBD_STAT_IN); i++)
+        ;
+}
+
+static int kbd_ctl_read() {
+    for (int i = 0; i < 100000; i++)
+        if (inb(KBD_STATUS) & KBD_STAT_OUT)
+            return inb(KBD_DATA);
+    return -1;
+}
+
+// Called with interrupts still off, so nothing else is reading port 0x60
+void kbd_init() {
+    while (inb(KBD_STATUS) & KBD_STAT_OUT)
+        inb(KBD_DATA);
+    // Firmware normally leaves IRQ1 on, but polling-only setups don't
+    kbd_ctl_wait();
+    outb(KBD_STATUS, 0x20);
+    int cfg = kbd_ctl_read();
+    if (cfg >= 0 && !(cfg & KBD_CFG_IRQ1)) {
+        kbd_ctl_wait();
+        outb(KBD_STATUS, 0x60);
+        kbd_ctl_wait();
+        outb(KBD_DATA, cfg | KBD_CFG_IRQ1);
+    }
+    irq_install(1, kbd_irq);
+}
+
+int kbd_poll() {
+    while (kbd_tail != kbd_head) {
+        uint8_t sc = kbd_ring[kbd_tail];
+        __asm__ volatile ("" : : : "memory");
+        kbd_tail++;
+
+        if (sc == 0xE0) {
+            kbd_extended = 1;
+            continue;
+        }
+        int extended = kbd_extended;
+        kbd_extended = 0;
+        uint8_t code = sc & 0x7F;
+        if (code == 0x2A || code == 0x36) {
+            // E0-prefixed shifts are fake ones around PrtSc and the like
+            if (!extended) kbd_shift = !(sc & 0x80);
+            continue;
+        }
+        if (sc & 0x80)
+            continue;
+        char c = kbd_shift ? kbdus_shift[code] : kbdus[code];
+        if (c)
+            return (unsigned char)c;
+    }
+    return -1;
+}
+
+// Same check-then-hlt as the disk driver: sti's one-instruction shadow
+// means an IRQ1 landing after the check still wakes the hlt
+void kbd_wait() {
+    __asm__ volatile ("cli");
+    if (kbd_tail == kbd_head)
+        __asm__ volatile ("sti; hlt");
+    else
+        __asm__ volatile ("sti");
+}
+
+int kbd_getc() {
+    int c;
+    while ((c = kbd_poll()) < 0)
+        kbd_wait();
+    return c;
+}
+
+// Drained through kbd_poll so shift releases still update the state
+void kbd_flush() {
+    while (kbd_poll() >= 0)
+        ;
+}
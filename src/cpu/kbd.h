@@ -0,0 +1,21 @@
+#ifndef KBD_H
+#define KBD_H
+
+#include <stdint.h>
+
+// US layout, indexed by set-1 make code
+extern const char kbdus[128];
+extern const char kbdus_shift[128];
+
+// Hook IRQ1; scancodes are queued from then on
+void kbd_init();
+// Next translated key press, or -1 if none is queued
+int kbd_poll();
+// Halt until an interrupt arrives, unless a scancode is already queued
+void kbd_wait();
+// Block until a key is pressed
+int kbd_getc();
+// Drop everything queued, e.g. keys typed before a prompt appeared
+void kbd_flush();
+
+#endif
@@ -0,0 +1,64 @@
+#include "pic.h"
+
+#define PIC1_CMD    0x20
+#define PIC1_DATA   0x21
+#define PIC2_CMD    0xA0
+#define PIC2_DATA   0xA1
+#define PIC_EOI     0x20
+#define PIC_READ_ISR 0x0B
+
+static inline void outb(uint16_t port, uint8_t val) {
+    __asm__ volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+static inline uint8_t inb(uint16_t port) {
+    uint8_t ret;
+    __asm__ volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+// Write to an unused port to give the old 8259s time to settle
+static inline void io_wait() {
+    outb(0x80, 0);
+}
+
+// Reinitialise both 8259s with all lines masked except the cascade
+void pic_remap() {
+    outb(PIC1_CMD, 0x11);               // ICW1: init, expect ICW4
+    io_wait();
+    outb(PIC2_CMD, 0x11);
+    io_wait();
+    outb(PIC1_DATA, PIC_VECTOR_BASE);   // ICW2: vector offsets
+    io_wait();
+    outb(PIC2_DATA, PIC_VECTOR_BASE + 8);
+    io_wait();
+    outb(PIC1_DATA, 0x04);              // ICW3: slave on IRQ2
+    io_wait();
+    outb(PIC2_DATA, 0x02);
+    io_wait();
+    outb(PIC1_DATA, 0x01);              // ICW4: 8086 mode
+    io_wait();
+    outb(PIC2_DATA, 0x01);
+    io_wait();
+    outb(PIC1_DATA, 0xFB);
+    outb(PIC2_DATA, 0xFF);
+}
+
+void pic_unmask(uint8_t irq) {
+    if (irq < 8) outb(PIC1_DATA, inb(PIC1_DATA) & ~(1 << irq));
+    else         outb(PIC2_DATA, inb(PIC2_DATA) & ~(1 << (irq - 8)));
+}
+
+void pic_mask(uint8_t irq) {
+    if (irq < 8) outb(PIC1_DATA, inb(PIC1_DATA) | (1 << irq));
+    else         outb(PIC2_DATA, inb(PIC2_DATA) | (1 << (irq - 8)));
+}
+
+void pic_eoi(uint8_t irq) {
+    if (irq >= 8) outb(PIC2_CMD, PIC_EOI);
+    outb(PIC1_CMD, PIC_EOI);
+}
+
+int pic_in_service(uint8_t irq) {
+    uint16_t port = irq < 8 ? PIC1_CMD : PIC2_CMD;
+    outb(port, PIC_READ_ISR);
+    return (inb(port) >> (irq & 7)) & 1;
+}
@@ -0,0 +1,16 @@
+#ifndef PIC_H
+#define PIC_H
+
+#include <stdint.h>
+
+// IRQ 0-15 are remapped to vectors 0x20-0x2F, clear of CPU exceptions
+#define PIC_VECTOR_BASE 0x20
+
+void pic_remap();
+void pic_unmask(uint8_t irq);
+void pic_mask(uint8_t irq);
+void pic_eoi(uint8_t irq);
+// True if the IRQ is really in service (false for spurious IRQ 7/15)
+int pic_in_service(uint8_t irq);
+
+#endif
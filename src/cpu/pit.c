@@ -0,0 +1,28 @@
+#include "pit.h"
+#include "idt.h"
+#include "timer.h"
+
+#define PIT_BASE_HZ 1193182
+#define PIT_CH0     0x40
+#define PIT_CMD     0x43
+
+volatile uint32_t pit_ticks = 0;
+
+static inline void outb(uint16_t port, uint8_t val) {
+    __asm__ volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+
+static void pit_irq(struct isr_frame *frame) {
+    (void)frame;
+    pit_ticks++;
+    timer_tick();
+}
+
+// Channel 0, rate generator: a steady IRQ0 so hlt always wakes up again
+void pit_init(uint32_t hz) {
+    uint32_t divisor = PIT_BASE_HZ / hz;
+    outb(PIT_CMD, 0x34);
+    outb(PIT_CH0, divisor & 0xFF);
+    outb(PIT_CH0, (divisor >> 8) & 0xFF);
+    irq_install(0, pit_irq);
+}
@@ -0,0 +1,14 @@
+#ifndef PIT_H
+#define PIT_H
+
+#include <stdint.h>
+
+// 1 ms ticks: the timer wheel and msleep resolution
+#define PIT_HZ 1000
+
+// Ticks of IRQ0 since pit_init
+extern volatile uint32_t pit_ticks;
+
+void pit_init(uint32_t hz);
+
+#endif
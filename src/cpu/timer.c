@@ -0,0 +1,264 @@
+#include "timer.h"
+#include "pit.h"
+#include "hpet.h"
+#include "cpu.h"
+#include <stddef.h>
+
+// Hierarchical wheel over PIT ticks: 256 one-tick slots, then three levels
+// of 64 slots each 64 times coarser. A level's slot is cascaded into the
+// finer ones as the level below wraps, so start, cancel and each tick are
+// O(1) and the wheel spans 2^26 ticks; anything further waits in the last
+// level and is cascaded again until it comes into range
+#define WHEEL_ROOT_BITS 8
+#define WHEEL_VEC_BITS  6
+#define WHEEL_LEVELS    3
+#define WHEEL_ROOT_SIZE (1 << WHEEL_ROOT_BITS)
+#define WHEEL_VEC_SIZE  (1 << WHEEL_VEC_BITS)
+#define WHEEL_ROOT_MASK (WHEEL_ROOT_SIZE - 1)
+#define WHEEL_VEC_MASK  (WHEEL_VEC_SIZE - 1)
+#define WHEEL_SPAN      (1u << (WHEEL_ROOT_BITS + WHEEL_LEVELS * WHEEL_VEC_BITS))
+#define WHEEL_SHIFT(l)  (WHEEL_ROOT_BITS + (l) * WHEEL_VEC_BITS)
+
+#define TIMER_CAL_MS    50
+#define CLOCK_SHIFT     24          // clock_mult is ns per count in 8.24 fixed point
+#define CPUID_EXT_MAX   0x80000000
+#define CPUID_EXT_POWER 0x80000007
+#define CPUID_INVARIANT_TSC (1u << 8)
+
+static struct timer *wheel_root[WHEEL_ROOT_SIZE];
+static struct timer *wheel_vec[WHEEL_LEVELS][WHEEL_VEC_SIZE];
+static uint32_t wheel_now;          // Next tick to run
+static uint32_t wheel_pending;
+static uint32_t wheel_fired;
+
+static const char *clock_name = "pit";
+static uint64_t (*clock_read)() = NULL;
+static uint64_t clock_start;        // clock_read() at timer_init
+static uint64_t clock_offset;       // ktime_ns() at timer_init
+static uint32_t clock_mult;
+static uint32_t clock_tsc_khz;
+
+static inline uint32_t irq_save() {
+    uint32_t flags;
+    __asm__ volatile ("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint32_t flags) {
+    if (flags & 0x200) __asm__ volatile ("sti" : : : "memory");
+}
+
+// 64/32 division with divl; there's no libgcc for the generic one
+static uint64_t div64_32(uint64_t n, uint32_t d) {
+    uint32_t hi = n >> 32, lo = (uint32_t)n;
+    uint32_t rem = hi % d;
+    __asm__ ("divl %2" : "+a"(lo), "+d"(rem) : "rm"(d));
+    return ((uint64_t)(hi / d) << 32) | lo;
+}
+
+static uint32_t ms_to_ticks(uint32_t ms) {
+    return ms / 1000 * PIT_HZ + ((ms % 1000) * PIT_HZ + 999) / 1000;
+}
+
+// ============ Wheel =============
+
+static void wheel_add(struct timer *t) {
+    uint32_t expires = t->expires;
+    uint32_t delta = expires - wheel_now;
+    struct timer **slot;
+    if ((int32_t)delta < 0) {
+        slot = &wheel_root[wheel_now & WHEEL_ROOT_MASK];   // Overdue: next tick
+    } else if (delta < WHEEL_ROOT_SIZE) {
+        slot = &wheel_root[expires & WHEEL_ROOT_MASK];
+    } else {
+        int level = 0;
+        while (level < WHEEL_LEVELS - 1 && delta >= 1u << WHEEL_SHIFT(level + 1))
+            level++;
+        if (delta >= WHEEL_SPAN)
+            expires = wheel_now + WHEEL_SPAN - 1;
+        slot = &wheel_vec[level][(expires >> WHEEL_SHIFT(level)) & WHEEL_VEC_MASK];
+    }
+    t->next = *slot;
+    if (t->next) t->next->pprev = &t->next;
+    t->pprev = slot;
+    *slot = t;
+    wheel_pending++;
+}
+
+static void wheel_del(struct timer *t) {
+    *t->pprev = t->next;
+    if (t->next) t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+    wheel_pending--;
+}
+
+// Spread one slot of `level` over the finer levels; returns its index so
+// the caller knows whether this level wrapped too
+static uint32_t wheel_cascade(int level) {
+    uint32_t index = (wheel_now >> WHEEL_SHIFT(level)) & WHEEL_VEC_MASK;
+    struct timer *list = wheel_vec[level][index];
+    if (list) list->pprev = &list;
+    wheel_vec[level][index] = NULL;
+    while (list) {
+        struct timer *t = list;
+        wheel_del(t);
+        wheel_add(t);
+    }
+    return index;
+}
+
+void timer_tick() {
+    while ((int32_t)(pit_ticks - wheel_now) >= 0) {
+        uint32_t index = wheel_now & WHEEL_ROOT_MASK;
+        if (!index && !wheel_cascade(0) && !wheel_cascade(1))
+            wheel_cascade(2);
+        wheel_now++;
+
+        // Moved to a local head so callbacks can start and cancel freely
+        struct timer *list = wheel_root[index];
+        if (list) list->pprev = &list;
+        wheel_root[index] = NULL;
+        while (list) {
+            struct timer *t = list;
+            wheel_del(t);
+            t->fired++;
+            wheel_fired++;
+            if (t->period) {
+                t->expires += t->period;
+                if ((int32_t)(t->expires - wheel_now) < 0)
+                    t->expires = wheel_now;
+                wheel_add(t);
+            }
+            if (t->fn) t->fn(t->arg);
+        }
+    }
+}
+
+void timer_setup(struct timer *t, void (*fn)(void *arg), void *arg) {
+    t->next = NULL;
+    t->pprev = NULL;
+    t->expires = 0;
+    t->period = 0;
+    t->fn = fn;
+    t->arg = arg;
+    t->fired = 0;
+    t->seen = 0;
+}
+
+void timer_start(struct timer *t, uint32_t ms, uint32_t period_ms) {
+    uint32_t ticks = ms_to_ticks(ms);
+    if (ticks > 0x7FFFFFFF) ticks = 0x7FFFFFFF;
+    uint32_t flags = irq_save();
+    if (t->pprev) wheel_del(t);
+    // +1: the current tick is already partly over
+    t->expires = pit_ticks + ticks + 1;
+    t->period = period_ms ? ms_to_ticks(period_ms) : 0;
+    wheel_add(t);
+    irq_restore(flags);
+}
+
+void timer_cancel(struct timer *t) {
+    uint32_t flags = irq_save();
+    if (t->pprev) wheel_del(t);
+    irq_restore(flags);
+}
+
+// Check-then-hlt with interrupts off; sti's shadow covers the gap
+uint32_t timer_wait(struct timer *t) {
+    while (1) {
+        __asm__ volatile ("cli" : : : "memory");
+        uint32_t fired = t->fired;
+        if (fired != t->seen || !t->pprev) {
+            __asm__ volatile ("sti" : : : "memory");
+            uint32_t n = fired - t->seen;
+            t->seen = fired;
+            return n;
+        }
+        __asm__ volatile ("sti; hlt" : : : "memory");
+    }
+}
+
+void msleep(uint32_t ms) {
+    if (!ms) return;
+    struct timer t;
+    timer_setup(&t, NULL, NULL);
+    timer_start(&t, ms, 0);
+    timer_wait(&t);
+}
+
+// ============ Clock source =============
+
+static uint64_t clock_read_tsc() {
+    return rdtsc();
+}
+
+uint64_t ktime_ns() {
+    if (!clock_read)
+        return (uint64_t)pit_ticks * (1000000000 / PIT_HZ);
+    uint64_t delta = clock_read() - clock_start;
+    uint32_t hi = delta >> 32, lo = (uint32_t)delta;
+    return clock_offset + (((uint64_t)hi * clock_mult) << (32 - CLOCK_SHIFT))
+                        + (((uint64_t)lo * clock_mult) >> CLOCK_SHIFT);
+}
+
+static void timer_next_tick() {
+    uint32_t t = pit_ticks;
+    while (pit_ticks == t)
+        __asm__ volatile ("hlt");
+}
+
+// The TSC is cheap to read but only trustworthy across power states when
+// CPUID says it's invariant; otherwise the HPET wins if there is one. The
+// TSC rate is measured against the HPET when present, else the PIT, over
+// the same tick-aligned window
+void timer_init(uint32_t mb2_addr) {
+    int hpet = hpet_init(mb2_addr) == 0;
+
+    timer_next_tick();
+    uint64_t tsc0 = rdtsc();
+    uint64_t hpet0 = hpet ? hpet_read() : 0;
+    uint32_t start = pit_ticks;
+    while (pit_ticks - start < ms_to_ticks(TIMER_CAL_MS))
+        __asm__ volatile ("hlt");
+    uint64_t tsc1 = rdtsc();
+    uint64_t hpet1 = hpet ? hpet_read() : 0;
+    uint32_t ticks = pit_ticks - start;
+
+    uint32_t ns = hpet ? (uint32_t)div64_32((hpet1 - hpet0) * hpet_period_fs(), 1000000)
+                       : ticks * (1000000000 / PIT_HZ);
+    if (ns) clock_tsc_khz = (uint32_t)div64_32((tsc1 - tsc0) * 1000000, ns);
+
+    uint32_t a, b, c, d;
+    int invariant = 0;
+    cpuid(CPUID_EXT_MAX, &a, &b, &c, &d);
+    if (a >= CPUID_EXT_POWER) {
+        cpuid(CPUID_EXT_POWER, &a, &b, &c, &d);
+        invariant = (d & CPUID_INVARIANT_TSC) != 0;
+    }
+
+    uint32_t flags = irq_save();
+    clock_offset = ktime_ns();
+    if (hpet && !invariant) {
+        clock_name = "hpet";
+        clock_read = hpet_read;
+        clock_mult = (uint32_t)div64_32((uint64_t)hpet_period_fs() << CLOCK_SHIFT, 1000000);
+    } else if (clock_tsc_khz >= 4000) {
+        // Below 4 MHz the multiplier wouldn't fit; keep the PIT then
+        clock_name = "tsc";
+        clock_read = clock_read_tsc;
+        clock_mult = (uint32_t)div64_32(1000000ull << CLOCK_SHIFT, clock_tsc_khz);
+    }
+    if (clock_read) clock_start = clock_read();
+    irq_restore(flags);
+}
+
+void timer_get_info(struct timer_info *info) {
+    uint32_t flags = irq_save();
+    info->source = clock_name;
+    info->tsc_khz = clock_tsc_khz;
+    info->hpet_period_fs = hpet_period_fs();
+    info->pending = wheel_pending;
+    info->fired = wheel_fired;
+    irq_restore(flags);
+}
@@ -0,0 +1,48 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+// A one-shot or periodic timer on the tick wheel. Callbacks run in the
+// IRQ0 handler with interrupts off, so they must be short
+struct timer {
+    struct timer *next;
+    struct timer **pprev;           // NULL while not queued
+    uint32_t expires;               // pit_ticks value to fire at
+    uint32_t period;                // Ticks between runs, 0 for one-shot
+    void (*fn)(void *arg);          // May be NULL for timers only waited on
+    void *arg;
+    volatile uint32_t fired;        // Expirations so far
+    uint32_t seen;                  // Expirations timer_wait has returned
+};
+
+struct timer_info {
+    const char *source;             // Clock behind ktime_ns
+    uint32_t tsc_khz;
+    uint32_t hpet_period_fs;        // 0 without an HPET
+    uint32_t pending;               // Timers on the wheel
+    uint32_t fired;                 // Expirations since boot
+};
+
+// Pick and calibrate the clock source. Needs pit_init and interrupts on;
+// takes about 50 ms
+void timer_init(uint32_t mb2_addr);
+// Nanoseconds since pit_init (PIT tick resolution until timer_init)
+uint64_t ktime_ns();
+// Halt until at least `ms` have passed
+void msleep(uint32_t ms);
+
+void timer_setup(struct timer *t, void (*fn)(void *arg), void *arg);
+// (Re)arm to fire after `ms`, then every `period_ms` unless that is 0
+void timer_start(struct timer *t, uint32_t ms, uint32_t period_ms);
+void timer_cancel(struct timer *t);
+// Halt until the timer fires (interrupts must be on); returns how many
+// times it has since the last call, more than 1 if the caller fell behind
+// a periodic timer, and 0 at once for a one-shot that isn't queued
+uint32_t timer_wait(struct timer *t);
+void timer_get_info(struct timer_info *info);
+
+// Advance the wheel; called from the IRQ0 handler
+void timer_tick();
+
+#endif
@@ -0,0 +1,341 @@
+#include <stdint.h>
+#include "ahci.h"
+#include "diskio.h"
+#include "../pci/pci.h"
+#include "../mm/paging.h"
+#include "../cpu/pit.h"
+
+#define SECTOR_SIZE         512
+
+// Generic host control registers
+#define HBA_CAP             0x00
+#define HBA_GHC             0x04
+#define HBA_PI              0x0C
+#define HBA_CAP2            0x24
+#define HBA_BOHC            0x28
+#define HBA_CAP_SNCQ        (1u << 30)
+#define HBA_GHC_AE          (1u << 31)
+
+// Port registers (offsets within the port's 0x80-byte block)
+#define PX_CLB              0x00
+#define PX_CLBU             0x04
+#define PX_FB               0x08
+#define PX_FBU              0x0C
+#define PX_IS               0x10
+#define PX_IE               0x14
+#define PX_CMD              0x18
+#define PX_TFD              0x20
+#define PX_SIG              0x24
+#define PX_SSTS             0x28
+#define PX_SERR             0x30
+#define PX_SACT             0x34
+#define PX_CI               0x38
+#define PX_CMD_ST           (1u << 0)
+#define PX_CMD_FRE          (1u << 4)
+#define PX_CMD_FR           (1u << 14)
+#define PX_CMD_CR           (1u << 15)
+#define PX_IS_TFES          (1u << 30)
+#define PX_TFD_BSY          0x80
+#define PX_TFD_DRQ          0x08
+#define SATA_SIG_ATA        0x00000101
+
+// ATA commands used over the H2D register FIS
+#define ATA_CMD_IDENTIFY        0xEC
+#define ATA_CMD_READ_DMA_EXT    0x25
+#define ATA_CMD_WRITE_DMA_EXT   0x35
+#define ATA_CMD_READ_FPDMA      0x60
+#define ATA_CMD_WRITE_FPDMA     0x61
+#define FIS_TYPE_REG_H2D        0x27
+
+#define AHCI_MAX_SLOTS      32
+#define AHCI_PRDS           DISK_IOV_MAX
+#define AHCI_MAX_SECTORS    256     // Per command, so a large transfer spreads over slots
+#define AHCI_SPIN_LIMIT     1000000
+#define AHCI_TIMEOUT_TICKS  (5 * PIT_HZ)    // A drive that stops answering without TFES
+#define AHCI_BOUNCE_SECTORS (DISK_SEG_SIZE / SECTOR_SIZE)
+
+// Command header: one per slot in the 1K command list
+struct ahci_cmd_header {
+    uint16_t flags;     // CFL[4:0] in dwords, A, W (bit 6), P, R, B, C, PMP
+    uint16_t prdtl;     // PRD entries in the command table
+    volatile uint32_t prdbc;
+    uint32_t ctba;
+    uint32_t ctbau;
+    uint32_t reserved[4];
+};
+
+struct ahci_prd {
+    uint32_t dba;
+    uint32_t dbau;
+    uint32_t reserved;
+    uint32_t dbc;       // Byte count - 1, bit 31 = interrupt on completion
+};
+
+struct ahci_cmd_table {
+    uint8_t cfis[64];
+    uint8_t acmd[16];
+    uint8_t reserved[48];
+    struct ahci_prd prdt[AHCI_PRDS];
+};
+
+// Per-port DMA structures; paging identity-maps memory, so their addresses
+// are the physical ones the HBA needs
+static struct ahci_cmd_header ahci_cmdlist[AHCI_MAX_SLOTS] __attribute__((aligned(1024)));
+static uint8_t ahci_fis[256] __attribute__((aligned(256)));
+static struct ahci_cmd_table ahci_tables[AHCI_MAX_SLOTS] __attribute__((aligned(128)));
+static uint16_t ahci_identify[256] __attribute__((aligned(4)));
+
+static uintptr_t ahci_abar = 0;
+static int ahci_port = -1;
+static uint32_t ahci_nslots = 1;
+static int ahci_ncq = 0;
+static uint32_t ahci_busy = 0;      // Slots issued and not yet reaped
+static uint32_t ahci_failed = 0;    // Reaped slots that completed with an error
+
+// MMIO access macros
+#define HBA_REG(offset) (*(volatile uint32_t *)(ahci_abar + (offset)))
+#define PORT_REG(offset) HBA_REG(0x100 + ahci_port * 0x80 + (offset))
+#define HBA_SIZE            (0x100 + 32 * 0x80)
+
+static int ahci_spin_clear(uint32_t offset, uint32_t bits) {
+    for (int i = 0; i < AHCI_SPIN_LIMIT; i++)
+        if (!(PORT_REG(offset) & bits)) return 0;
+    return -1;
+}
+
+static void ahci_stop_port() {
+    PORT_REG(PX_CMD) &= ~PX_CMD_ST;
+    ahci_spin_clear(PX_CMD, PX_CMD_CR);
+    PORT_REG(PX_CMD) &= ~PX_CMD_FRE;
+    ahci_spin_clear(PX_CMD, PX_CMD_FR);
+}
+
+static int ahci_start_port() {
+    PORT_REG(PX_SERR) = 0xFFFFFFFF;
+    PORT_REG(PX_IS) = 0xFFFFFFFF;
+    PORT_REG(PX_CMD) |= PX_CMD_FRE;
+    if (ahci_spin_clear(PX_TFD, PX_TFD_BSY | PX_TFD_DRQ) < 0) return -1;
+    PORT_REG(PX_CMD) |= PX_CMD_ST;
+    return 0;
+}
+
+// Fill a slot's header, FIS and one PRD per segment; caller sets SACT/CI
+static void ahci_build(int slot, uint8_t cmd, uint32_t lba, const struct disk_iovec *seg,
+                       uint32_t nseg, uint32_t sectors, int write) {
+    struct ahci_cmd_table *t = &ahci_tables[slot];
+    uint8_t *fis = t->cfis;
+    for (int i = 0; i < 20; i++) fis[i] = 0;
+    fis[0] = FIS_TYPE_REG_H2D;
+    fis[1] = 0x80;                          // C: this is a command
+    fis[2] = cmd;
+    fis[4] = lba & 0xFF;
+    fis[5] = (lba >> 8) & 0xFF;
+    fis[6] = (lba >> 16) & 0xFF;
+    fis[7] = cmd == ATA_CMD_IDENTIFY ? 0 : 0x40;   // LBA mode
+    fis[8] = (lba >> 24) & 0xFF;
+    if (cmd == ATA_CMD_READ_FPDMA || cmd == ATA_CMD_WRITE_FPDMA) {
+        // NCQ: sector count moves to FEATURES, the tag goes in COUNT[7:3]
+        fis[3] = sectors & 0xFF;
+        fis[11] = (sectors >> 8) & 0xFF;
+        fis[12] = slot << 3;
+    } else {
+        fis[12] = sectors & 0xFF;
+        fis[13] = (sectors >> 8) & 0xFF;
+    }
+
+    for (uint32_t i = 0; i < nseg; i++) {
+        t->prdt[i].dba = (uint32_t)(uintptr_t)seg[i].base;
+        t->prdt[i].dbau = 0;
+        t->prdt[i].reserved = 0;
+        t->prdt[i].dbc = seg[i].sectors * SECTOR_SIZE - 1;
+    }
+
+    struct ahci_cmd_header *h = &ahci_cmdlist[slot];
+    h->flags = 5 | (write ? (1 << 6) : 0); // 5-dword H2D FIS
+    h->prdtl = nseg;
+    h->prdbc = 0;
+}
+
+// Task file error: the port halts and aborts everything outstanding
+static void ahci_recover() {
+    ahci_stop_port();
+    ahci_failed |= ahci_busy;
+    ahci_busy = 0;
+    ahci_start_port();
+}
+
+uint32_t ahci_poll() {
+    if (PORT_REG(PX_IS) & PX_IS_TFES) {
+        ahci_recover();
+        return 0;
+    }
+    uint32_t pending = PORT_REG(PX_CI);
+    if (ahci_ncq) pending |= PORT_REG(PX_SACT);
+    ahci_busy &= pending;
+    return ahci_busy;
+}
+
+static int ahci_expired(uint32_t deadline) {
+    return (int32_t)(pit_ticks - deadline) >= 0;
+}
+
+// A hung command is treated like a task file error: the port restarts and
+// everything outstanding fails
+int ahci_wait(uint32_t mask) {
+    uint32_t deadline = pit_ticks + AHCI_TIMEOUT_TICKS;
+    while (ahci_poll() & mask) {
+        if (ahci_expired(deadline)) {
+            ahci_recover();
+            break;
+        }
+    }
+    if (ahci_failed & mask) {
+        ahci_failed &= ~mask;
+        return -1;
+    }
+    return 0;
+}
+
+int ahci_submit(uint32_t lba, const struct disk_iovec *seg, uint32_t nseg,
+                uint32_t sectors, int write) {
+    int slot = -1;
+    for (uint32_t i = 0; i < ahci_nslots; i++)
+        if (!(ahci_busy & (1u << i))) { slot = i; break; }
+    if (slot < 0) return -1;
+
+    uint8_t cmd;
+    if (ahci_ncq) cmd = write ? ATA_CMD_WRITE_FPDMA : ATA_CMD_READ_FPDMA;
+    else          cmd = write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+    ahci_build(slot, cmd, lba, seg, nseg, sectors, write);
+
+    ahci_busy |= 1u << slot;
+    ahci_failed &= ~(1u << slot);
+    if (ahci_ncq) PORT_REG(PX_SACT) = 1u << slot;
+    PORT_REG(PX_CI) = 1u << slot;
+    return slot;
+}
+
+// Spread the transfer over as many slots as are free, one PRD per segment;
+// the drive reorders queued commands itself, so they all complete in one wait
+static int ahci_rw(uint32_t lba, const struct disk_iovec *iov, uint32_t iovcnt, int write) {
+    struct disk_iov_cursor cur = { iov, iovcnt, 0, 0 };
+    struct disk_iovec seg[AHCI_PRDS];
+    uint32_t nseg, count, mask = 0;
+    while ((count = disk_iov_next(&cur, AHCI_MAX_SECTORS, AHCI_PRDS, seg, &nseg))) {
+        int slot;
+        uint32_t deadline = pit_ticks + AHCI_TIMEOUT_TICKS;
+        while ((slot = ahci_submit(lba, seg, nseg, count, write)) < 0) {
+            ahci_poll();
+            // Stop before a failed slot of ours is reused and its error lost
+            if (ahci_failed & mask)
+                return ahci_wait(mask);
+            if (ahci_expired(deadline)) {
+                ahci_recover();
+                ahci_wait(mask);
+                return -1;
+            }
+        }
+        mask |= 1u << slot;
+        lba += count;
+    }
+    return ahci_wait(mask);
+}
+
+// PRD data addresses must be word aligned; odd segments go through a bounce
+static int ahci_rw_bounce(uint32_t lba, uint8_t *buf, uint32_t sectors, int write) {
+    uint8_t *bounce = disk_seg_alloc();
+    if (!bounce) return -1;
+    int ret = 0;
+    while (sectors && ret == 0) {
+        uint32_t count = sectors > AHCI_BOUNCE_SECTORS ? AHCI_BOUNCE_SECTORS : sectors;
+        uint32_t bytes = count * SECTOR_SIZE;
+        struct disk_iovec seg = { bounce, count };
+        if (write)
+            for (uint32_t i = 0; i < bytes; i++) bounce[i] = buf[i];
+        ret = ahci_rw(lba, &seg, 1, write);
+        if (!write && ret == 0)
+            for (uint32_t i = 0; i < bytes; i++) buf[i] = bounce[i];
+        buf += bytes;
+        lba += count;
+        sectors -= count;
+    }
+    disk_seg_free(bounce);
+    return ret;
+}
+
+int ahci_rwv(uint32_t lba, const struct disk_iovec *iov, uint32_t iovcnt, int write) {
+    int aligned = 1;
+    for (uint32_t i = 0; i < iovcnt; i++)
+        if ((uintptr_t)iov[i].base & 1) aligned = 0;
+    if (aligned) return ahci_rw(lba, iov, iovcnt, write);
+
+    for (uint32_t i = 0; i < iovcnt; i++) {
+        int ret = ((uintptr_t)iov[i].base & 1)
+                ? ahci_rw_bounce(lba, iov[i].base, iov[i].sectors, write)
+                : ahci_rw(lba, &iov[i], 1, write);
+        if (ret < 0) return -1;
+        lba += iov[i].sectors;
+    }
+    return 0;
+}
+
+uint32_t ahci_capacity() {
+    return disk_identify_sectors(ahci_identify);
+}
+
+int ahci_init() {
+    struct pci_device dev;
+    if (pci_find_class(0x01, 0x06, &dev) < 0) return -1;
+    uint32_t bar5 = pci_read_bar(&dev, 5);
+    if (bar5 & 1) return -1;    // ABAR must be memory space
+    pci_enable_bus_master(&dev);
+    ahci_abar = (uintptr_t)mmio_map(bar5 & 0xFFFFFFF0, HBA_SIZE);
+
+    // Take ownership from firmware if it supports the BIOS/OS handoff
+    if (HBA_REG(HBA_CAP2) & 1) {
+        HBA_REG(HBA_BOHC) |= 2;
+        for (int i = 0; i < AHCI_SPIN_LIMIT && (HBA_REG(HBA_BOHC) & 1); i++);
+    }
+    HBA_REG(HBA_GHC) |= HBA_GHC_AE;
+
+    // First implemented port with an active link and an ATA signature
+    uint32_t pi = HBA_REG(HBA_PI);
+    for (int p = 0; p < 32 && ahci_port < 0; p++) {
+        if (!(pi & (1u << p))) continue;
+        ahci_port = p;
+        uint32_t ssts = PORT_REG(PX_SSTS);
+        if ((ssts & 0x0F) != 3 || ((ssts >> 8) & 0x0F) != 1 || PORT_REG(PX_SIG) != SATA_SIG_ATA)
+            ahci_port = -1;
+    }
+    if (ahci_port < 0) return -1;
+
+    ahci_stop_port();
+    for (int i = 0; i < AHCI_MAX_SLOTS; i++) {
+        ahci_cmdlist[i].ctba = (uint32_t)(uintptr_t)&ahci_tables[i];
+        ahci_cmdlist[i].ctbau = 0;
+    }
+    PORT_REG(PX_CLB) = (uint32_t)(uintptr_t)ahci_cmdlist;
+    PORT_REG(PX_CLBU) = 0;
+    PORT_REG(PX_FB) = (uint32_t)(uintptr_t)ahci_fis;
+    PORT_REG(PX_FBU) = 0;
+    PORT_REG(PX_IE) = 0;        // Completion is polled
+    if (ahci_start_port() < 0) return -1;
+
+    // IDENTIFY in slot 0 decides whether NCQ can be used
+    struct disk_iovec id_seg = { (uint8_t *)ahci_identify, 1 };
+    ahci_build(0, ATA_CMD_IDENTIFY, 0, &id_seg, 1, 0, 0);
+    ahci_busy = 1;
+    PORT_REG(PX_CI) = 1;
+    if (ahci_wait(1) < 0) return -1;
+
+    uint32_t cap = HBA_REG(HBA_CAP);
+    uint32_t hba_slots = ((cap >> 8) & 0x1F) + 1;
+    if ((cap & HBA_CAP_SNCQ) && (ahci_identify[76] & (1 << 8))) {
+        uint32_t depth = (ahci_identify[75] & 0x1F) + 1;   // Word 75: queue depth - 1
+        ahci_ncq = 1;
+        ahci_nslots = depth < hba_slots ? depth : hba_slots;
+    } else {
+        ahci_nslots = hba_slots;
+    }
+    return 0;
+}
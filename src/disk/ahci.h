@@ -0,0 +1,23 @@
+#ifndef AHCI_H
+#define AHCI_H
+
+#include <stdint.h>
+#include "diskio.h"
+
+// Probe PCI class 01:06 and bring up the first SATA disk; returns 0 if found
+int ahci_init();
+// Sectors on the disk, from its IDENTIFY data
+uint32_t ahci_capacity();
+int ahci_rwv(uint32_t lba, const struct disk_iovec *iov, uint32_t iovcnt, int write);
+
+// Queue one command of `sectors` over up to DISK_IOV_MAX segments in a free
+// slot (READ/WRITE FPDMA QUEUED when the drive supports NCQ) without
+// waiting; returns the slot number or -1 if all busy
+int ahci_submit(uint32_t lba, const struct disk_iovec *seg, uint32_t nseg,
+                uint32_t sectors, int write);
+// Reap finished slots; returns the mask of slots still outstanding
+uint32_t ahci_poll();
+// Wait for every slot in `mask`; returns -1 if any of them failed
+int ahci_wait(uint32_t mask);
+
+#endif
@@ -0,0 +1,244 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "bcache.h"
+#include "diskio.h"
+#include "blkq.h"
+
+#define SECTOR_SIZE         512
+#define BCACHE_HASH_SIZE    128     // Power of two
+#define BCACHE_RUN_SECTORS  DISK_IOV_MAX   // Longest run written back in one command
+
+extern void *memcpy(void *d, const void *s, size_t n);
+
+struct bcache_buf {
+    uint32_t lba;
+    uint8_t valid;
+    uint8_t dirty;
+    uint8_t inflight;   // Queued writebacks still referencing `data`; pins the buffer
+    uint8_t loading;    // Readahead queued; `data` is not valid until it completes
+    struct bcache_buf *hash_next;
+    struct bcache_buf *lru_prev, *lru_next;    // Head = most recently used
+    uint8_t data[SECTOR_SIZE];
+};
+
+static struct bcache_buf bcache_pool[BCACHE_MAX_BUFFERS];
+static struct bcache_buf *bcache_hash[BCACHE_HASH_SIZE];
+static struct bcache_buf *lru_head = NULL, *lru_tail = NULL;
+static uint32_t bcache_limit = BCACHE_DEFAULT_BUDGET / SECTOR_SIZE;
+static uint32_t bcache_used = 0;    // Pool entries handed out so far
+static struct bcache_stats bcache_counters;
+
+static struct bcache_buf *bcache_lookup(uint32_t lba) {
+    struct bcache_buf *b = bcache_hash[lba & (BCACHE_HASH_SIZE - 1)];
+    while (b && b->lba != lba) b = b->hash_next;
+    return b;
+}
+
+static void hash_insert(struct bcache_buf *b) {
+    struct bcache_buf **head = &bcache_hash[b->lba & (BCACHE_HASH_SIZE - 1)];
+    b->hash_next = *head;
+    *head = b;
+}
+
+static void hash_remove(struct bcache_buf *b) {
+    struct bcache_buf **p = &bcache_hash[b->lba & (BCACHE_HASH_SIZE - 1)];
+    while (*p && *p != b) p = &(*p)->hash_next;
+    if (*p) *p = b->hash_next;
+}
+
+static void lru_unlink(struct bcache_buf *b) {
+    if (b->lru_prev) b->lru_prev->lru_next = b->lru_next; else lru_head = b->lru_next;
+    if (b->lru_next) b->lru_next->lru_prev = b->lru_prev; else lru_tail = b->lru_prev;
+    b->lru_prev = b->lru_next = NULL;
+}
+
+static void lru_push_front(struct bcache_buf *b) {
+    b->lru_prev = NULL;
+    b->lru_next = lru_head;
+    if (lru_head) lru_head->lru_prev = b; else lru_tail = b;
+    lru_head = b;
+}
+
+static void lru_touch(struct bcache_buf *b) {
+    if (lru_head == b) return;
+    lru_unlink(b);
+    lru_push_front(b);
+}
+
+// Write `b` and the dirty sectors that directly follow it as one command,
+// straight out of the buffers with one segment each
+static int bcache_writeback_run(struct bcache_buf *b) {
+    struct bcache_buf *run[BCACHE_RUN_SECTORS];
+    struct disk_iovec iov[BCACHE_RUN_SECTORS];
+    uint32_t start = b->lba, n = 0;
+    while (b && b->dirty && n < BCACHE_RUN_SECTORS) {
+        run[n] = b;
+        iov[n].base = b->data;
+        iov[n].sectors = 1;
+        n++;
+        b = bcache_lookup(b->lba + 1);
+    }
+    if (disk_writev(start, iov, n) < 0) return -1;
+    for (uint32_t i = 0; i < n; i++) run[i]->dirty = 0;
+    bcache_counters.writebacks += n;
+    return 0;
+}
+
+// Drop the least recently used buffer, writing it back first if dirty
+static int bcache_evict(struct bcache_buf *b) {
+    if (b->dirty && bcache_writeback_run(b) < 0) return -1;
+    hash_remove(b);
+    lru_unlink(b);
+    b->valid = 0;
+    bcache_counters.evictions++;
+    return 0;
+}
+
+// Get a buffer for `lba`, from the unused pool or by evicting the least
+// recently used buffer that has no writeback queued
+static struct bcache_buf *bcache_alloc(uint32_t lba) {
+    struct bcache_buf *b;
+    if (bcache_used < bcache_limit) {
+        b = &bcache_pool[bcache_used++];
+    } else {
+        b = lru_tail;
+        while (b && b->inflight) b = b->lru_prev;
+        if (!b) {
+            blk_flush();
+            b = lru_tail;
+        }
+        if (!b || bcache_evict(b) < 0) return NULL;
+    }
+    b->lba = lba;
+    b->valid = 1;
+    b->dirty = 0;
+    b->inflight = 0;
+    b->loading = 0;
+    hash_insert(b);
+    lru_push_front(b);
+    return b;
+}
+
+// Sector lookup that waits out a queued readahead of it first
+static struct bcache_buf *bcache_get(uint32_t lba) {
+    struct bcache_buf *b = bcache_lookup(lba);
+    if (b && b->loading) {
+        blk_flush();
+        b = bcache_lookup(lba);     // Dropped if the read failed
+    }
+    return b;
+}
+
+int bcache_read(uint32_t lba, uint8_t *buf, uint32_t sectors) {
+    uint32_t i = 0;
+    while (i < sectors) {
+        struct bcache_buf *b = bcache_get(lba + i);
+        if (b) {
+            bcache_counters.hits++;
+            memcpy(buf + i * SECTOR_SIZE, b->data, SECTOR_SIZE);
+            lru_touch(b);
+            i++;
+            continue;
+        }
+        // Fetch the whole run of misses with one multi-sector read
+        uint32_t run = 1;
+        while (i + run < sectors && !bcache_lookup(lba + i + run)) run++;
+        if (disk_read(lba + i, buf + i * SECTOR_SIZE, run) < 0) return -1;
+        bcache_counters.misses += run;
+        for (uint32_t j = 0; j < run; j++) {
+            b = bcache_alloc(lba + i + j);
+            if (b) memcpy(b->data, buf + (i + j) * SECTOR_SIZE, SECTOR_SIZE);
+        }
+        i += run;
+    }
+    return 0;
+}
+
+int bcache_write(uint32_t lba, const uint8_t *buf, uint32_t sectors) {
+    for (uint32_t i = 0; i < sectors; i++) {
+        struct bcache_buf *b = bcache_get(lba + i);
+        if (b) {
+            lru_touch(b);
+        } else if (!(b = bcache_alloc(lba + i))) {
+            // Cache can't take it (writeback failed): go straight to disk
+            if (disk_write(lba + i, buf + i * SECTOR_SIZE, 1) < 0) return -1;
+            continue;
+        }
+        memcpy(b->data, buf + i * SECTOR_SIZE, SECTOR_SIZE);
+        b->dirty = 1;
+    }
+    return 0;
+}
+
+static void bcache_read_done(void *ctx, int status) {
+    struct bcache_buf *b = ctx;
+    b->inflight--;
+    b->loading = 0;
+    if (status < 0) {
+        // Leave it on the LRU list to be recycled, but unreachable by LBA
+        hash_remove(b);
+        b->valid = 0;
+    }
+}
+
+// Queue reads of the uncached sectors in the range straight into fresh
+// buffers; the request queue merges them into one command per run
+void bcache_readahead(uint32_t lba, uint32_t sectors) {
+    for (uint32_t i = 0; i < sectors; i++) {
+        if (bcache_lookup(lba + i)) continue;
+        struct bcache_buf *b = bcache_alloc(lba + i);
+        if (!b) return;
+        b->loading = 1;
+        b->inflight++;
+        bcache_counters.readaheads++;
+        blk_submit(b->lba, b->data, 1, 0, bcache_read_done, b);
+    }
+}
+
+static void bcache_write_done(void *ctx, int status) {
+    struct bcache_buf *b = ctx;
+    b->inflight--;
+    if (status < 0)
+        b->dirty = 1;
+    else
+        bcache_counters.writebacks++;
+}
+
+// The request queue sorts these and merges adjacent LBAs into one command.
+// A sector rewritten before dispatch is simply dirty again: the queued
+// write carries the newer data and a later writeback repeats it.
+void bcache_writeback_async() {
+    for (uint32_t i = 0; i < bcache_used; i++) {
+        struct bcache_buf *b = &bcache_pool[i];
+        if (!b->valid || !b->dirty) continue;
+        b->dirty = 0;
+        b->inflight++;
+        blk_submit(b->lba, b->data, 1, 1, bcache_write_done, b);
+    }
+}
+
+int bcache_sync() {
+    bcache_writeback_async();
+    return blk_flush();
+}
+
+int bcache_set_budget(uint32_t bytes) {
+    uint32_t limit = bytes / SECTOR_SIZE;
+    if (limit < 1) limit = 1;
+    if (limit > BCACHE_MAX_BUFFERS) limit = BCACHE_MAX_BUFFERS;
+
+    if (limit < bcache_used) {
+        // Compact: evict everything, then the pool refills up to the new limit
+        if (bcache_sync() < 0) return -1;
+        for (uint32_t i = 0; i < BCACHE_HASH_SIZE; i++) bcache_hash[i] = NULL;
+        for (uint32_t i = 0; i < bcache_used; i++) bcache_pool[i].valid = 0;
+        lru_head = lru_tail = NULL;
+        bcache_used = 0;
+    }
+    bcache_limit = limit;
+    return 0;
+}
+
+void bcache_get_stats(struct bcache_stats *out) {
+    *out = bcache_counters;
+}
@@ -0,0 +1,33 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stdint.h>
+
+#define BCACHE_MAX_BUFFERS      256                 // Static pool: 128 KiB of sector data
+#define BCACHE_DEFAULT_BUDGET   (64 * 512)          // Bytes of sector data in use by default
+
+struct bcache_stats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t writebacks;    // Dirty sectors written to disk (eviction or sync)
+    uint32_t evictions;
+    uint32_t readaheads;    // Sectors queued by bcache_readahead
+};
+
+// Write-back sector cache in front of disk_read/disk_write
+int bcache_read(uint32_t lba, uint8_t *buf, uint32_t sectors);
+int bcache_write(uint32_t lba, const uint8_t *buf, uint32_t sectors);
+// Queue reads of the uncached sectors in the range and return at once;
+// bcache_read of a sector still loading waits for it
+void bcache_readahead(uint32_t lba, uint32_t sectors);
+// Queue every dirty sector on the block request queue and return at once;
+// blk_idle()/blk_flush() dispatch them
+void bcache_writeback_async();
+// Write every dirty sector back to disk and wait, coalescing adjacent LBAs
+int bcache_sync();
+// Limit cached sector data to `bytes` (capped by the static pool); shrinking
+// below what is in use writes everything back and empties the cache
+int bcache_set_budget(uint32_t bytes);
+void bcache_get_stats(struct bcache_stats *out);
+
+#endif
@@ -0,0 +1,107 @@
+#include <stdint.h>
+#include "blkq.h"
+#include "diskio.h"
+
+struct blk_request {
+    uint32_t lba;
+    uint32_t sectors;
+    uint8_t *buf;
+    uint8_t write;
+    blk_done_t done;
+    void *ctx;
+};
+
+// Pending requests, kept sorted by LBA (stable, so same-LBA order holds)
+static struct blk_request blkq[BLKQ_DEPTH];
+static uint32_t blkq_count = 0;
+static uint32_t blkq_head = 0;      // LBA just past the last dispatch
+static int blkq_error = 0;          // Set when a dispatch fails, for blk_flush
+
+// Request b's buffer continues a's in memory, so both fit one DMA segment
+static inline int blkq_contiguous(const struct blk_request *a, const struct blk_request *b) {
+    return a->buf + a->sectors * 512 == b->buf;
+}
+
+// Issue requests r[0..n) as one vectored command, one DMA segment per run
+// of buffers that are adjacent in memory
+static int blkq_dispatch(struct blk_request *r, uint32_t n) {
+    struct disk_iovec iov[DISK_IOV_MAX];
+    uint32_t nseg = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (nseg && blkq_contiguous(&r[i - 1], &r[i])) {
+            iov[nseg - 1].sectors += r[i].sectors;
+            continue;
+        }
+        iov[nseg].base = r[i].buf;
+        iov[nseg].sectors = r[i].sectors;
+        nseg++;
+    }
+    if (r[0].write) return disk_writev(r[0].lba, iov, nseg);
+    return disk_readv(r[0].lba, iov, nseg);
+}
+
+int blk_idle() {
+    if (!blkq_count) return 0;
+
+    // C-LOOK: continue upward from the head, wrap to the lowest LBA at the end
+    uint32_t start = 0;
+    while (start < blkq_count && blkq[start].lba < blkq_head) start++;
+    if (start == blkq_count) start = 0;
+
+    // Merge following requests in the same direction that continue the run
+    uint32_t end = start + 1, total = blkq[start].sectors, nseg = 1;
+    while (end < blkq_count &&
+           blkq[end].write == blkq[start].write &&
+           blkq[end - 1].lba + blkq[end - 1].sectors == blkq[end].lba &&
+           total + blkq[end].sectors <= BLKQ_MERGE_MAX) {
+        uint32_t seg = !blkq_contiguous(&blkq[end - 1], &blkq[end]);
+        if (nseg + seg > DISK_IOV_MAX) break;
+        nseg += seg;
+        total += blkq[end].sectors;
+        end++;
+    }
+
+    int status = blkq_dispatch(&blkq[start], end - start);
+    if (status < 0) blkq_error = 1;
+    blkq_head = blkq[start].lba + total;
+
+    // Dequeue before running callbacks so they are free to submit more
+    struct blk_request done[BLKQ_DEPTH];
+    uint32_t n = end - start;
+    for (uint32_t i = 0; i < n; i++) done[i] = blkq[start + i];
+    for (uint32_t i = end; i < blkq_count; i++) blkq[i - n] = blkq[i];
+    blkq_count -= n;
+    for (uint32_t i = 0; i < n; i++)
+        if (done[i].done) done[i].done(done[i].ctx, status);
+    return 1;
+}
+
+int blk_flush() {
+    blkq_error = 0;
+    while (blk_idle());
+    return blkq_error ? -1 : 0;
+}
+
+int blk_submit(uint32_t lba, uint8_t *buf, uint32_t sectors, int write,
+               blk_done_t done, void *ctx) {
+    if (!sectors) return -1;
+    if (blkq_count == BLKQ_DEPTH) blk_idle();
+
+    uint32_t pos = blkq_count;
+    while (pos > 0 && blkq[pos - 1].lba > lba) {
+        blkq[pos] = blkq[pos - 1];
+        pos--;
+    }
+    blkq[pos].lba = lba;
+    blkq[pos].sectors = sectors;
+    blkq[pos].buf = buf;
+    blkq[pos].write = write ? 1 : 0;
+    blkq[pos].done = done;
+    blkq[pos].ctx = ctx;
+    blkq_count++;
+    return 0;
+}
+
+uint32_t blk_pending() {
+    return blkq_count;
+}
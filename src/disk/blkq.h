@@ -0,0 +1,22 @@
+#ifndef BLKQ_H
+#define BLKQ_H
+
+#include <stdint.h>
+
+#define BLKQ_DEPTH      64      // Pending requests before submit dispatches inline
+#define BLKQ_MERGE_MAX  64      // Sectors per merged command
+
+// Completion callback; status is 0 or -1
+typedef void (*blk_done_t)(void *ctx, int status);
+
+// Queue a transfer; `buf` must stay valid until `done` runs. Never blocks
+// unless the queue is full.
+int blk_submit(uint32_t lba, uint8_t *buf, uint32_t sectors, int write,
+               blk_done_t done, void *ctx);
+// Dispatch one merged command in C-LOOK order; returns 1 if work was done
+int blk_idle();
+// Dispatch until the queue is empty; returns -1 if any request failed
+int blk_flush();
+uint32_t blk_pending();
+
+#endif
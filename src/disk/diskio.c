@@ -1,11 +1,53 @@
 #include <stdint.h>
 #include "diskio.h"
+#include "ahci.h"
+#include "virtio_blk.h"
+#include "ramdisk.h"
+#include "../pci/pci.h"
+#include "../cpu/cpu.h"
+#include "../cpu/idt.h"
+#include "../cpu/pit.h"
 
 // ATA Primary channel I/O ports (for QEMU/Bochs, first IDE disk)
 #define ATA_PRIMARY_IO      0x1F0
 #define ATA_PRIMARY_CTRL    0x3F6
 #define SECTOR_SIZE         512
 
+// Status register bits
+#define ATA_SR_ERR          0x01
+#define ATA_SR_DRQ          0x08
+#define ATA_SR_DF           0x20
+#define ATA_SR_BSY          0x80
+
+// Commands
+#define ATA_CMD_READ_SECTORS    0x20
+#define ATA_CMD_WRITE_SECTORS   0x30
+#define ATA_CMD_READ_MULTIPLE   0xC4
+#define ATA_CMD_WRITE_MULTIPLE  0xC5
+#define ATA_CMD_SET_MULTIPLE    0xC6
+#define ATA_CMD_IDENTIFY        0xEC
+#define ATA_CMD_READ_DMA        0xC8
+#define ATA_CMD_WRITE_DMA       0xCA
+#define ATA_CMD_READ_DMA_EXT    0x25
+#define ATA_CMD_WRITE_DMA_EXT   0x35
+
+// Bus-master IDE registers (offsets from BAR4, primary channel)
+#define BM_CMD              0x00
+#define BM_STATUS           0x02
+#define BM_PRDT             0x04
+#define BM_CMD_START        0x01
+#define BM_CMD_READ         0x08    // Bus master writes to memory (disk read)
+#define BM_SR_ACTIVE        0x01
+#define BM_SR_ERR           0x02
+#define BM_SR_IRQ           0x04
+
+#define ATA_MAX_SECTORS     256     // Sector count register 0 means 256
+#define ATA_TIMEOUT_MS      5000
+#define ATA_TIMEOUT_TICKS   (ATA_TIMEOUT_MS * PIT_HZ / 1000)
+#define ATA_SPIN_LIMIT      10000000    // Status reads before a polled wait gives up
+#define ATA_CTRL_SRST       0x04
+#define ATA_CTRL_NIEN       0x02
+
 // I/O port helpers
 static inline void outb(uint16_t port, uint8_t val) {
     __asm__ volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
@@ -15,59 +57,421 @@ static inline uint8_t inb(uint16_t port) {
     __asm__ volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
     return ret;
 }
-static inline uint16_t inw(uint16_t port) {
-    uint16_t ret;
-    __asm__ volatile ("inw %1, %0" : "=a"(ret) : "Nd"(port));
+static inline void outl(uint16_t port, uint32_t val) {
+    __asm__ volatile ("outl %0, %1" : : "a"(val), "Nd"(port));
+}
+// String I/O: move a whole DRQ block in one instruction instead of a word loop
+static inline void insw(uint16_t port, void *buf, uint32_t words) {
+    __asm__ volatile ("rep insw" : "+D"(buf), "+c"(words) : "d"(port) : "memory");
+}
+static inline void outsw(uint16_t port, const void *buf, uint32_t words) {
+    __asm__ volatile ("rep outsw" : "+S"(buf), "+c"(words) : "d"(port) : "memory");
+}
+
+// Backend selection, made on first access unless a ramdisk was chosen
+#define DISK_BACKEND_ATA    0
+#define DISK_BACKEND_AHCI   1
+#define DISK_BACKEND_VIRTIO 2
+#define DISK_BACKEND_RAM    3
+static int disk_probed = 0;
+static int disk_backend = DISK_BACKEND_ATA;
+
+// Drive state filled in by IDENTIFY
+static uint32_t ata_multiple = 0;   // Sectors per DRQ block, 0 = READ/WRITE MULTIPLE unused
+static int ata_lba48 = 0;
+static uint32_t ata_sectors = 0;
+static uint16_t bmide_base = 0;     // Bus-master I/O base, 0 = DMA unavailable
+
+// Completion state: the IRQ14 handler's status read also acks INTRQ
+static int ata_use_irq = 0;
+static volatile int ata_irq_pending = 0;
+static volatile uint8_t ata_irq_status = 0;
+static struct disk_stats disk_counters;
+
+// DMA-safe segment buffers: page aligned, so never across a 64K boundary
+static uint8_t disk_seg_pool[DISK_SEG_COUNT][DISK_SEG_SIZE] __attribute__((aligned(4096)));
+static uint32_t disk_seg_used = 0;
+
+// Physical Region Descriptor: one contiguous chunk that must not cross 64K
+struct ata_prd {
+    uint32_t addr;
+    uint16_t count;     // Bytes, 0 = 64K
+    uint16_t flags;     // Bit 15: end of table
+} __attribute__((packed));
+
+// Each segment may add a split per 64K line it crosses
+#define ATA_PRD_MAX (2 * DISK_IOV_MAX + 4)
+// Aligning to a power of two at least its size keeps the table itself
+// inside one 64K window
+static struct ata_prd ata_prdt[ATA_PRD_MAX] __attribute__((aligned(2048)));
+
+// ~400ns delay: four reads of the alternate status register
+static void ata_delay() {
+    for (int i = 0; i < 4; i++) inb(ATA_PRIMARY_CTRL);
+}
+
+// Pulse SRST so a drive that stopped responding accepts the next command
+static void ata_soft_reset() {
+    uint8_t ctrl = ata_use_irq ? 0 : ATA_CTRL_NIEN;
+    outb(ATA_PRIMARY_CTRL, ctrl | ATA_CTRL_SRST);
+    ata_delay();
+    outb(ATA_PRIMARY_CTRL, ctrl);
+    for (uint32_t i = 0; i < ATA_SPIN_LIMIT && (inb(ATA_PRIMARY_IO + 7) & ATA_SR_BSY); i++);
+}
+
+// Poll until BSY clears (and DRQ sets if `drq`); bounded, and fails on ERR/DF
+static int ata_poll(int drq) {
+    uint64_t start = rdtsc();
+    int ret = -1;
+    uint32_t i;
+    for (i = 0; i < ATA_SPIN_LIMIT; i++) {
+        uint8_t st = inb(ATA_PRIMARY_IO + 7);
+        if (st & ATA_SR_BSY) continue;
+        if (st & (ATA_SR_ERR | ATA_SR_DF)) {
+            disk_counters.errors++;
+            break;
+        }
+        if (!drq || (st & ATA_SR_DRQ)) {
+            ret = 0;
+            break;
+        }
+    }
+    disk_counters.spin_cycles += rdtsc() - start;
+    if (i == ATA_SPIN_LIMIT) {
+        disk_counters.timeouts++;
+        ata_soft_reset();
+    }
     return ret;
 }
-static inline void outw(uint16_t port, uint16_t val) {
-    __asm__ volatile ("outw %0, %1" : : "a"(val), "Nd"(port));
+
+// Halt until IRQ14 signals the drive finished a step. The timer and any
+// other unmasked IRQs (the keyboard ring included) keep running. The
+// check-then-hlt runs with interrupts off and relies on sti's
+// one-instruction shadow so a wakeup can't be lost.
+static int ata_sleep(int drq) {
+    uint64_t start = rdtsc();
+    uint32_t deadline = pit_ticks + ATA_TIMEOUT_TICKS;
+    __asm__ volatile ("cli");
+    while (!ata_irq_pending && (int32_t)(pit_ticks - deadline) < 0)
+        __asm__ volatile ("sti; hlt; cli");
+    int fired = ata_irq_pending;
+    ata_irq_pending = 0;
+    __asm__ volatile ("sti");
+    disk_counters.sleep_cycles += rdtsc() - start;
+
+    if (!fired) {
+        disk_counters.timeouts++;
+        ata_soft_reset();
+        return -1;
+    }
+    uint8_t st = ata_irq_status;
+    if (st & (ATA_SR_ERR | ATA_SR_DF)) {
+        disk_counters.errors++;
+        return -1;
+    }
+    if ((st & ATA_SR_BSY) || (drq && !(st & ATA_SR_DRQ)))
+        return ata_poll(drq);   // Status raced the IRQ; finish off by polling
+    return 0;
 }
 
-// Wait until drive is ready to transfer (BSY clear, DRQ set)
-static void ata_wait() {
-    while (inb(ATA_PRIMARY_IO + 7) & 0x80);      // Wait for BSY = 0
-    while (!(inb(ATA_PRIMARY_IO + 7) & 0x08));   // Wait for DRQ = 1
+// Wait for the next step of the current command: BSY clear, plus DRQ if
+// `drq`. Interrupt-driven once IRQ14 is wired up and interrupts are on.
+static int ata_wait(int drq) {
+    if (ata_use_irq && cpu_interrupts_enabled()) return ata_sleep(drq);
+    return ata_poll(drq);
 }
 
-// Read sectors from disk using LBA
-int disk_read(uint32_t lba, uint8_t *buf, uint32_t sectors) {
-    for (uint32_t s = 0; s < sectors; s++) {
-        // Setup registers for PIO LBA read
-        outb(ATA_PRIMARY_IO + 2, 1); // sector count
-        outb(ATA_PRIMARY_IO + 3, (uint8_t)((lba + s) & 0xFF));         // LBA low
-        outb(ATA_PRIMARY_IO + 4, (uint8_t)(((lba + s) >> 8) & 0xFF));  // LBA mid
-        outb(ATA_PRIMARY_IO + 5, (uint8_t)(((lba + s) >> 16) & 0xFF)); // LBA high
-        outb(ATA_PRIMARY_IO + 6, 0xE0 | (((lba + s) >> 24) & 0x0F));   // drive/head
-        outb(ATA_PRIMARY_IO + 7, 0x20); // READ SECTORS
-
-        ata_wait();
-
-        uint16_t *ptr = (uint16_t*)(buf + s * SECTOR_SIZE);
-        for (int i = 0; i < SECTOR_SIZE / 2; i++) { // 256 words = 512 bytes
-            ptr[i] = inw(ATA_PRIMARY_IO);
+static void ata_irq(struct isr_frame *frame) {
+    (void)frame;
+    ata_irq_status = inb(ATA_PRIMARY_IO + 7);
+    if (bmide_base) outb(bmide_base + BM_STATUS, BM_SR_IRQ);
+    ata_irq_pending = 1;
+    disk_counters.irqs++;
+}
+
+// The secondary channel is unused, but a stray INTRQ there still needs acking
+static void ata_irq_secondary(struct isr_frame *frame) {
+    (void)frame;
+    inb(0x177);
+}
+
+// Program the task file for an LBA28 command covering `count` sectors
+static void ata_issue(uint32_t lba, uint32_t count, uint8_t cmd) {
+    outb(ATA_PRIMARY_IO + 2, (uint8_t)(count & 0xFF));        // sector count (0 = 256)
+    outb(ATA_PRIMARY_IO + 3, (uint8_t)(lba & 0xFF));          // LBA low
+    outb(ATA_PRIMARY_IO + 4, (uint8_t)((lba >> 8) & 0xFF));   // LBA mid
+    outb(ATA_PRIMARY_IO + 5, (uint8_t)((lba >> 16) & 0xFF));  // LBA high
+    outb(ATA_PRIMARY_IO + 6, 0xE0 | ((lba >> 24) & 0x0F));    // drive/head
+    ata_irq_pending = 0;
+    outb(ATA_PRIMARY_IO + 7, cmd);
+    ata_delay();
+}
+
+// LBA48 variant: high-order bytes go in first, through the same registers
+static void ata_issue48(uint32_t lba, uint32_t count, uint8_t cmd) {
+    outb(ATA_PRIMARY_IO + 6, 0x40);
+    outb(ATA_PRIMARY_IO + 2, (uint8_t)((count >> 8) & 0xFF));
+    outb(ATA_PRIMARY_IO + 3, (uint8_t)((lba >> 24) & 0xFF));
+    outb(ATA_PRIMARY_IO + 4, 0);
+    outb(ATA_PRIMARY_IO + 5, 0);
+    outb(ATA_PRIMARY_IO + 2, (uint8_t)(count & 0xFF));
+    outb(ATA_PRIMARY_IO + 3, (uint8_t)(lba & 0xFF));
+    outb(ATA_PRIMARY_IO + 4, (uint8_t)((lba >> 8) & 0xFF));
+    outb(ATA_PRIMARY_IO + 5, (uint8_t)((lba >> 16) & 0xFF));
+    ata_irq_pending = 0;
+    outb(ATA_PRIMARY_IO + 7, cmd);
+    ata_delay();
+}
+
+// Find a PCI IDE controller whose primary channel is in compatibility mode
+// (so it drives ports 0x1F0/0x3F6) and which can bus-master
+static void bmide_probe() {
+    struct pci_device dev;
+    if (pci_find_class(0x01, 0x01, &dev) < 0) return;
+    if (!(dev.prog_if & 0x80) || (dev.prog_if & 0x01)) return;
+    uint32_t bar4 = pci_read_bar(&dev, 4);
+    if (!(bar4 & 1)) return;   // Must be an I/O BAR
+    pci_enable_bus_master(&dev);
+    bmide_base = bar4 & 0xFFFC;
+}
+
+// IDENTIFY the master drive and enable READ/WRITE MULTIPLE if supported.
+// Probing is polled; IRQ14/15 are wired up afterwards if the IDT is live.
+static void ata_probe() {
+    uint16_t id[256];
+    outb(ATA_PRIMARY_CTRL, ATA_CTRL_NIEN);
+    outb(ATA_PRIMARY_IO + 6, 0xA0);
+    ata_delay();
+    outb(ATA_PRIMARY_IO + 7, ATA_CMD_IDENTIFY);
+    ata_delay();
+    uint8_t st = inb(ATA_PRIMARY_IO + 7);
+    if (st == 0 || st == 0xFF) return;  // No drive / floating bus
+    if (ata_wait(1) < 0) return;
+    insw(ATA_PRIMARY_IO, id, 256);
+
+    ata_lba48 = (id[83] >> 10) & 1;
+    ata_sectors = disk_identify_sectors(id);
+    if (id[49] & (1 << 8))      // Word 49 bit 8: DMA supported
+        bmide_probe();
+
+    // Word 47 bits 7:0: max sectors per DRQ block for READ/WRITE MULTIPLE
+    uint32_t max_multiple = id[47] & 0xFF;
+    if (max_multiple >= 2) {
+        ata_issue(0, max_multiple, ATA_CMD_SET_MULTIPLE);
+        if (ata_wait(0) == 0)
+            ata_multiple = max_multiple;
+    }
+
+    if (cpu_interrupts_enabled()) {
+        irq_install(14, ata_irq);
+        irq_install(15, ata_irq_secondary);
+        outb(ATA_PRIMARY_CTRL, 0);      // Clear nIEN: let the drive assert INTRQ
+        ata_use_irq = 1;
+    }
+}
+
+// Prefer virtio-blk (QEMU), then AHCI (q35 and most current hardware),
+// else the legacy channel
+static void disk_probe() {
+    disk_probed = 1;
+    if (virtio_blk_init() == 0)
+        disk_backend = DISK_BACKEND_VIRTIO;
+    else if (ahci_init() == 0)
+        disk_backend = DISK_BACKEND_AHCI;
+    else
+        ata_probe();
+}
+
+uint32_t disk_iov_next(struct disk_iov_cursor *c, uint32_t max_sectors, uint32_t max_segs,
+                       struct disk_iovec *out, uint32_t *nout) {
+    uint32_t total = 0, n = 0;
+    while (c->idx < c->cnt && n < max_segs && total < max_sectors) {
+        const struct disk_iovec *v = &c->iov[c->idx];
+        if (!v->sectors) {
+            c->idx++;
+            continue;
+        }
+        uint32_t take = v->sectors - c->off;
+        if (take > max_sectors - total) take = max_sectors - total;
+        out[n].base = v->base + c->off * SECTOR_SIZE;
+        out[n].sectors = take;
+        n++;
+        total += take;
+        c->off += take;
+        if (c->off == v->sectors) {
+            c->idx++;
+            c->off = 0;
         }
     }
+    *nout = n;
+    return total;
+}
+
+// Append `bytes` at `addr` to the PRD table, split on 64K boundaries
+static int ata_add_prds(int n, uint32_t addr, uint32_t bytes) {
+    while (bytes) {
+        if (n == ATA_PRD_MAX) return -1;
+        uint32_t chunk = 0x10000 - (addr & 0xFFFF);
+        if (chunk > bytes) chunk = bytes;
+        ata_prdt[n].addr = addr;
+        ata_prdt[n].count = (uint16_t)chunk;
+        ata_prdt[n].flags = 0;
+        addr += chunk;
+        bytes -= chunk;
+        n++;
+    }
+    return n;
+}
+
+// One READ/WRITE DMA command over up to 256 sectors of segments; BSY stays
+// set until the transfer is done, so completion is the same wait as for PIO
+static int ata_dma_transfer(uint32_t lba, const struct disk_iovec *seg, uint32_t nseg,
+                            uint32_t count, int write) {
+    uint8_t dir = write ? 0 : BM_CMD_READ;
+    int n = 0;
+    for (uint32_t i = 0; i < nseg; i++)
+        if ((n = ata_add_prds(n, (uint32_t)(uintptr_t)seg[i].base, seg[i].sectors * SECTOR_SIZE)) < 0)
+            return -1;
+    ata_prdt[n - 1].flags = 0x8000;
+
+    outl(bmide_base + BM_PRDT, (uint32_t)(uintptr_t)ata_prdt);
+    outb(bmide_base + BM_CMD, dir);
+    outb(bmide_base + BM_STATUS, BM_SR_ERR | BM_SR_IRQ);   // RW1C
+
+    if (ata_lba48 && lba + count > 0x10000000)
+        ata_issue48(lba, count, write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT);
+    else
+        ata_issue(lba, count, write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+    outb(bmide_base + BM_CMD, dir | BM_CMD_START);
+
+    int err = ata_wait(0);
+    uint8_t bm = inb(bmide_base + BM_STATUS);
+    outb(bmide_base + BM_CMD, dir);                        // Stop the engine
+    outb(bmide_base + BM_STATUS, BM_SR_ERR | BM_SR_IRQ);
+    return (err < 0 || (bm & BM_SR_ERR)) ? -1 : 0;
+}
+
+// One multi-sector PIO command; each DRQ block (`block` sectors, or fewer
+// for the tail) is moved with string I/O, a segment piece at a time
+static int ata_pio_transfer(uint32_t lba, const struct disk_iovec *seg, uint32_t nseg,
+                            uint32_t count, int write) {
+    uint32_t block = ata_multiple ? ata_multiple : 1;
+    uint8_t cmd;
+    if (write) cmd = ata_multiple ? ATA_CMD_WRITE_MULTIPLE : ATA_CMD_WRITE_SECTORS;
+    else       cmd = ata_multiple ? ATA_CMD_READ_MULTIPLE : ATA_CMD_READ_SECTORS;
+    ata_issue(lba, count, cmd);
+
+    uint32_t si = 0, soff = 0;
+    for (uint32_t done = 0; done < count; done += block) {
+        uint32_t n = count - done < block ? count - done : block;
+        if (write) {
+            // No interrupt precedes the first block of a PIO write
+            if ((done == 0 ? ata_poll(1) : ata_wait(1)) < 0) return -1;
+        } else {
+            if (ata_wait(1) < 0) return -1;
+        }
+        while (n && si < nseg) {
+            uint32_t piece = seg[si].sectors - soff < n ? seg[si].sectors - soff : n;
+            uint8_t *p = seg[si].base + soff * SECTOR_SIZE;
+            if (write) outsw(ATA_PRIMARY_IO, p, piece * (SECTOR_SIZE / 2));
+            else       insw(ATA_PRIMARY_IO, p, piece * (SECTOR_SIZE / 2));
+            n -= piece;
+            soff += piece;
+            if (soff == seg[si].sectors) {
+                si++;
+                soff = 0;
+            }
+        }
+    }
+    // Let the drive commit the last block before the next command
+    if (write && ata_wait(0) < 0) return -1;
     return 0;
 }
 
+static int ata_rwv(uint32_t lba, const struct disk_iovec *iov, uint32_t iovcnt, int write) {
+    // PRD addresses must be word aligned; odd segments take the PIO path
+    int dma = bmide_base != 0;
+    for (uint32_t i = 0; i < iovcnt; i++)
+        if ((uintptr_t)iov[i].base & 1) dma = 0;
+
+    struct disk_iov_cursor cur = { iov, iovcnt, 0, 0 };
+    struct disk_iovec seg[DISK_IOV_MAX];
+    uint32_t nseg, count;
+    while ((count = disk_iov_next(&cur, ATA_MAX_SECTORS, DISK_IOV_MAX, seg, &nseg))) {
+        int ret = dma ? ata_dma_transfer(lba, seg, nseg, count, write)
+                      : ata_pio_transfer(lba, seg, nseg, count, write);
+        if (ret < 0) return -1;
+        lba += count;
+    }
+    return 0;
+}
+
+static int disk_rwv(uint32_t lba, const struct disk_iovec *iov, uint32_t iovcnt, int write) {
+    if (!disk_probed) disk_probe();
+    if (disk_backend == DISK_BACKEND_RAM) return ramdisk_rwv(lba, iov, iovcnt, write);
+    if (disk_backend == DISK_BACKEND_VIRTIO) return virtio_blk_rwv(lba, iov, iovcnt, write);
+    if (disk_backend == DISK_BACKEND_AHCI) return ahci_rwv(lba, iov, iovcnt, write);
+    return ata_rwv(lba, iov, iovcnt, write);
+}
+
+int disk_readv(uint32_t lba, const struct disk_iovec *iov, uint32_t iovcnt) {
+    return disk_rwv(lba, iov, iovcnt, 0);
+}
+
+int disk_writev(uint32_t lba, const struct disk_iovec *iov, uint32_t iovcnt) {
+    return disk_rwv(lba, iov, iovcnt, 1);
+}
+
+// Read sectors from disk using LBA
+int disk_read(uint32_t lba, uint8_t *buf, uint32_t sectors) {
+    struct disk_iovec iov = { buf, sectors };
+    return disk_rwv(lba, &iov, 1, 0);
+}
+
 // Write sectors to disk using LBA
 int disk_write(uint32_t lba, const uint8_t *buf, uint32_t sectors) {
-    for (uint32_t s = 0; s < sectors; s++) {
-        // Setup registers for PIO LBA write
-        outb(ATA_PRIMARY_IO + 2, 1); // sector count
-        outb(ATA_PRIMARY_IO + 3, (uint8_t)((lba + s) & 0xFF));         // LBA low
-        outb(ATA_PRIMARY_IO + 4, (uint8_t)(((lba + s) >> 8) & 0xFF));  // LBA mid
-        outb(ATA_PRIMARY_IO + 5, (uint8_t)(((lba + s) >> 16) & 0xFF)); // LBA high
-        outb(ATA_PRIMARY_IO + 6, 0xE0 | (((lba + s) >> 24) & 0x0F));   // drive/head
-        outb(ATA_PRIMARY_IO + 7, 0x30); // WRITE SECTORS
-
-        ata_wait();
-
-        const uint16_t *ptr = (const uint16_t*)(buf + s * SECTOR_SIZE);
-        for (int i = 0; i < SECTOR_SIZE / 2; i++) { // 256 words = 512 bytes
-            outw(ATA_PRIMARY_IO, ptr[i]);
+    struct disk_iovec iov = { (uint8_t *)buf, sectors };
+    return disk_rwv(lba, &iov, 1, 1);
+}
+
+int disk_use_ramdisk(uint32_t sectors) {
+    if (!ramdisk_init(sectors)) return -1;
+    disk_probed = 1;
+    disk_backend = DISK_BACKEND_RAM;
+    return 0;
+}
+
+uint32_t disk_capacity() {
+    if (!disk_probed) disk_probe();
+    if (disk_backend == DISK_BACKEND_RAM) return ramdisk_sectors();
+    if (disk_backend == DISK_BACKEND_VIRTIO) return virtio_blk_capacity();
+    if (disk_backend == DISK_BACKEND_AHCI) return ahci_capacity();
+    return ata_sectors;
+}
+
+uint32_t disk_identify_sectors(const uint16_t *id) {
+    if ((id[83] >> 10) & 1) {
+        if (id[102] || id[103]) return 0xFFFFFFFF;
+        return id[100] | (uint32_t)id[101] << 16;
+    }
+    return id[60] | (uint32_t)id[61] << 16;
+}
+
+uint8_t *disk_seg_alloc() {
+    for (int i = 0; i < DISK_SEG_COUNT; i++) {
+        if (!(disk_seg_used & (1u << i))) {
+            disk_seg_used |= 1u << i;
+            return disk_seg_pool[i];
         }
     }
     return 0;
-}
\ No newline at end of file
+}
+
+void disk_seg_free(uint8_t *seg) {
+    uint32_t i = (uint32_t)(seg - &disk_seg_pool[0][0]) / DISK_SEG_SIZE;
+    if (i < DISK_SEG_COUNT) disk_seg_used &= ~(1u << i);
+}
+
+void disk_get_stats(struct disk_stats *out) {
+    *out = disk_counters;
+}
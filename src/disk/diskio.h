@@ -3,7 +3,56 @@
 
 #include <stdint.h>
 
+// Wait accounting for the ATA backend, in TSC cycles
+struct disk_stats {
+    uint64_t spin_cycles;   // Burnt polling the status register
+    uint64_t sleep_cycles;  // Spent halted waiting for IRQ14
+    uint32_t irqs;
+    uint32_t timeouts;
+    uint32_t errors;
+};
+
+// One segment of a vectored transfer, in whole sectors
+struct disk_iovec {
+    uint8_t *base;
+    uint32_t sectors;
+};
+
+#define DISK_IOV_MAX    64      // Segments per command: a BLKQ_MERGE_MAX run of single sectors
+#define DISK_SEG_SIZE   4096
+#define DISK_SEG_COUNT  16
+
 int disk_read(uint32_t lba, uint8_t *buf, uint32_t sectors);
 int disk_write(uint32_t lba, const uint8_t *buf, uint32_t sectors);
+// Scatter/gather: segments cover consecutive LBAs starting at `lba`
+int disk_readv(uint32_t lba, const struct disk_iovec *iov, uint32_t iovcnt);
+int disk_writev(uint32_t lba, const struct disk_iovec *iov, uint32_t iovcnt);
+
+// Put everything on a ramdisk of `sectors` instead of the probed disk; call
+// before the first access
+int disk_use_ramdisk(uint32_t sectors);
+// Sectors on the device, 0 if unknown
+uint32_t disk_capacity();
+
+// DMA-safe buffers (page aligned, word aligned, never across 64K)
+uint8_t *disk_seg_alloc();
+void disk_seg_free(uint8_t *seg);
+
+// For drivers: walk a segment list one command at a time
+struct disk_iov_cursor {
+    const struct disk_iovec *iov;
+    uint32_t cnt;
+    uint32_t idx;       // Current segment
+    uint32_t off;       // Sectors already consumed from it
+};
+// Take up to `max_sectors` in at most `max_segs` pieces; returns sectors taken
+uint32_t disk_iov_next(struct disk_iov_cursor *c, uint32_t max_sectors, uint32_t max_segs,
+                       struct disk_iovec *out, uint32_t *nout);
+
+// Addressable sectors from IDENTIFY DEVICE data: words 100-103 when the
+// drive does LBA48, else 60-61; clamped to 32-bit LBAs
+uint32_t disk_identify_sectors(const uint16_t *id);
+
+void disk_get_stats(struct disk_stats *out);
 
-#endif
\ No newline at end of file
+#endif
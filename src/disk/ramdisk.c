@@ -0,0 +1,63 @@
+#include "ramdisk.h"
+#include "../mm/page.h"
+#include <stddef.h>
+
+#define SECTOR_SIZE 512
+#define RAMDISK_ORDER_SECTORS(o) (((uint32_t)PAGE_SIZE << (o)) / SECTOR_SIZE)
+#define RAMDISK_CHUNK_SECTORS RAMDISK_ORDER_SECTORS(PAGE_MAX_ORDER)
+#define RAMDISK_CHUNKS (RAMDISK_MAX_SECTORS / RAMDISK_CHUNK_SECTORS)
+
+// The disk is a row of the largest blocks the page allocator hands out
+static uint8_t *ramdisk_chunks[RAMDISK_CHUNKS];
+static uint32_t ramdisk_size = 0;   // Sectors in use
+
+static inline void ramdisk_copy(void *dst, const void *src, uint32_t bytes) {
+    uint32_t d0, d1, d2;
+    __asm__ volatile ("rep movsl" : "=&D"(d0), "=&S"(d1), "=&c"(d2)
+                      : "0"(dst), "1"(src), "2"(bytes / 4) : "memory");
+}
+
+uint32_t ramdisk_init(uint32_t sectors) {
+    for (uint32_t c = 0; c < RAMDISK_CHUNKS; c++) {
+        page_free(ramdisk_chunks[c]);
+        ramdisk_chunks[c] = NULL;
+    }
+    if (sectors > RAMDISK_MAX_SECTORS) sectors = RAMDISK_MAX_SECTORS;
+    ramdisk_size = 0;
+    while (ramdisk_size < sectors) {
+        // The last chunk only as big as it needs to be
+        uint32_t order = 0, want = sectors - ramdisk_size;
+        while (order < PAGE_MAX_ORDER && RAMDISK_ORDER_SECTORS(order) < want) order++;
+        uint8_t *chunk = page_alloc(order);
+        if (!chunk) break;
+        uint32_t n = RAMDISK_ORDER_SECTORS(order);
+        uint32_t *p = (uint32_t *)chunk;
+        for (uint32_t i = 0; i < n * SECTOR_SIZE / 4; i++) p[i] = 0;
+        ramdisk_chunks[ramdisk_size / RAMDISK_CHUNK_SECTORS] = chunk;
+        ramdisk_size += n < want ? n : want;
+    }
+    return ramdisk_size;
+}
+
+uint32_t ramdisk_sectors() {
+    return ramdisk_size;
+}
+
+int ramdisk_rwv(uint32_t lba, const struct disk_iovec *iov, uint32_t iovcnt, int write) {
+    for (uint32_t i = 0; i < iovcnt; i++) {
+        if (lba >= ramdisk_size || iov[i].sectors > ramdisk_size - lba) return -1;
+        // A segment can straddle two chunks
+        for (uint32_t done = 0; done < iov[i].sectors; ) {
+            uint32_t in = lba % RAMDISK_CHUNK_SECTORS;
+            uint32_t n = RAMDISK_CHUNK_SECTORS - in;
+            if (n > iov[i].sectors - done) n = iov[i].sectors - done;
+            uint8_t *disk = ramdisk_chunks[lba / RAMDISK_CHUNK_SECTORS] + in * SECTOR_SIZE;
+            uint8_t *mem = iov[i].base + done * SECTOR_SIZE;
+            if (write) ramdisk_copy(disk, mem, n * SECTOR_SIZE);
+            else       ramdisk_copy(mem, disk, n * SECTOR_SIZE);
+            done += n;
+            lba += n;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef RAMDISK_H
+#define RAMDISK_H
+
+#include <stdint.h>
+#include "diskio.h"
+
+#define RAMDISK_MAX_SECTORS 262144  // 128 MiB, taken from the page allocator
+
+// Size the ramdisk (clamped to RAMDISK_MAX_SECTORS and to the free memory)
+// and clear it; returns the sectors it got, 0 if none
+uint32_t ramdisk_init(uint32_t sectors);
+uint32_t ramdisk_sectors();
+int ramdisk_rwv(uint32_t lba, const struct disk_iovec *iov, uint32_t iovcnt, int write);
+
+#endif
@@ -0,0 +1,357 @@
+#include <stdint.h>
+#include "virtio_blk.h"
+#include "diskio.h"
+#include "../pci/pci.h"
+#include "../cpu/pit.h"
+#include "../mm/paging.h"
+
+#define SECTOR_SIZE         512
+
+// PCI IDs
+#define VIRTIO_VENDOR           0x1AF4
+#define VIRTIO_BLK_LEGACY_ID    0x1001  // Transitional: legacy I/O BAR0 + modern caps
+#define VIRTIO_BLK_MODERN_ID    0x1042
+
+// Device status bits
+#define VIRTIO_STATUS_ACK           1
+#define VIRTIO_STATUS_DRIVER        2
+#define VIRTIO_STATUS_DRIVER_OK     4
+#define VIRTIO_STATUS_FEATURES_OK   8
+
+// Legacy I/O register block (BAR0)
+#define VIRTIO_LEG_GUEST_FEATURES   0x04
+#define VIRTIO_LEG_QUEUE_PFN        0x08
+#define VIRTIO_LEG_QUEUE_SIZE       0x0C
+#define VIRTIO_LEG_QUEUE_SELECT     0x0E
+#define VIRTIO_LEG_QUEUE_NOTIFY     0x10
+#define VIRTIO_LEG_STATUS           0x12
+#define VIRTIO_LEG_DEVICE_CFG       0x14    // Without MSI-X, which we never enable
+
+// Modern capabilities (vendor-specific, id 0x09) and common config layout
+#define PCI_CAP_VENDOR              0x09
+#define VIRTIO_CAP_COMMON           1
+#define VIRTIO_CAP_NOTIFY           2
+#define VIRTIO_CAP_DEVICE           4
+#define VIRTIO_COM_DFSELECT         0x00
+#define VIRTIO_COM_DF               0x04
+#define VIRTIO_COM_GFSELECT         0x08
+#define VIRTIO_COM_GF               0x0C
+#define VIRTIO_COM_STATUS           0x14
+#define VIRTIO_COM_Q_SELECT         0x16
+#define VIRTIO_COM_Q_SIZE           0x18
+#define VIRTIO_COM_Q_ENABLE         0x1C
+#define VIRTIO_COM_Q_NOFF           0x1E
+#define VIRTIO_COM_Q_DESC           0x20
+#define VIRTIO_COM_Q_AVAIL          0x28
+#define VIRTIO_COM_Q_USED           0x30
+#define VIRTIO_F_VERSION_1_HI       (1u << 0)   // Feature bit 32
+#define VIRTIO_BLK_CFG_CAPACITY     0x00        // u64, in 512-byte sectors
+
+// Ring flags
+#define VRING_DESC_F_NEXT           1
+#define VRING_DESC_F_WRITE          2
+#define VRING_AVAIL_F_NO_INTERRUPT  1
+#define VRING_USED_F_NO_NOTIFY      1
+
+// Block request types
+#define VIRTIO_BLK_T_IN             0
+#define VIRTIO_BLK_T_OUT            1
+
+#define VQ_MAX_SIZE         256
+#define VBLK_MAX_REQS       64          // Requests per batch (2 + segments descriptors each)
+#define VBLK_MAX_SECTORS    256         // Sectors per request
+#define VBLK_TIMEOUT_TICKS  (5 * PIT_HZ)
+
+struct vring_desc {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+};
+
+struct vring_avail {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+};
+
+struct vring_used_elem {
+    uint32_t id;
+    uint32_t len;
+};
+
+struct vring_used {
+    uint16_t flags;
+    uint16_t idx;
+    struct vring_used_elem ring[];
+};
+
+struct virtio_blk_req {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+};
+
+// Legacy layout for up to 256 entries: descriptors + avail ring, then the
+// used ring on the next 4K boundary. Modern devices take the same addresses.
+static uint8_t vq_mem[3 * 4096] __attribute__((aligned(4096)));
+static struct vring_desc *vq_desc;
+static struct vring_avail *vq_avail;
+static volatile struct vring_used *vq_used;
+static uint16_t vq_size = 0;
+static uint16_t vq_last_used = 0;
+
+static struct virtio_blk_req vblk_hdr[VBLK_MAX_REQS];
+static volatile uint8_t vblk_status[VBLK_MAX_REQS];
+static uint32_t vblk_max_reqs = 0;
+static uint32_t vblk_max_segs = 0;    // Data descriptors per chain
+static uint64_t vblk_sectors = 0;
+
+// Transport: legacy port I/O or modern MMIO
+static struct pci_device vblk_dev;      // Kept to bring the device back after a reset
+static int vblk_modern = 0;
+static uint16_t vblk_iobase = 0;
+static uintptr_t vblk_common = 0;
+static uintptr_t vblk_notify = 0;
+
+static inline void outb(uint16_t port, uint8_t val) {
+    __asm__ volatile ("outb %0, %1" : : "a"(val), "Nd"(port));
+}
+static inline uint8_t inb(uint16_t port) {
+    uint8_t ret;
+    __asm__ volatile ("inb %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+static inline void outw(uint16_t port, uint16_t val) {
+    __asm__ volatile ("outw %0, %1" : : "a"(val), "Nd"(port));
+}
+static inline uint16_t inw(uint16_t port) {
+    uint16_t ret;
+    __asm__ volatile ("inw %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+static inline void outl(uint16_t port, uint32_t val) {
+    __asm__ volatile ("outl %0, %1" : : "a"(val), "Nd"(port));
+}
+static inline uint32_t inl(uint16_t port) {
+    uint32_t ret;
+    __asm__ volatile ("inl %1, %0" : "=a"(ret) : "Nd"(port));
+    return ret;
+}
+
+#define COM8(off)  (*(volatile uint8_t *)(vblk_common + (off)))
+#define COM16(off) (*(volatile uint16_t *)(vblk_common + (off)))
+#define COM32(off) (*(volatile uint32_t *)(vblk_common + (off)))
+
+static uint8_t vblk_get_status() {
+    return vblk_modern ? COM8(VIRTIO_COM_STATUS) : inb(vblk_iobase + VIRTIO_LEG_STATUS);
+}
+
+static void vblk_set_status(uint8_t st) {
+    if (vblk_modern) COM8(VIRTIO_COM_STATUS) = st;
+    else outb(vblk_iobase + VIRTIO_LEG_STATUS, st);
+}
+
+static void vblk_kick() {
+    if (vq_used->flags & VRING_USED_F_NO_NOTIFY) return;
+    if (vblk_modern) *(volatile uint16_t *)vblk_notify = 0;
+    else outw(vblk_iobase + VIRTIO_LEG_QUEUE_NOTIFY, 0);
+}
+
+// Lay the split virtqueue out in vq_mem for `size` entries
+static void vq_setup(uint16_t size) {
+    for (uint32_t i = 0; i < sizeof(vq_mem); i++) vq_mem[i] = 0;
+    vq_size = size;
+    vq_desc = (struct vring_desc *)vq_mem;
+    vq_avail = (struct vring_avail *)(vq_mem + 16 * size);
+    uint32_t used_off = (16 * size + 6 + 2 * size + 4095) & ~4095u;
+    vq_used = (volatile struct vring_used *)(vq_mem + used_off);
+    vq_last_used = 0;
+    // We poll the used ring, so ask the device not to interrupt
+    vq_avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+    vblk_max_reqs = size / 3 < VBLK_MAX_REQS ? size / 3 : VBLK_MAX_REQS;
+    vblk_max_segs = size - 2u < DISK_IOV_MAX ? size - 2u : DISK_IOV_MAX;
+}
+
+static int vblk_init_legacy(const struct pci_device *dev) {
+    uint32_t bar0 = pci_read_bar(dev, 0);
+    if (!(bar0 & 1)) return -1;
+    vblk_iobase = bar0 & 0xFFFC;
+    vblk_modern = 0;
+
+    vblk_set_status(0);
+    vblk_set_status(VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+    outl(vblk_iobase + VIRTIO_LEG_GUEST_FEATURES, 0);
+
+    outw(vblk_iobase + VIRTIO_LEG_QUEUE_SELECT, 0);
+    uint16_t size = inw(vblk_iobase + VIRTIO_LEG_QUEUE_SIZE);
+    if (size < 3 || size > VQ_MAX_SIZE) return -1;    // Legacy size is fixed by the device
+    vq_setup(size);
+    outl(vblk_iobase + VIRTIO_LEG_QUEUE_PFN, (uint32_t)(uintptr_t)vq_mem >> 12);
+    uint16_t cfg = vblk_iobase + VIRTIO_LEG_DEVICE_CFG + VIRTIO_BLK_CFG_CAPACITY;
+    vblk_sectors = inl(cfg) | (uint64_t)inl(cfg + 4) << 32;
+
+    vblk_set_status(vblk_get_status() | VIRTIO_STATUS_DRIVER_OK);
+    return 0;
+}
+
+// Address of a capability's window; 0 if its BAR is unusable from 32-bit
+static uintptr_t vblk_cap_addr(const struct pci_device *dev, uint8_t cap) {
+    uint8_t bar = pci_config_read(dev->bus, dev->slot, dev->func, cap + 4) & 0xFF;
+    uint32_t offset = pci_config_read(dev->bus, dev->slot, dev->func, cap + 8);
+    uint32_t length = pci_config_read(dev->bus, dev->slot, dev->func, cap + 12);
+    if (bar > 5) return 0;
+    uint32_t lo = pci_read_bar(dev, bar);
+    if (lo & 1) return 0;                               // Must be memory
+    if (((lo >> 1) & 3) == 2 && bar < 5 && pci_read_bar(dev, bar + 1))
+        return 0;                                       // Mapped above 4G
+    return (uintptr_t)mmio_map((lo & 0xFFFFFFF0) + offset, length);
+}
+
+static int vblk_init_modern(const struct pci_device *dev) {
+    uint32_t notify_mult = 0;
+    uintptr_t notify_base = 0, device_cfg = 0;
+    vblk_common = 0;
+    for (uint8_t cap = pci_next_capability(dev, 0); cap; cap = pci_next_capability(dev, cap)) {
+        uint32_t hdr = pci_config_read(dev->bus, dev->slot, dev->func, cap);
+        if ((hdr & 0xFF) != PCI_CAP_VENDOR) continue;
+        uint8_t type = (hdr >> 24) & 0xFF;
+        if (type == VIRTIO_CAP_COMMON && !vblk_common) {
+            vblk_common = vblk_cap_addr(dev, cap);
+        } else if (type == VIRTIO_CAP_NOTIFY && !notify_base) {
+            notify_base = vblk_cap_addr(dev, cap);
+            notify_mult = pci_config_read(dev->bus, dev->slot, dev->func, cap + 16);
+        } else if (type == VIRTIO_CAP_DEVICE && !device_cfg) {
+            device_cfg = vblk_cap_addr(dev, cap);
+        }
+    }
+    if (!vblk_common || !notify_base || !device_cfg) return -1;
+    vblk_modern = 1;
+
+    vblk_set_status(0);
+    for (int i = 0; i < 1000000 && vblk_get_status(); i++);
+    vblk_set_status(VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+
+    COM32(VIRTIO_COM_DFSELECT) = 1;
+    if (!(COM32(VIRTIO_COM_DF) & VIRTIO_F_VERSION_1_HI)) return -1;
+    COM32(VIRTIO_COM_GFSELECT) = 0;
+    COM32(VIRTIO_COM_GF) = 0;
+    COM32(VIRTIO_COM_GFSELECT) = 1;
+    COM32(VIRTIO_COM_GF) = VIRTIO_F_VERSION_1_HI;
+    vblk_set_status(vblk_get_status() | VIRTIO_STATUS_FEATURES_OK);
+    if (!(vblk_get_status() & VIRTIO_STATUS_FEATURES_OK)) return -1;
+
+    COM16(VIRTIO_COM_Q_SELECT) = 0;
+    uint16_t size = COM16(VIRTIO_COM_Q_SIZE);
+    if (size < 3) return -1;
+    if (size > VQ_MAX_SIZE) {
+        size = VQ_MAX_SIZE;
+        COM16(VIRTIO_COM_Q_SIZE) = size;
+    }
+    vq_setup(size);
+    COM32(VIRTIO_COM_Q_DESC) = (uint32_t)(uintptr_t)vq_desc;
+    COM32(VIRTIO_COM_Q_DESC + 4) = 0;
+    COM32(VIRTIO_COM_Q_AVAIL) = (uint32_t)(uintptr_t)vq_avail;
+    COM32(VIRTIO_COM_Q_AVAIL + 4) = 0;
+    COM32(VIRTIO_COM_Q_USED) = (uint32_t)(uintptr_t)vq_used;
+    COM32(VIRTIO_COM_Q_USED + 4) = 0;
+    vblk_notify = notify_base + COM16(VIRTIO_COM_Q_NOFF) * notify_mult;
+    COM16(VIRTIO_COM_Q_ENABLE) = 1;
+    volatile uint32_t *cfg = (volatile uint32_t *)(device_cfg + VIRTIO_BLK_CFG_CAPACITY);
+    vblk_sectors = cfg[0] | (uint64_t)cfg[1] << 32;
+
+    vblk_set_status(vblk_get_status() | VIRTIO_STATUS_DRIVER_OK);
+    return 0;
+}
+
+int virtio_blk_init() {
+    struct pci_device *dev = &vblk_dev;
+    if (pci_find_device(VIRTIO_VENDOR, VIRTIO_BLK_MODERN_ID, dev) == 0) {
+        pci_enable_bus_master(dev);
+        return vblk_init_modern(dev);
+    }
+    if (pci_find_device(VIRTIO_VENDOR, VIRTIO_BLK_LEGACY_ID, dev) == 0) {
+        pci_enable_bus_master(dev);
+        // Transitional devices: use the modern interface when it's reachable
+        if (vblk_init_modern(dev) == 0) return 0;
+        return vblk_init_legacy(dev);
+    }
+    return -1;
+}
+
+uint32_t virtio_blk_capacity() {
+    return vblk_sectors > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)vblk_sectors;
+}
+
+// Chains from a timed-out batch may still complete later, into buffers and
+// ring slots the next batch reuses. Resetting the device discards them and
+// the ring starts over empty; if it won't come back, later I/O just fails
+static void vblk_reset() {
+    vblk_set_status(0);
+    vq_size = 0;
+    if (vblk_modern) vblk_init_modern(&vblk_dev);
+    else vblk_init_legacy(&vblk_dev);
+}
+
+// Post up to vblk_max_reqs header/data.../status chains, notify once for the
+// whole batch, then poll the used ring until every chain comes back. Each
+// chain carries one data descriptor per segment, so a scattered request
+// still costs the device a single command
+int virtio_blk_rwv(uint32_t lba, const struct disk_iovec *iov, uint32_t iovcnt, int write) {
+    struct disk_iov_cursor cur = { iov, iovcnt, 0, 0 };
+    struct disk_iovec seg[DISK_IOV_MAX];
+    uint32_t nseg = 0;
+    if (!vq_size) return -1;
+    uint32_t count = disk_iov_next(&cur, VBLK_MAX_SECTORS, vblk_max_segs, seg, &nseg);
+    while (count) {
+        uint32_t n = 0;
+        uint16_t d = 0;
+        uint16_t avail_idx = vq_avail->idx;
+        while (count && n < vblk_max_reqs && d + nseg + 2 <= vq_size) {
+            uint16_t head = d;
+            vblk_hdr[n].type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+            vblk_hdr[n].reserved = 0;
+            vblk_hdr[n].sector = lba;
+            vblk_status[n] = 0xFF;
+
+            vq_desc[d].addr = (uint32_t)(uintptr_t)&vblk_hdr[n];
+            vq_desc[d].len = sizeof(struct virtio_blk_req);
+            vq_desc[d].flags = VRING_DESC_F_NEXT;
+            vq_desc[d].next = d + 1;
+            d++;
+            for (uint32_t i = 0; i < nseg; i++, d++) {
+                vq_desc[d].addr = (uint32_t)(uintptr_t)seg[i].base;
+                vq_desc[d].len = seg[i].sectors * SECTOR_SIZE;
+                vq_desc[d].flags = VRING_DESC_F_NEXT | (write ? 0 : VRING_DESC_F_WRITE);
+                vq_desc[d].next = d + 1;
+            }
+            vq_desc[d].addr = (uint32_t)(uintptr_t)&vblk_status[n];
+            vq_desc[d].len = 1;
+            vq_desc[d].flags = VRING_DESC_F_WRITE;
+            vq_desc[d].next = 0;
+            d++;
+
+            vq_avail->ring[(uint16_t)(avail_idx + n) % vq_size] = head;
+            n++;
+            lba += count;
+            count = disk_iov_next(&cur, VBLK_MAX_SECTORS, vblk_max_segs, seg, &nseg);
+        }
+        __sync_synchronize();           // Descriptors visible before the index
+        vq_avail->idx = avail_idx + n;
+        __sync_synchronize();           // Index visible before the flags check
+        vblk_kick();
+
+        uint32_t deadline = pit_ticks + VBLK_TIMEOUT_TICKS;
+        while ((uint16_t)(vq_used->idx - vq_last_used) < n) {
+            if ((int32_t)(pit_ticks - deadline) >= 0) {
+                vblk_reset();
+                return -1;
+            }
+            __asm__ volatile ("pause");
+        }
+        vq_last_used += n;
+        for (uint32_t i = 0; i < n; i++)
+            if (vblk_status[i] != 0) return -1;
+    }
+    return 0;
+}
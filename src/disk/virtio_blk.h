@@ -0,0 +1,13 @@
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include <stdint.h>
+#include "diskio.h"
+
+// Probe for a virtio-blk PCI function (modern or legacy); returns 0 if found
+int virtio_blk_init();
+// Sectors on the device, clamped to 32-bit LBAs
+uint32_t virtio_blk_capacity();
+int virtio_blk_rwv(uint32_t lba, const struct disk_iovec *iov, uint32_t iovcnt, int write);
+
+#endif
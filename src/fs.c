@@ -1,183 +1,1608 @@
+#include "disk/bcache.h"
 #include "disk/diskio.h"
+#include "cpu/pit.h"
+#include "fs.h"
+#include "lz4.h"
+#include "tmpfs.h"
 #include <stddef.h>
 #include <stdint.h>
 
+extern void *memcpy(void *d, const void *s, size_t n);
+extern int strncmp(const char *a, const char *b, size_t n);
+extern size_t strlen(const char *s);
+extern char *strcpy(char *d, const char *s);
+extern char *strncpy(char *d, const char *s, size_t n);
+
 // Filesystem configuration
-#define FS_MAX_FILES       16
-#define FS_MAX_FILENAME    16
-#define FS_MAX_FILESIZE    4096
-#define FS_MAX_DIRS        4
-#define FS_MAX_DIRNAME     16
-#define FS_DISK_START      1         // LBA sector for file table start
-#define FS_DISK_FTABLE_SECTORS 2     // Number of sectors for file table
+#define FS_DISK_START      1         // LBA sector for the version 0/1 dir table
+#define FS_DISK_FTABLE_SECTORS 2     // Number of sectors for the version 0/1 file table
 #define FS_DISK_FILEDATA_START 10    // LBA sector for file data start
 #define FS_DISK_BLOCK_SIZE 512
-#define FS_DISK_FILE_BLOCKS (FS_MAX_FILESIZE / FS_DISK_BLOCK_SIZE)
+#define FS_DCACHE_SIZE     128       // Dentry cache slots, power of two
+#define FS_FLUSH_TICKS     (2 * PIT_HZ)  // Max age of dirty metadata before fs_idle flushes it
+
+// On-disk format. Version 0 has no superblock and gives file i the fixed
+// 4K slot at FS_DISK_FILEDATA_START + 8 * i; version 1 adds a superblock,
+// a free-cluster bitmap and a per-file extent map; version 2 replaces the
+// flat tables with an inode table and per-directory B-trees
+#define FS_MAGIC           0x534C5550    // "PULS"
+#define FS_VERSION         2
+#define FS_SUPER_LBA       4
+#define FS_BITMAP_LBA      5
+#define FS_BITMAP_SECTORS  5
+#define FS_CLUSTER_SECTORS 8             // Allocation unit, 4K
+#define FS_CLUSTER_SIZE    (FS_CLUSTER_SECTORS * FS_DISK_BLOCK_SIZE)
+#define FS_CLUSTERS        (FS_BITMAP_SECTORS * FS_DISK_BLOCK_SIZE * 8)    // 80 MiB of data
+#define FS_INODE_SECTORS   (FS_MAX_FILES * sizeof(struct fs_disk_entry) / FS_DISK_BLOCK_SIZE)
+#define FS_INODES_PER_SECTOR (FS_DISK_BLOCK_SIZE / sizeof(struct fs_disk_entry))
+#define FS_MIN_INODES      1024          // Floor for upgraded version 0/1 images, their old table size
+#define FS_CLUSTERS_PER_INODE 2          // Up to FS_MAX_FILES
+#define FS_MAX_EXTENTS     63
+#define FS_INLINE_MAX      (FS_DISK_BLOCK_SIZE - 8)  // Largest file kept in its extent map sector
+#define FS_Z_EXTENTS       31            // Extents left in a compressed file's map
+#define FS_Z_CLUSTERS      256           // Clusters a compressed file can hold, 1 MiB
+#define FS_ZSLOTS          4             // Decompressed clusters held in memory
+#define FS_EXTMAP_SLOTS    16            // Extent maps held in memory
+#define FS_ROOT_INO        0
+#define FS_RA_MIN          8             // Readahead window in sectors: first sequential read
+#define FS_RA_MAX          32            // ... doubling up to this while access stays sequential
+
+// Version 0/1 layout, kept for the upgrade path
+#define FS_V1_MAX_DIRS     4
+#define FS_V1_MAX_FILES    16
+#define FS_V1_EXTMAP_CLUSTER 16
+#define FS_V1_EXTMAP_LBA   (FS_DISK_FILEDATA_START + FS_V1_EXTMAP_CLUSTER * FS_CLUSTER_SECTORS)
+
+// Metadata sectors tracked for flushing, in fs_meta_dirty bit order
+#define FS_META_SUPER      0
+#define FS_META_BITMAP     1
+#define FS_META_INODE      (FS_META_BITMAP + FS_BITMAP_SECTORS)
+#define FS_META_SECTORS    (FS_META_INODE + FS_INODE_SECTORS)
+
+// Directory B-tree nodes are one sector of the directory's data
+#define FS_DNODE_SIZE      FS_DISK_BLOCK_SIZE
+#define FS_DLEAF_MAX       ((FS_DNODE_SIZE - 8) / sizeof(struct fs_dirent))
+#define FS_DINNER_MAX      ((FS_DNODE_SIZE - 8) / sizeof(struct fs_dkey))
+#define FS_BTREE_DEPTH     8
 
-// Directory entry
+// Version 0/1 directory and file table entries
 struct fs_dir_entry {
-    char name[FS_MAX_DIRNAME];
+    char name[FS_MAX_FILENAME];
     uint8_t used;
     uint8_t reserved[7];
 };
 
-// On-disk file table entry
-struct fs_disk_entry {
+struct fs_disk_entry_v1 {
     char name[FS_MAX_FILENAME];
     uint32_t size;
-    uint32_t block; // Start sector for file data
+    uint32_t block;
     uint8_t used;
     uint8_t dir;    // Directory index
     uint8_t reserved[2];
 };
 
-static struct fs_dir_entry dirtable[FS_MAX_DIRS];
-static struct fs_disk_entry filetable[FS_MAX_FILES];
+// On-disk inode; the table is indexed by inode number
+struct fs_disk_entry {
+    char name[FS_MAX_FILENAME];
+    uint32_t size;
+    uint32_t block;     // Extent map sector
+    uint16_t parent;    // Inode of the containing directory
+    uint8_t used;
+    uint8_t type;       // FS_TYPE_FILE or FS_TYPE_DIR
+    uint8_t flags;      // FS_FILE_*
+    uint8_t reserved[3];
+};
+
+// Inode flags
+#define FS_FILE_INLINE     0x01    // Contents live in the extent map sector
+#define FS_FILE_LZ4        0x02    // Each cluster is stored LZ4-compressed
+
+// Superblock, version 1 and later
+struct fs_super {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t cluster_sectors;
+    uint32_t clusters;          // Data clusters covered by the bitmap
+    uint32_t free_clusters;
+    uint32_t bitmap_lba;
+    uint32_t extmap_lba;
+    uint32_t data_lba;          // First sector of cluster 0
+    uint32_t inode_lba;         // Version 2
+    uint32_t inodes;
+};
+
+// A run of clusters; an extent map lists a file's runs in file order
+struct fs_extent {
+    uint32_t start;
+    uint32_t count;
+};
+
+// One sector per inode, at extmap_lba + inode number. A small file keeps
+// its contents here instead, so it costs no data sectors and is written
+// out with the rest of the metadata. A compressed file gives up half its
+// extents to record how many sectors of each cluster are in use: 0 if
+// never written (reads as zeros), fewer than FS_CLUSTER_SECTORS if
+// compressed, all of them if stored raw
+struct fs_extmap {
+    uint32_t count;
+    uint32_t reserved;
+    union {
+        struct fs_extent ext[FS_MAX_EXTENTS];
+        uint8_t data[FS_INLINE_MAX];
+        struct {
+            struct fs_extent zext[FS_Z_EXTENTS];    // Same slots as ext
+            uint8_t zsectors[FS_Z_CLUSTERS];
+        };
+    };
+};
+
+// Directory B-tree, keyed on (name hash, inode) so keys are unique. Leaves
+// hold the entries and are chained in key order; an inner key is the lower
+// bound of its child's subtree. Block 0 is always the root
+struct fs_dirent {
+    uint32_t hash;
+    uint16_t ino;
+    uint8_t type;
+    uint8_t reserved;
+    char name[FS_MAX_FILENAME];
+};
+
+struct fs_dkey {
+    uint32_t hash;
+    uint16_t ino;
+    uint16_t reserved;
+    uint32_t child;
+};
+
+struct fs_dnode {
+    uint16_t count;
+    uint8_t leaf;
+    uint8_t reserved;
+    uint32_t next;      // Leaf: block of the next leaf, 0 at the end
+    union {
+        struct fs_dirent ents[(FS_DNODE_SIZE - 8) / sizeof(struct fs_dirent)];
+        struct fs_dkey keys[(FS_DNODE_SIZE - 8) / sizeof(struct fs_dkey)];
+        uint8_t raw[FS_DNODE_SIZE - 8];
+    } u;
+};
+
+// Path-walk result: (parent, name) -> inode, direct mapped
+struct fs_dentry {
+    uint16_t parent;
+    uint16_t ino;
+    uint8_t valid;
+    char name[FS_MAX_FILENAME];
+};
+
+// Position in an extent map, so sequential mapping need not rescan it
+struct fs_extcur {
+    uint32_t gen;       // fs_extgen when taken; stale cursors restart at 0
+    uint32_t ext;
+    uint32_t sec;       // First file sector of ext
+};
+
+// Open file: the resolved entry, a cursor and sequential readahead state
+#define FS_H_TMP           0x80    // Handle flag: idx is a tmpfs file
+struct fs_handle {
+    uint8_t used;
+    uint8_t flags;
+    int16_t idx;        // Inode, -1 once the file is deleted
+    uint32_t pos;
+    struct fs_extcur cur;
+    uint32_t ra_next;   // Offset a sequential read would start at
+    uint32_t ra_window; // Sectors to read ahead, 0 after a seek
+    uint32_t ra_end;    // File sector readahead has been queued up to
+};
+
+// Open directory: a copy of the current leaf and the next slot in it
+struct fs_dirhandle {
+    uint8_t used;
+    int16_t dir;        // Inode, -1 once the directory is deleted
+    uint8_t tmp;        // Listing tmpfs; pos is the next file index
+    uint16_t pos;
+    struct fs_dnode node;
+    struct fs_stat st;  // Returned by fs_readdir
+};
+
+// In-memory images, padded to whole sectors so the cache can move them
+// without running past the end of the arrays
+static union {
+    struct fs_disk_entry entries[FS_MAX_FILES];
+    uint8_t raw[FS_INODE_SECTORS * FS_DISK_BLOCK_SIZE];
+} fileblock;
+#define filetable fileblock.entries
+static union {
+    struct fs_super sb;
+    uint8_t raw[FS_DISK_BLOCK_SIZE];
+} superblock;
+static uint8_t fs_bitmap[FS_BITMAP_SECTORS * FS_DISK_BLOCK_SIZE];
+
+// Extent maps are loaded on demand into a few slots, least recently used
+// slot reused first
+static struct fs_extmap fs_extmaps[FS_EXTMAP_SLOTS];
+static int16_t fs_extslot_ino[FS_EXTMAP_SLOTS];
+static uint8_t fs_extslot_dirty[FS_EXTMAP_SLOTS];
+static uint32_t fs_extslot_used[FS_EXTMAP_SLOTS];
+static uint32_t fs_extclock = 0;
+static uint32_t fs_extgen[FS_MAX_FILES];       // Bumped whenever a file's extent map changes
 
-// Freestanding string/memory functions
-size_t strlen(const char *s) {
-    size_t i = 0; while (s[i]) i++; return i;
+static uint8_t fs_sector[FS_DISK_BLOCK_SIZE];  // Partial edge sector of a transfer
+static uint8_t fs_zero[FS_DISK_BLOCK_SIZE];
+static uint8_t fs_inline[FS_INLINE_MAX];        // Contents of a file leaving its map sector
+
+// Clusters of compressed files, decompressed and written back on flush or
+// eviction; the compressed sectors themselves go through the block cache
+static uint8_t fs_zdata[FS_ZSLOTS][FS_CLUSTER_SIZE];
+static int16_t fs_zslot_ino[FS_ZSLOTS];
+static uint32_t fs_zslot_cl[FS_ZSLOTS];
+static uint8_t fs_zslot_dirty[FS_ZSLOTS];
+static uint32_t fs_zslot_used[FS_ZSLOTS];
+static uint32_t fs_zclock = 0;
+static uint8_t fs_zbuf[FS_CLUSTER_SIZE];        // Compressed image of one cluster
+static struct fs_dnode fs_node, fs_sibling;    // B-tree work nodes
+static struct fs_dentry fs_dcache[FS_DCACHE_SIZE];
+static struct fs_handle fs_handles[FS_MAX_OPEN];
+static struct fs_dirhandle fs_dirhandles[FS_MAX_OPENDIR];
+static uint32_t fs_ino_hint = 1;
+
+// Metadata sectors changed since the last flush, one bit per FS_META_* sector
+static uint32_t fs_meta_dirty[(FS_META_SECTORS + 31) / 32];
+static int fs_meta_pending = 0;
+static uint32_t fs_meta_since = 0;     // pit_ticks when the oldest change was made
+
+static void fs_memzero(void *p, uint32_t n) {
+    uint8_t *b = p;
+    for (uint32_t i = 0; i < n; i++) b[i] = 0;
+}
+
+// FNV-1a over a path component
+static uint32_t fs_hash(const char *name, uint32_t len) {
+    uint32_t h = 2166136261u;
+    for (uint32_t i = 0; i < len; i++) {
+        h ^= (uint8_t)name[i];
+        h *= 16777619u;
+    }
+    return h;
 }
-void *memcpy(void *d, const void *s, size_t n) {
-    char *dd = d; const char *ss = s;
-    for (size_t i = 0; i < n; i++) dd[i] = ss[i];
-    return d;
+
+// Compare a stored, NUL-padded name against a component of `len` bytes
+static int fs_name_eq(const char *stored, const char *name, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++)
+        if (stored[i] != name[i]) return 0;
+    return stored[len] == 0;
 }
-char *strcpy(char *d, const char *s) {
-    char *dd = d; while ((*dd++ = *s++)); return d;
+
+static void fs_meta_touch() {
+    if (!fs_meta_pending) fs_meta_since = pit_ticks;
+    fs_meta_pending = 1;
+}
+
+static void fs_mark_meta(uint32_t s) {
+    fs_meta_touch();
+    fs_meta_dirty[s / 32] |= 1u << (s % 32);
 }
-char *strncpy(char *d, const char *s, size_t n) {
-    size_t i = 0;
-    for (; i < n && s[i]; i++) d[i] = s[i];
-    for (; i < n; i++) d[i] = 0;
-    return d;
+
+// Entries are 32 bytes, so each sits in one inode table sector
+static void fs_mark_file(int idx) {
+    fs_mark_meta(FS_META_INODE + idx * sizeof(struct fs_disk_entry) / FS_DISK_BLOCK_SIZE);
 }
 
+// In-memory image and LBA of metadata sector `s`
+static uint8_t *fs_meta_sector(uint32_t s, uint32_t *lba) {
+    if (s == FS_META_SUPER) {
+        *lba = FS_SUPER_LBA;
+        return superblock.raw;
+    }
+    if (s < FS_META_INODE) {
+        *lba = FS_BITMAP_LBA + (s - FS_META_BITMAP);
+        return fs_bitmap + (s - FS_META_BITMAP) * FS_DISK_BLOCK_SIZE;
+    }
+    *lba = superblock.sb.inode_lba + (s - FS_META_INODE);
+    return fileblock.raw + (s - FS_META_INODE) * FS_DISK_BLOCK_SIZE;
+}
 
-// Load file and dir tables from disk
-static void fs_disk_load_table() {
-    disk_read(FS_DISK_START, (uint8_t*)dirtable, 1);
-    disk_read(FS_DISK_START + 1, (uint8_t*)filetable, FS_DISK_FTABLE_SECTORS);
+static void fs_extslot_flush(int slot) {
+    if (!fs_extslot_dirty[slot]) return;
+    bcache_write(superblock.sb.extmap_lba + fs_extslot_ino[slot], (const uint8_t *)&fs_extmaps[slot], 1);
+    fs_extslot_dirty[slot] = 0;
 }
 
-// Save file and dir tables to disk
-static void fs_disk_save_table() {
-    disk_write(FS_DISK_START, (const uint8_t*)dirtable, 1);
-    disk_write(FS_DISK_START + 1, (const uint8_t*)filetable, FS_DISK_FTABLE_SECTORS);
+// Extent map of inode `idx`. `fresh` skips the disk read for a newly
+// allocated inode and starts it empty. The pointer is valid until the
+// next call for another inode
+static struct fs_extmap *fs_extmap_get(int idx, int fresh) {
+    int slot = -1;
+    for (int i = 0; i < FS_EXTMAP_SLOTS; i++) {
+        if (fs_extslot_ino[i] == idx) {
+            slot = i;
+            break;
+        }
+        if (slot < 0 || (fs_extslot_ino[slot] >= 0 &&
+            (fs_extslot_ino[i] < 0 || fs_extslot_used[i] < fs_extslot_used[slot])))
+            slot = i;
+    }
+    struct fs_extmap *m = &fs_extmaps[slot];
+    if (fs_extslot_ino[slot] != idx) {
+        if (fs_extslot_ino[slot] >= 0) fs_extslot_flush(slot);
+        fs_extslot_ino[slot] = idx;
+        fs_extslot_dirty[slot] = 0;
+        if (fresh || bcache_read(superblock.sb.extmap_lba + idx, (uint8_t *)m, 1) < 0)
+            fs_memzero(m, sizeof(*m));
+    }
+    if (fresh) {
+        fs_memzero(m, sizeof(*m));
+        fs_extslot_dirty[slot] = 1;
+        fs_meta_touch();
+    }
+    fs_extslot_used[slot] = ++fs_extclock;
+    return m;
 }
 
-// Initialize (load table)
-int fs_init() {
-    fs_disk_load_table();
+// Mark the (resident) extent map of `idx` for the next flush
+static void fs_extmap_dirty(int idx) {
+    for (int i = 0; i < FS_EXTMAP_SLOTS; i++) {
+        if (fs_extslot_ino[i] == idx) {
+            fs_extslot_dirty[i] = 1;
+            fs_meta_touch();
+        }
+    }
+}
+
+static void fs_extmap_reset_cache() {
+    for (int i = 0; i < FS_EXTMAP_SLOTS; i++) {
+        fs_extslot_ino[i] = -1;
+        fs_extslot_dirty[i] = 0;
+    }
+}
+
+// The image's inode table; the arrays are sized for FS_MAX_FILES
+static uint32_t fs_inode_sectors() {
+    return superblock.sb.inodes / FS_INODES_PER_SECTOR;
+}
+
+static int fs_cluster_used(uint32_t c) {
+    return fs_bitmap[c >> 3] & (1 << (c & 7));
+}
+
+static void fs_cluster_set(uint32_t start, uint32_t count, int used) {
+    for (uint32_t c = start; c < start + count; c++) {
+        if (used) fs_bitmap[c >> 3] |= 1 << (c & 7);
+        else      fs_bitmap[c >> 3] &= ~(1 << (c & 7));
+        fs_mark_meta(FS_META_BITMAP + c / (FS_DISK_BLOCK_SIZE * 8));
+    }
+    if (used) superblock.sb.free_clusters -= count;
+    else      superblock.sb.free_clusters += count;
+    fs_mark_meta(FS_META_SUPER);
+}
+
+// Contiguous-first allocation: extend the run at `goal` if it is free, else
+// take the first free run that fits all of `want`, else the longest one.
+// Returns the start cluster and sets `got` (0 when the disk is full)
+static uint32_t fs_alloc(uint32_t goal, uint32_t want, uint32_t *got) {
+    uint32_t clusters = superblock.sb.clusters;
+    uint32_t start = goal, n = 0;
+    while (goal + n < clusters && n < want && !fs_cluster_used(goal + n)) n++;
+    if (!n) {
+        for (uint32_t c = 0; c < clusters && n < want; ) {
+            if (!(c & 7) && fs_bitmap[c >> 3] == 0xFF) { c += 8; continue; }
+            if (fs_cluster_used(c)) { c++; continue; }
+            uint32_t run = c;
+            while (c < clusters && c - run < want && !fs_cluster_used(c)) c++;
+            if (c - run > n) {
+                start = run;
+                n = c - run;
+            }
+        }
+    }
+    if (n) fs_cluster_set(start, n, 1);
+    *got = n;
+    return start;
+}
+
+// Forget the cached clusters of `idx` from `from` on, without writing them
+static void fs_zdrop(int idx, uint32_t from) {
+    for (int i = 0; i < FS_ZSLOTS; i++) {
+        if (fs_zslot_ino[i] == idx && fs_zslot_cl[i] >= from) {
+            fs_zslot_ino[i] = -1;
+            fs_zslot_dirty[i] = 0;
+        }
+    }
+}
+
+// Grow or shrink file `idx` to `need` clusters. Growth extends the last
+// extent in place when it can, so a file written in one go is one run
+static int fs_resize(int idx, uint32_t need) {
+    if (filetable[idx].flags & FS_FILE_INLINE) return need ? -1 : 0;
+    int z = filetable[idx].flags & FS_FILE_LZ4;
+    if (z && need > FS_Z_CLUSTERS) return -1;
+    struct fs_extmap *m = fs_extmap_get(idx, 0);
+    uint32_t have = 0;
+    for (uint32_t i = 0; i < m->count; i++) have += m->ext[i].count;
+    if (have == need) return 0;
+    if (z && need < have) {
+        for (uint32_t c = need; c < have; c++) m->zsectors[c] = 0;
+        fs_zdrop(idx, need);
+    }
+
+    while (have > need) {
+        struct fs_extent *e = &m->ext[m->count - 1];
+        uint32_t drop = have - need < e->count ? have - need : e->count;
+        fs_cluster_set(e->start + e->count - drop, drop, 0);
+        e->count -= drop;
+        have -= drop;
+        if (!e->count) m->count--;
+    }
+    while (have < need) {
+        struct fs_extent *last = m->count ? &m->ext[m->count - 1] : NULL;
+        uint32_t goal = last ? last->start + last->count : superblock.sb.clusters;
+        uint32_t got, start = fs_alloc(goal, need - have, &got);
+        if (!got) break;
+        if (last && start == goal) {
+            last->count += got;
+        } else if (m->count < (z ? FS_Z_EXTENTS : FS_MAX_EXTENTS)) {
+            m->ext[m->count].start = start;
+            m->ext[m->count].count = got;
+            m->count++;
+        } else {
+            fs_cluster_set(start, got, 0);
+            break;
+        }
+        have += got;
+    }
+    fs_extgen[idx]++;
+    fs_extmap_dirty(idx);
+    return have == need ? 0 : -1;
+}
+
+// LBA of sector `sec` of file `idx`; `run` gets the number of sectors that
+// follow contiguously on disk (0 past the end of the extents). A cursor,
+// if given, is used as the starting point and left at the extent found
+static uint32_t fs_map(int idx, uint32_t sec, uint32_t *run, struct fs_extcur *cur) {
+    *run = 0;
+    if (filetable[idx].flags & FS_FILE_INLINE) return 0;
+    struct fs_extmap *m = fs_extmap_get(idx, 0);
+    uint32_t i = 0, base = 0;
+    if (cur && cur->gen == fs_extgen[idx] && cur->sec <= sec) {
+        i = cur->ext;
+        base = cur->sec;
+    }
+    for (; i < m->count; i++) {
+        uint32_t len = m->ext[i].count * FS_CLUSTER_SECTORS;
+        if (sec < base + len) {
+            if (cur) {
+                cur->gen = fs_extgen[idx];
+                cur->ext = i;
+                cur->sec = base;
+            }
+            *run = base + len - sec;
+            return superblock.sb.data_lba + m->ext[i].start * FS_CLUSTER_SECTORS + (sec - base);
+        }
+        base += len;
+    }
     return 0;
 }
 
-// Find directory entry by name
-static int fs_dir_find(const char* name) {
-    for (int i = 0; i < FS_MAX_DIRS; i++)
-        if (dirtable[i].used && strncmp(dirtable[i].name, name, FS_MAX_DIRNAME) == 0)
+// Write a cached cluster back: compressed when that saves at least one
+// sector, raw otherwise. The compressed image is its length, then the
+// LZ4 block
+static int fs_zflush(int slot) {
+    if (fs_zslot_ino[slot] < 0 || !fs_zslot_dirty[slot]) return 0;
+    int idx = fs_zslot_ino[slot];
+    uint32_t cl = fs_zslot_cl[slot];
+    uint32_t run, lba = fs_map(idx, cl * FS_CLUSTER_SECTORS, &run, NULL);
+    if (!run) return -1;
+    uint32_t cap = (FS_CLUSTER_SECTORS - 1) * FS_DISK_BLOCK_SIZE - 2;
+    uint32_t n = lz4_compress(fs_zdata[slot], FS_CLUSTER_SIZE, fs_zbuf + 2, cap);
+    uint32_t sectors = FS_CLUSTER_SECTORS;
+    const uint8_t *src = fs_zdata[slot];
+    if (n) {
+        fs_zbuf[0] = n;
+        fs_zbuf[1] = n >> 8;
+        sectors = (n + 2 + FS_DISK_BLOCK_SIZE - 1) / FS_DISK_BLOCK_SIZE;
+        fs_memzero(fs_zbuf + 2 + n, sectors * FS_DISK_BLOCK_SIZE - 2 - n);
+        src = fs_zbuf;
+    }
+    if (bcache_write(lba, src, sectors) < 0) return -1;
+    fs_extmap_get(idx, 0)->zsectors[cl] = sectors;
+    fs_extmap_dirty(idx);
+    fs_zslot_dirty[slot] = 0;
+    return 0;
+}
+
+// Slot holding cluster `cl` of compressed file `idx`, decompressing it on a
+// miss unless `load` is 0 (nothing in it needs to survive). -1 on error
+static int fs_zget(int idx, uint32_t cl, int load) {
+    int slot = -1;
+    for (int i = 0; i < FS_ZSLOTS; i++) {
+        if (fs_zslot_ino[i] == idx && fs_zslot_cl[i] == cl) {
+            fs_zslot_used[i] = ++fs_zclock;
             return i;
+        }
+        if (slot < 0 || (fs_zslot_ino[slot] >= 0 &&
+            (fs_zslot_ino[i] < 0 || fs_zslot_used[i] < fs_zslot_used[slot])))
+            slot = i;
+    }
+    if (fs_zflush(slot) < 0) return -1;
+    uint8_t *d = fs_zdata[slot];
+    fs_zslot_ino[slot] = -1;
+    uint32_t zs = fs_extmap_get(idx, 0)->zsectors[cl];
+    if (!load || !zs) {
+        fs_memzero(d, FS_CLUSTER_SIZE);
+    } else {
+        uint32_t run, lba = fs_map(idx, cl * FS_CLUSTER_SECTORS, &run, NULL);
+        if (!run) return -1;
+        if (zs >= FS_CLUSTER_SECTORS) {
+            if (bcache_read(lba, d, FS_CLUSTER_SECTORS) < 0) return -1;
+        } else {
+            if (bcache_read(lba, fs_zbuf, zs) < 0) return -1;
+            uint32_t n = fs_zbuf[0] | (fs_zbuf[1] << 8);
+            if (n > zs * FS_DISK_BLOCK_SIZE - 2) return -1;
+            int got = lz4_decompress(fs_zbuf + 2, n, d, FS_CLUSTER_SIZE);
+            if (got < 0) return -1;
+            fs_memzero(d + got, FS_CLUSTER_SIZE - got);
+        }
+    }
+    fs_zslot_ino[slot] = idx;
+    fs_zslot_cl[slot] = cl;
+    fs_zslot_dirty[slot] = 0;
+    fs_zslot_used[slot] = ++fs_zclock;
+    return slot;
+}
+
+// Hand the changed clusters, metadata sectors and extent maps to the block
+// cache. Clusters go first since compressing them updates their maps
+static void fs_flush_meta() {
+    for (int i = 0; i < FS_ZSLOTS; i++) fs_zflush(i);
+    for (uint32_t s = 0; s < FS_META_INODE + fs_inode_sectors(); s++) {
+        if (!(fs_meta_dirty[s / 32] & (1u << (s % 32)))) continue;
+        uint32_t lba;
+        const uint8_t *src = fs_meta_sector(s, &lba);
+        bcache_write(lba, src, 1);
+    }
+    for (int i = 0; i < FS_EXTMAP_SLOTS; i++) fs_extslot_flush(i);
+    fs_memzero(fs_meta_dirty, sizeof(fs_meta_dirty));
+    fs_meta_pending = 0;
+}
+
+// Move `len` bytes at byte `off` of file `idx` through the cache, one call
+// per extent for whole sectors. Partial edge sectors are read-modify-written
+// through fs_sector, skipping the read when none of the first `valid` bytes
+// of the file would survive in that sector. Inline files are copied to or
+// from their map sector, compressed ones through their cached clusters
+static int fs_io(int idx, uint32_t off, uint8_t *buf, uint32_t len, uint32_t valid, int write,
+                 struct fs_extcur *cur) {
+    if (filetable[idx].flags & FS_FILE_INLINE) {
+        if (off + len > FS_INLINE_MAX) return -1;
+        struct fs_extmap *m = fs_extmap_get(idx, 0);
+        if (write) {
+            memcpy(m->data + off, buf, len);
+            fs_extmap_dirty(idx);
+        } else {
+            memcpy(buf, m->data + off, len);
+        }
+        return 0;
+    }
+    if (filetable[idx].flags & FS_FILE_LZ4) {
+        while (len) {
+            uint32_t cl = off / FS_CLUSTER_SIZE, in = off % FS_CLUSTER_SIZE;
+            uint32_t n = FS_CLUSTER_SIZE - in < len ? FS_CLUSTER_SIZE - in : len;
+            uint32_t start = cl * FS_CLUSTER_SIZE;
+            uint32_t keep = valid < start + FS_CLUSTER_SIZE ? valid : start + FS_CLUSTER_SIZE;
+            int slot = fs_zget(idx, cl, !write || (keep > start && (in || off + n < keep)));
+            if (slot < 0) return -1;
+            if (write) {
+                memcpy(fs_zdata[slot] + in, buf, n);
+                fs_zslot_dirty[slot] = 1;
+                fs_meta_touch();
+            } else {
+                memcpy(buf, fs_zdata[slot] + in, n);
+            }
+            off += n;
+            buf += n;
+            len -= n;
+        }
+        return 0;
+    }
+    while (len) {
+        uint32_t sec = off / FS_DISK_BLOCK_SIZE, in = off % FS_DISK_BLOCK_SIZE, run;
+        uint32_t lba = fs_map(idx, sec, &run, cur);
+        if (!run) return -1;
+        if (in || len < FS_DISK_BLOCK_SIZE) {
+            uint32_t n = FS_DISK_BLOCK_SIZE - in < len ? FS_DISK_BLOCK_SIZE - in : len;
+            uint32_t start = sec * FS_DISK_BLOCK_SIZE;
+            uint32_t keep = valid < start + FS_DISK_BLOCK_SIZE ? valid : start + FS_DISK_BLOCK_SIZE;
+            if (!write || (keep > start && (in || off + n < keep))) {
+                if (bcache_read(lba, fs_sector, 1) < 0) return -1;
+            } else {
+                fs_memzero(fs_sector, FS_DISK_BLOCK_SIZE);
+            }
+            if (write) {
+                memcpy(fs_sector + in, buf, n);
+                if (bcache_write(lba, fs_sector, 1) < 0) return -1;
+            } else {
+                memcpy(buf, fs_sector + in, n);
+            }
+            off += n;
+            buf += n;
+            len -= n;
+            continue;
+        }
+        uint32_t n = len / FS_DISK_BLOCK_SIZE;
+        if (n > run) n = run;
+        if ((write ? bcache_write(lba, buf, n) : bcache_read(lba, buf, n)) < 0) return -1;
+        off += n * FS_DISK_BLOCK_SIZE;
+        buf += n * FS_DISK_BLOCK_SIZE;
+        len -= n * FS_DISK_BLOCK_SIZE;
+    }
+    return 0;
+}
+
+// Rewrite clusters [0, clusters) of compressed file `idx` compressed or
+// raw. A raw cluster is a valid state of a compressed file (zsectors of
+// FS_CLUSTER_SECTORS), so the map matches the disk after every cluster
+static int fs_zrewrite(int idx, uint32_t clusters, int compress) {
+    for (uint32_t cl = 0; cl < clusters; cl++) {
+        int slot = fs_zget(idx, cl, 1);
+        if (slot < 0) return -1;
+        if (compress) {
+            fs_zslot_dirty[slot] = 1;
+            if (fs_zflush(slot) < 0) return -1;
+            continue;
+        }
+        uint32_t run, lba = fs_map(idx, cl * FS_CLUSTER_SECTORS, &run, NULL);
+        if (!run || bcache_write(lba, fs_zdata[slot], FS_CLUSTER_SECTORS) < 0) return -1;
+        fs_extmap_get(idx, 0)->zsectors[cl] = FS_CLUSTER_SECTORS;
+        fs_extmap_dirty(idx);
+        // Now on disk raw; flushing the slot on eviction would write the
+        // compressed image over it
+        fs_zslot_dirty[slot] = 0;
+    }
+    return 0;
+}
+
+// Switch file `idx` between raw and compressed clusters, rewriting each one
+// in place. Compression needs the file to fit a compressed map. The flag
+// only changes once every cluster is converted; a failed compression is
+// undone, and a failed decompression leaves a readable compressed file
+static int fs_zconvert(int idx, int enable) {
+    struct fs_disk_entry *f = &filetable[idx];
+    if (f->flags & FS_FILE_INLINE) {
+        f->flags = enable ? f->flags | FS_FILE_LZ4 : f->flags & ~FS_FILE_LZ4;
+        fs_mark_file(idx);
+        return 0;
+    }
+    uint32_t clusters = (f->size + FS_CLUSTER_SIZE - 1) / FS_CLUSTER_SIZE;
+    struct fs_extmap *m = fs_extmap_get(idx, 0);
+    if (enable) {
+        if (clusters > FS_Z_CLUSTERS || m->count > FS_Z_EXTENTS) return -1;
+        // Every cluster starts out described as raw, which it is
+        fs_memzero(m->zsectors, sizeof(m->zsectors));
+        for (uint32_t cl = 0; cl < clusters; cl++) m->zsectors[cl] = FS_CLUSTER_SECTORS;
+        fs_extmap_dirty(idx);
+        f->flags |= FS_FILE_LZ4;
+        if (fs_zrewrite(idx, clusters, 1) < 0) {
+            if (fs_zrewrite(idx, clusters, 0) == 0) {
+                fs_zdrop(idx, 0);
+                fs_memzero(fs_extmap_get(idx, 0)->zsectors, sizeof(m->zsectors));
+                f->flags &= ~FS_FILE_LZ4;
+            }
+            fs_mark_file(idx);
+            return -1;
+        }
+        fs_mark_file(idx);
+        return 0;
+    }
+    if (fs_zrewrite(idx, clusters, 0) < 0) return -1;
+    fs_zdrop(idx, 0);
+    m = fs_extmap_get(idx, 0);
+    fs_memzero(m->zsectors, sizeof(m->zsectors));
+    fs_extmap_dirty(idx);
+    f->flags &= ~FS_FILE_LZ4;
+    fs_mark_file(idx);
+    return 0;
+}
+
+// Make room for `size` bytes in file `idx`, keeping the first `keep` bytes
+// of its contents. Files that fit stay inline, or go inline when their old
+// contents are being replaced; one that outgrows its map sector moves to
+// clusters. On failure the file is left as it was
+static int fs_reserve(int idx, uint32_t size, uint32_t keep) {
+    struct fs_disk_entry *f = &filetable[idx];
+    uint32_t need = (size + FS_CLUSTER_SIZE - 1) / FS_CLUSTER_SIZE;
+    if (f->type == FS_TYPE_FILE && size <= FS_INLINE_MAX && ((f->flags & FS_FILE_INLINE) || !keep)) {
+        if (!(f->flags & FS_FILE_INLINE)) {
+            fs_resize(idx, 0);
+            f->flags |= FS_FILE_INLINE;
+            fs_mark_file(idx);
+        }
+        return 0;
+    }
+    if (f->flags & FS_FILE_INLINE) {
+        struct fs_extmap *m = fs_extmap_get(idx, 0);
+        memcpy(fs_inline, m->data, keep);
+        fs_memzero(m, sizeof(*m));
+        fs_extmap_dirty(idx);
+        f->flags &= ~FS_FILE_INLINE;
+        fs_mark_file(idx);
+        if (fs_resize(idx, need) < 0) {
+            fs_resize(idx, 0);
+            f->flags |= FS_FILE_INLINE;
+            memcpy(fs_extmap_get(idx, 0)->data, fs_inline, keep);
+            return -1;
+        }
+        return keep ? fs_io(idx, 0, fs_inline, keep, 0, 1, NULL) : 0;
+    }
+    // Too big to track compressed: store it raw from here on
+    if ((f->flags & FS_FILE_LZ4) && need > FS_Z_CLUSTERS && fs_zconvert(idx, 0) < 0) return -1;
+    uint32_t have = (f->size + FS_CLUSTER_SIZE - 1) / FS_CLUSTER_SIZE;
+    if (fs_resize(idx, need) < 0) {
+        fs_resize(idx, have);   // Disk full: give back what was added
+        return -1;
+    }
+    return 0;
+}
+
+// Write `len` bytes at `off`, growing the file as needed; a gap between the
+// old end and `off` reads back as zeros. Only the sectors covering the range
+// are touched. Returns the bytes written
+static int fs_pwrite_idx(int idx, uint32_t off, const char* data, size_t len, struct fs_extcur *cur) {
+    uint32_t size = filetable[idx].size;
+    uint32_t end = off + len;
+    if (end < off) return -1;
+    if (end > size && fs_reserve(idx, end, size) < 0) return -1;
+    // Clear the gap and anything stale past the old end in its last sector
+    uint32_t valid = size;
+    while (valid < off) {
+        uint32_t n = FS_DISK_BLOCK_SIZE - valid % FS_DISK_BLOCK_SIZE;
+        if (n > off - valid) n = off - valid;
+        if (fs_io(idx, valid, fs_zero, n, valid, 1, cur) < 0) return -1;
+        valid += n;
+    }
+    if (fs_io(idx, off, (uint8_t *)data, len, valid, 1, cur) < 0) return -1;
+    if (end > size) {
+        filetable[idx].size = end;
+        fs_mark_file(idx);
+    }
+    return len;
+}
+
+// Read up to `len` bytes at `off`; returns the bytes read, 0 at end of file
+static int fs_pread_idx(int idx, uint32_t off, char* out, size_t len, struct fs_extcur *cur) {
+    uint32_t size = filetable[idx].size;
+    if (off >= size) return 0;
+    if (len > size - off) len = size - off;
+    if (fs_io(idx, off, (uint8_t *)out, len, size, 0, cur) < 0) return -1;
+    return len;
+}
+
+static int fs_dnode_read(int dir, uint32_t blk, struct fs_dnode *n) {
+    return fs_pread_idx(dir, blk * FS_DNODE_SIZE, (char *)n, FS_DNODE_SIZE, NULL) == FS_DNODE_SIZE ? 0 : -1;
+}
+
+// Writing at the directory's end appends a new block
+static int fs_dnode_write(int dir, uint32_t blk, struct fs_dnode *n) {
+    return fs_pwrite_idx(dir, blk * FS_DNODE_SIZE, (const char *)n, FS_DNODE_SIZE, NULL) < 0 ? -1 : 0;
+}
+
+static int fs_key_cmp(uint32_t h1, uint16_t i1, uint32_t h2, uint16_t i2) {
+    if (h1 != h2) return h1 < h2 ? -1 : 1;
+    if (i1 != i2) return i1 < i2 ? -1 : 1;
+    return 0;
+}
+
+static uint32_t fs_node_key_hash(struct fs_dnode *n, uint32_t i) {
+    return n->leaf ? n->u.ents[i].hash : n->u.keys[i].hash;
+}
+
+static uint16_t fs_node_key_ino(struct fs_dnode *n, uint32_t i) {
+    return n->leaf ? n->u.ents[i].ino : n->u.keys[i].ino;
+}
+
+// First slot in `n` whose key is >= (hash, ino)
+static uint32_t fs_node_search(struct fs_dnode *n, uint32_t hash, uint16_t ino) {
+    uint32_t lo = 0, hi = n->count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (fs_key_cmp(fs_node_key_hash(n, mid), fs_node_key_ino(n, mid), hash, ino) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Walk from the root to the leaf whose range holds (hash, ino), leaving it
+// in `n` and the blocks visited in `path`; returns the depth
+static int fs_btree_descend(int dir, uint32_t hash, uint16_t ino, uint32_t *path, struct fs_dnode *n) {
+    uint32_t blk = 0;
+    for (int d = 0; d < FS_BTREE_DEPTH; d++) {
+        path[d] = blk;
+        if (fs_dnode_read(dir, blk, n) < 0) return -1;
+        if (n->leaf) return d + 1;
+        // Last child whose lower bound is <= the key
+        uint32_t i = fs_node_search(n, hash, ino);
+        if (i == n->count || fs_key_cmp(n->u.keys[i].hash, n->u.keys[i].ino, hash, ino) > 0)
+            i = i ? i - 1 : 0;
+        blk = n->u.keys[i].child;
+    }
     return -1;
 }
 
-// Find file entry by name and directory
-static int fs_disk_find(const char* name, int dir_idx) {
-    for (int i = 0; i < FS_MAX_FILES; i++)
-        if (filetable[i].used && filetable[i].dir == dir_idx &&
-            strncmp(filetable[i].name, name, FS_MAX_FILENAME) == 0)
+// Find `name` in directory `dir`; returns its inode or -1
+static int fs_btree_find(int dir, const char *name, uint32_t len) {
+    uint32_t path[FS_BTREE_DEPTH];
+    uint32_t hash = fs_hash(name, len);
+    struct fs_dnode *n = &fs_node;
+    if (fs_btree_descend(dir, hash, 0, path, n) < 0) return -1;
+    uint32_t i = fs_node_search(n, hash, 0);
+    for (;;) {
+        for (; i < n->count; i++) {
+            if (n->u.ents[i].hash != hash) return -1;
+            if (fs_name_eq(n->u.ents[i].name, name, len)) return n->u.ents[i].ino;
+        }
+        // Same-hash entries can continue in the next leaf
+        if (!n->next || fs_dnode_read(dir, n->next, n) < 0) return -1;
+        i = 0;
+    }
+}
+
+static void fs_node_insert(struct fs_dnode *n, uint32_t pos, const void *elem, uint32_t size) {
+    uint8_t *base = n->u.raw;
+    for (uint32_t i = n->count * size; i > pos * size; i--) base[i + size - 1] = base[i - 1];
+    memcpy(base + pos * size, elem, size);
+    n->count++;
+}
+
+// Insert an entry, splitting full nodes on the way back up. A root split
+// moves the old root's halves to two new blocks so the root stays at 0
+static int fs_btree_insert(int dir, const struct fs_dirent *e) {
+    uint32_t path[FS_BTREE_DEPTH];
+    struct fs_dnode *n = &fs_node, *sib = &fs_sibling;
+    int depth = fs_btree_descend(dir, e->hash, e->ino, path, n);
+    if (depth < 0) return -1;
+
+    struct fs_dkey up;
+    const void *elem = e;
+    uint32_t pos = fs_node_search(n, e->hash, e->ino);
+    for (int level = depth - 1; ; level--) {
+        uint32_t size = n->leaf ? sizeof(struct fs_dirent) : sizeof(struct fs_dkey);
+        uint32_t max = n->leaf ? FS_DLEAF_MAX : FS_DINNER_MAX;
+        if (n->count < max) {
+            fs_node_insert(n, pos, elem, size);
+            return fs_dnode_write(dir, path[level], n);
+        }
+
+        uint32_t half = (max + 1) / 2;
+        uint32_t right = filetable[dir].size / FS_DNODE_SIZE;
+        sib->leaf = n->leaf;
+        sib->reserved = 0;
+        sib->count = n->count - half;
+        memcpy(sib->u.raw, n->u.raw + half * size, sib->count * size);
+        n->count = half;
+        if (pos <= half) fs_node_insert(n, pos, elem, size);
+        else             fs_node_insert(sib, pos - half, elem, size);
+        sib->next = n->leaf ? n->next : 0;
+        if (n->leaf) n->next = right;
+        up.hash = fs_node_key_hash(sib, 0);
+        up.ino = fs_node_key_ino(sib, 0);
+        up.reserved = 0;
+        up.child = right;
+        if (fs_dnode_write(dir, right, sib) < 0) return -1;
+
+        if (level == 0) {
+            uint32_t left = filetable[dir].size / FS_DNODE_SIZE;
+            if (fs_dnode_write(dir, left, n) < 0) return -1;
+            struct fs_dkey lo = { 0, 0, 0, left };
+            fs_memzero(n, sizeof(*n));
+            fs_node_insert(n, 0, &lo, sizeof(lo));
+            fs_node_insert(n, 1, &up, sizeof(up));
+            return fs_dnode_write(dir, 0, n);
+        }
+        if (fs_dnode_write(dir, path[level], n) < 0) return -1;
+        if (fs_dnode_read(dir, path[level - 1], n) < 0) return -1;
+        elem = &up;
+        pos = fs_node_search(n, up.hash, up.ino);
+    }
+}
+
+// Remove the entry keyed (hash, ino). Nodes are not merged: an emptied leaf
+// stays linked and is skipped by iteration
+static int fs_btree_remove(int dir, uint32_t hash, uint16_t ino) {
+    uint32_t path[FS_BTREE_DEPTH];
+    struct fs_dnode *n = &fs_node;
+    int depth = fs_btree_descend(dir, hash, ino, path, n);
+    if (depth < 0) return -1;
+    uint32_t i = fs_node_search(n, hash, ino);
+    if (i == n->count || n->u.ents[i].ino != ino) return -1;
+    for (; i + 1 < n->count; i++) n->u.ents[i] = n->u.ents[i + 1];
+    n->count--;
+    return fs_dnode_write(dir, path[depth - 1], n);
+}
+
+// Load the leftmost leaf of `dir` into `n`; returns its block or -1
+static int fs_btree_first(int dir, struct fs_dnode *n) {
+    uint32_t path[FS_BTREE_DEPTH];
+    int depth = fs_btree_descend(dir, 0, 0, path, n);
+    return depth < 0 ? -1 : (int)path[depth - 1];
+}
+
+static uint32_t fs_dcache_slot(int parent, const char *name, uint32_t len) {
+    return (fs_hash(name, len) ^ ((uint32_t)parent * 0x9E3779B1u)) & (FS_DCACHE_SIZE - 1);
+}
+
+static void fs_dcache_add(int parent, const char *name, uint32_t len, int ino) {
+    struct fs_dentry *d = &fs_dcache[fs_dcache_slot(parent, name, len)];
+    d->parent = parent;
+    d->ino = ino;
+    d->valid = 1;
+    strncpy(d->name, name, len);
+    d->name[len] = 0;
+}
+
+static void fs_dcache_drop(int parent, const char *name, uint32_t len) {
+    struct fs_dentry *d = &fs_dcache[fs_dcache_slot(parent, name, len)];
+    if (d->valid && d->parent == parent && fs_name_eq(d->name, name, len)) d->valid = 0;
+}
+
+// One path component in directory `dir`: the dentry cache, then the B-tree
+static int fs_dir_lookup(int dir, const char *name, uint32_t len) {
+    if (len == 1 && name[0] == '.') return dir;
+    if (len == 2 && name[0] == '.' && name[1] == '.') return filetable[dir].parent;
+    if (len >= FS_MAX_FILENAME) return -1;
+    struct fs_dentry *d = &fs_dcache[fs_dcache_slot(dir, name, len)];
+    if (d->valid && d->parent == dir && fs_name_eq(d->name, name, len)) return d->ino;
+    int ino = fs_btree_find(dir, name, len);
+    if (ino >= 0) fs_dcache_add(dir, name, len, ino);
+    return ino;
+}
+
+// Walk the first `len` bytes of `path` from `dir` (from the root if it is
+// absolute); -1 if a component is missing or not a directory
+static int fs_walk(int dir, const char *path, uint32_t len) {
+    uint32_t i = 0;
+    if (len && path[0] == '/') dir = FS_ROOT_INO;
+    while (i < len) {
+        while (i < len && path[i] == '/') i++;
+        uint32_t start = i;
+        while (i < len && path[i] != '/') i++;
+        if (i == start) break;
+        if (filetable[dir].type != FS_TYPE_DIR) return -1;
+        dir = fs_dir_lookup(dir, path + start, i - start);
+        if (dir < 0) return -1;
+    }
+    return dir;
+}
+
+// Resolve everything but the last component of `name`, relative to
+// `dirname` (itself relative to the root) unless `name` is absolute.
+// Returns the parent directory and points `leaf` at the last component
+static int fs_split(const char* name, const char* dirname, const char** leaf, uint32_t* leaf_len) {
+    int dir = FS_ROOT_INO;
+    if (name[0] != '/' && dirname && dirname[0]) dir = fs_walk(FS_ROOT_INO, dirname, strlen(dirname));
+    if (dir < 0) return -1;
+    uint32_t len = strlen(name);
+    while (len > 1 && name[len - 1] == '/') len--;
+    uint32_t cut = len;
+    while (cut && name[cut - 1] != '/') cut--;
+    if (cut) dir = fs_walk(dir, name, cut);
+    if (dir < 0 || filetable[dir].type != FS_TYPE_DIR) return -1;
+    *leaf = name + cut;
+    *leaf_len = len - cut;
+    return dir;
+}
+
+// Resolve a path to an inode
+static int fs_lookup(const char* name, const char* dirname) {
+    const char *leaf;
+    uint32_t len;
+    int dir = fs_split(name, dirname, &leaf, &len);
+    if (dir < 0) return -1;
+    if (!len) return dir;
+    return fs_dir_lookup(dir, leaf, len);
+}
+
+// Resolve a path that must name a regular file
+static int fs_lookup_file(const char* name, const char* dirname) {
+    int idx = fs_lookup(name, dirname);
+    if (idx < 0 || filetable[idx].type != FS_TYPE_FILE) return -1;
+    return idx;
+}
+
+static int fs_ino_alloc() {
+    uint32_t inodes = superblock.sb.inodes;
+    for (uint32_t n = 0; n < inodes; n++) {
+        uint32_t i = (fs_ino_hint + n) % inodes;
+        if (i != FS_ROOT_INO && !filetable[i].used) {
+            fs_ino_hint = i + 1;
             return i;
+        }
+    }
     return -1;
 }
 
-// Create directory
+// Fill in a new inode, with an empty root leaf for a directory
+static int fs_ino_init(int ino, const char *name, uint32_t len, int parent, int type) {
+    struct fs_disk_entry *f = &filetable[ino];
+    fs_memzero(f, sizeof(*f));
+    strncpy(f->name, name, len);
+    f->block = superblock.sb.extmap_lba + ino;
+    f->parent = parent;
+    f->used = 1;
+    f->type = type;
+    if (type == FS_TYPE_FILE) f->flags = FS_FILE_INLINE;
+    fs_extmap_get(ino, 1);
+    fs_extgen[ino]++;
+    fs_mark_file(ino);
+    if (type == FS_TYPE_DIR) {
+        fs_memzero(&fs_sibling, sizeof(fs_sibling));
+        fs_sibling.leaf = 1;
+        if (fs_dnode_write(ino, 0, &fs_sibling) < 0) return -1;
+    }
+    return 0;
+}
+
+// Create `name` in `parent`; returns the inode (the existing one if the
+// name is already there with the same type)
+static int fs_make(const char* name, const char* dirname, int type) {
+    const char *leaf;
+    uint32_t len;
+    int parent = fs_split(name, dirname, &leaf, &len);
+    if (parent < 0 || !len || len >= FS_MAX_FILENAME) return -1;
+    int ino = fs_dir_lookup(parent, leaf, len);
+    if (ino >= 0) return filetable[ino].type == type ? ino : -1;
+
+    ino = fs_ino_alloc();
+    if (ino < 0) return -1;
+    struct fs_dirent e;
+    fs_memzero(&e, sizeof(e));
+    e.hash = fs_hash(leaf, len);
+    e.ino = ino;
+    e.type = type;
+    strncpy(e.name, leaf, len);
+    if (fs_ino_init(ino, leaf, len, parent, type) < 0 || fs_btree_insert(parent, &e) < 0) {
+        fs_resize(ino, 0);
+        filetable[ino].used = 0;
+        return -1;
+    }
+    fs_dcache_add(parent, leaf, len, ino);
+    return ino;
+}
+
+// Clusters the bitmap may hand out on this device: all FS_CLUSTERS when
+// its size is unknown or it is big enough, else what fits (0 if not even
+// one cluster does)
+static uint32_t fs_device_clusters() {
+    uint32_t cap = disk_capacity();
+    if (!cap) return FS_CLUSTERS;
+    if (cap <= FS_DISK_FILEDATA_START) return 0;
+    uint32_t fit = (cap - FS_DISK_FILEDATA_START) / FS_CLUSTER_SECTORS;
+    return fit < FS_CLUSTERS ? fit : FS_CLUSTERS;
+}
+
+// Images formatted before the drivers reported a size may claim clusters
+// past the end of the disk; stop allocating there. Data already placed
+// beyond it was never written anyway. -1 if the inode table or extent
+// maps themselves lie past the end
+static int fs_fit_device() {
+    struct fs_super *sb = &superblock.sb;
+    uint32_t fit = fs_device_clusters();
+    if (sb->clusters <= fit) return 0;
+    uint32_t end = sb->data_lba + fit * FS_CLUSTER_SECTORS;
+    if (sb->inode_lba + fs_inode_sectors() > end || sb->extmap_lba + sb->inodes > end) return -1;
+    for (uint32_t c = fit; c < sb->clusters; c++)
+        if (!fs_cluster_used(c)) sb->free_clusters--;
+    sb->clusters = fit;
+    fs_mark_meta(FS_META_SUPER);
+    return 0;
+}
+
+// Version 0/1 images (a blank disk reads as an empty version 0 one) are
+// converted in place: the old tables become inodes under a new root, old
+// directories become its subdirectories and each file keeps its data. The
+// version 0 dir index 0 doubles as "no directory", so its files go to the
+// root. Every metadata sector is marked dirty for the caller to write out
+static int fs_upgrade() {
+    static union {
+        struct fs_dir_entry dirs[FS_V1_MAX_DIRS];
+        uint8_t raw[FS_DISK_BLOCK_SIZE];
+    } old_dirs;
+    static union {
+        struct fs_disk_entry_v1 files[FS_V1_MAX_FILES];
+        uint8_t raw[FS_DISK_FTABLE_SECTORS * FS_DISK_BLOCK_SIZE];
+    } old_files;
+    static struct fs_extmap old_map;
+    uint32_t version = superblock.sb.magic == FS_MAGIC ? superblock.sb.version : 0;
+    bcache_read(FS_DISK_START, old_dirs.raw, 1);
+    bcache_read(FS_DISK_START + 1, old_files.raw, FS_DISK_FTABLE_SECTORS);
+
+    struct fs_super *sb = &superblock.sb;
+    if (version == 1) {
+        bcache_read(FS_BITMAP_LBA, fs_bitmap, FS_BITMAP_SECTORS);
+        if (fs_fit_device() < 0) return -1;
+    } else {
+        fs_memzero(superblock.raw, sizeof(superblock.raw));
+        fs_memzero(fs_bitmap, sizeof(fs_bitmap));
+        sb->cluster_sectors = FS_CLUSTER_SECTORS;
+        sb->clusters = fs_device_clusters();
+        if (!sb->clusters) return -1;
+        sb->free_clusters = sb->clusters;
+        sb->bitmap_lba = FS_BITMAP_LBA;
+        sb->data_lba = FS_DISK_FILEDATA_START;
+        for (int i = 0; i < FS_V1_MAX_FILES; i++) {
+            struct fs_disk_entry_v1 *f = &old_files.files[i];
+            if (!f->used) continue;
+            if (f->size > FS_CLUSTER_SIZE) f->size = FS_CLUSTER_SIZE;
+            if (f->size) fs_cluster_set(i, 1, 1);
+        }
+    }
+    sb->magic = FS_MAGIC;
+    sb->version = FS_VERSION;
+    // One inode per FS_CLUSTERS_PER_INODE clusters, in whole sectors; each
+    // also costs an extent map sector. Only upgrades get the old fixed
+    // size as a floor, so a fresh format fits small devices
+    int fresh = version == 0;
+    for (int i = 0; i < FS_V1_MAX_DIRS; i++) fresh &= !old_dirs.dirs[i].used;
+    for (int i = 0; i < FS_V1_MAX_FILES; i++) fresh &= !old_files.files[i].used;
+    uint32_t least = fresh ? FS_INODES_PER_SECTOR : FS_MIN_INODES;
+    uint32_t inodes = sb->clusters / FS_CLUSTERS_PER_INODE / FS_INODES_PER_SECTOR * FS_INODES_PER_SECTOR;
+    sb->inodes = inodes < least ? least : inodes > FS_MAX_FILES ? FS_MAX_FILES : inodes;
+
+    // Inode table and extent map area, each one contiguous run
+    uint32_t got, want = (fs_inode_sectors() + FS_CLUSTER_SECTORS - 1) / FS_CLUSTER_SECTORS;
+    uint32_t c = fs_alloc(sb->clusters, want, &got);
+    if (got != want) return -1;
+    sb->inode_lba = sb->data_lba + c * FS_CLUSTER_SECTORS;
+    want = (sb->inodes + FS_CLUSTER_SECTORS - 1) / FS_CLUSTER_SECTORS;
+    c = fs_alloc(sb->clusters, want, &got);
+    if (got != want) return -1;
+    sb->extmap_lba = sb->data_lba + c * FS_CLUSTER_SECTORS;
+
+    fs_memzero(fileblock.raw, sizeof(fileblock.raw));
+    fs_extmap_reset_cache();
+    if (fs_ino_init(FS_ROOT_INO, "/", 1, FS_ROOT_INO, FS_TYPE_DIR) < 0) return -1;
+
+    int dir_ino[FS_V1_MAX_DIRS];
+    for (int d = 0; d < FS_V1_MAX_DIRS; d++) {
+        dir_ino[d] = FS_ROOT_INO;
+        struct fs_dir_entry *de = &old_dirs.dirs[d];
+        if (!de->used) continue;
+        de->name[FS_MAX_FILENAME - 1] = 0;
+        int ino = fs_make(de->name, NULL, FS_TYPE_DIR);
+        if (ino >= 0 && d) dir_ino[d] = ino;
+    }
+    for (int i = 0; i < FS_V1_MAX_FILES; i++) {
+        struct fs_disk_entry_v1 *f = &old_files.files[i];
+        if (!f->used) continue;
+        if (version == 1) bcache_read(FS_V1_EXTMAP_LBA + i, (uint8_t *)&old_map, 1);
+        f->name[FS_MAX_FILENAME - 1] = 0;
+        // Old directories all sit in the root, so their name is their path
+        int dir = f->dir < FS_V1_MAX_DIRS ? dir_ino[f->dir] : FS_ROOT_INO;
+        int ino = fs_make(f->name, dir == FS_ROOT_INO ? NULL : filetable[dir].name, FS_TYPE_FILE);
+        if (ino < 0) continue;
+        struct fs_extmap *m = fs_extmap_get(ino, 1);
+        filetable[ino].flags = 0;
+        if (version == 1) {
+            *m = old_map;
+        } else if (f->size) {
+            m->count = 1;
+            m->ext[0].start = i;
+            m->ext[0].count = 1;
+        }
+        filetable[ino].size = f->size;
+    }
+    if (version == 1) {
+        uint32_t n = (FS_V1_MAX_FILES + FS_CLUSTER_SECTORS - 1) / FS_CLUSTER_SECTORS;
+        fs_cluster_set(FS_V1_EXTMAP_CLUSTER, n, 0);
+    }
+    for (uint32_t s = 0; s < FS_META_INODE + fs_inode_sectors(); s++) fs_mark_meta(s);
+    return 0;
+}
+
+// Load the superblock, bitmap and inode table, upgrading older formats;
+// -1 if the image is newer than us or cannot be converted
+static int fs_disk_load_table() {
+    bcache_read(FS_SUPER_LBA, superblock.raw, 1);
+    fs_memzero(fs_meta_dirty, sizeof(fs_meta_dirty));
+    fs_meta_pending = 0;
+    fs_extmap_reset_cache();
+    for (int i = 0; i < FS_ZSLOTS; i++) fs_zslot_ino[i] = -1;
+    for (int i = 0; i < FS_DCACHE_SIZE; i++) fs_dcache[i].valid = 0;
+    for (int i = 0; i < FS_MAX_OPEN; i++) fs_handles[i].used = 0;
+    for (int i = 0; i < FS_MAX_OPENDIR; i++) fs_dirhandles[i].used = 0;
+    if (superblock.sb.magic == FS_MAGIC && superblock.sb.version > FS_VERSION) return -1;
+    if (superblock.sb.magic != FS_MAGIC || superblock.sb.version < FS_VERSION)
+        return fs_upgrade();
+    uint32_t inodes = superblock.sb.inodes;
+    if (!inodes || inodes > FS_MAX_FILES || inodes % FS_INODES_PER_SECTOR) return -1;
+    bcache_read(FS_BITMAP_LBA, fs_bitmap, FS_BITMAP_SECTORS);
+    fs_memzero(fileblock.raw, sizeof(fileblock.raw));
+    bcache_read(superblock.sb.inode_lba, fileblock.raw, fs_inode_sectors());
+    return fs_fit_device();
+}
+
+// "/tmp" and what lies under it, with or without the leading '/'; returns
+// the rest of the path, or NULL for anything else
+static const char *fs_tmp_strip(const char* path) {
+    while (*path == '/') path++;
+    if (strncmp(path, "tmp", 3) || (path[3] && path[3] != '/')) return NULL;
+    path += 3;
+    while (*path == '/') path++;
+    return path;
+}
+
+// Files directly in /tmp live in tmpfs: the name there, or NULL
+static const char *fs_tmp_name(const char* name, const char* dirname) {
+    if (name[0] == '/' || !dirname || !dirname[0]) return fs_tmp_strip(name);
+    const char *d = fs_tmp_strip(dirname);
+    return d && !d[0] ? name : NULL;
+}
+
+static uint32_t fs_tmp_size(int idx) {
+    const char *name;
+    uint32_t size = 0;
+    tmpfs_stat(idx, &name, &size);
+    return size;
+}
+
+// Flush metadata and all cached data to disk
+int fs_sync() {
+    fs_flush_meta();
+    return bcache_sync();
+}
+
+// Called from idle loops: once metadata has been dirty for FS_FLUSH_TICKS,
+// queue it for writeback without waiting
+void fs_idle() {
+    if (fs_meta_pending && pit_ticks - fs_meta_since >= FS_FLUSH_TICKS) {
+        fs_flush_meta();
+        bcache_writeback_async();
+    }
+}
+
+// Initialize (load table)
+int fs_init() {
+    if (fs_disk_load_table() < 0) {
+        // Nothing of a half-done format or upgrade may reach the disk
+        fs_memzero(superblock.raw, sizeof(superblock.raw));
+        fs_memzero(fs_meta_dirty, sizeof(fs_meta_dirty));
+        fs_meta_pending = 0;
+        fs_extmap_reset_cache();
+        return -1;
+    }
+    if (fs_meta_pending) return fs_sync();   // Persist an upgrade or shrink right away
+    return 0;
+}
+
+// Create directory; the parent must exist
 int fs_mkdir(const char* dirname) {
-    if (fs_dir_find(dirname) >= 0) return 0; // Already exists
-    for (int i = 0; i < FS_MAX_DIRS; i++) {
-        if (!dirtable[i].used) {
-            strncpy(dirtable[i].name, dirname, FS_MAX_DIRNAME-1);
-            dirtable[i].name[FS_MAX_DIRNAME-1] = 0;
-            dirtable[i].used = 1;
-            fs_disk_save_table();
-            return 0;
+    if (fs_tmp_name(dirname, NULL)) return -1;     // tmpfs is flat
+    return fs_make(dirname, NULL, FS_TYPE_DIR) < 0 ? -1 : 0;
+}
+
+// Position `h` at the first entry of `path`
+static int fs_dir_start(struct fs_dirhandle *h, const char* path) {
+    if (!path || !path[0]) path = "/";
+    const char *t = fs_tmp_name(path, NULL);
+    h->tmp = t != NULL;
+    h->pos = 0;
+    if (t) return t[0] ? -1 : 0;
+    int dir = fs_lookup(path, NULL);
+    if (dir < 0 || filetable[dir].type != FS_TYPE_DIR) return -1;
+    if (fs_btree_first(dir, &h->node) < 0) return -1;
+    h->dir = dir;
+    h->pos = 0;
+    return 0;
+}
+
+// Next entry of `h`, NULL at the end. Entries removed since their leaf was
+// copied are skipped; names point into the resident inode table
+static const struct fs_stat *fs_dir_next(struct fs_dirhandle *h) {
+    if (h->tmp) {
+        while (h->pos < TMPFS_MAX_FILES) {
+            if (tmpfs_stat(h->pos++, &h->st.name, &h->st.size) < 0) continue;
+            h->st.type = FS_TYPE_FILE;
+            return &h->st;
         }
+        return NULL;
+    }
+    if (h->dir < 0) return NULL;
+    for (;;) {
+        if (h->pos == h->node.count) {
+            if (!h->node.next || fs_dnode_read(h->dir, h->node.next, &h->node) < 0) return NULL;
+            h->pos = 0;
+            continue;
+        }
+        struct fs_disk_entry *f = &filetable[h->node.u.ents[h->pos++].ino];
+        if (!f->used || f->parent != h->dir) continue;
+        h->st.name = f->name;
+        h->st.size = f->size;
+        h->st.type = f->type;
+        return &h->st;
     }
-    return -1;
 }
 
-// List files in a directory
+// List a directory in hash order, directories marked with a trailing '/'
 int fs_listdir(const char* dirname, char* out, size_t maxlen) {
-    int dir_idx = fs_dir_find(dirname);
-    if (dir_idx < 0) return -1;
+    static struct fs_dirhandle h;
+    const struct fs_stat *st;
     size_t total = 0;
-    for (int i = 0; i < FS_MAX_FILES; i++) {
-        if (filetable[i].used && filetable[i].dir == dir_idx) {
-            size_t len = strlen(filetable[i].name);
-            if (total + len + 2 < maxlen) {
-                strcpy(out + total, filetable[i].name);
-                total += len;
-                out[total++] = '\n';
-            }
+    if (fs_dir_start(&h, dirname) < 0) return -1;
+    while ((st = fs_dir_next(&h))) {
+        size_t len = strlen(st->name);
+        if (total + len + 3 < maxlen) {
+            strcpy(out + total, st->name);
+            total += len;
+            if (st->type == FS_TYPE_DIR) out[total++] = '/';
+            out[total++] = '\n';
         }
     }
     out[total] = 0;
     return total;
 }
 
+int fs_opendir(const char* dirname) {
+    int dd = 0;
+    while (dd < FS_MAX_OPENDIR && fs_dirhandles[dd].used) dd++;
+    if (dd == FS_MAX_OPENDIR || fs_dir_start(&fs_dirhandles[dd], dirname) < 0) return -1;
+    fs_dirhandles[dd].used = 1;
+    return dd;
+}
+
+const struct fs_stat *fs_readdir(int dd) {
+    if (dd < 0 || dd >= FS_MAX_OPENDIR || !fs_dirhandles[dd].used) return NULL;
+    return fs_dir_next(&fs_dirhandles[dd]);
+}
+
+int fs_closedir(int dd) {
+    if (dd < 0 || dd >= FS_MAX_OPENDIR || !fs_dirhandles[dd].used) return -1;
+    fs_dirhandles[dd].used = 0;
+    return 0;
+}
+
 // Create file (optionally in a directory)
 int fs_create(const char* name, const char* dirname) {
-    int dir_idx = 0; // Default to root dir
-    if (dirname && dirname[0])
-        dir_idx = fs_dir_find(dirname);
-    if (dir_idx < 0) dir_idx = 0;
-    if (fs_disk_find(name, dir_idx) >= 0) return 0; // Already exists
-    for (int i = 0; i < FS_MAX_FILES; i++) {
-        if (!filetable[i].used) {
-            strncpy(filetable[i].name, name, FS_MAX_FILENAME-1);
-            filetable[i].name[FS_MAX_FILENAME-1] = 0;
-            filetable[i].size = 0;
-            filetable[i].block = FS_DISK_FILEDATA_START + i * FS_DISK_FILE_BLOCKS;
-            filetable[i].used = 1;
-            filetable[i].dir = dir_idx;
-            fs_disk_save_table();
-            return 0;
-        }
-    }
-    return -1;
+    const char *t = fs_tmp_name(name, dirname);
+    if (t) return tmpfs_create(t) < 0 ? -1 : 0;
+    return fs_make(name, dirname, FS_TYPE_FILE) < 0 ? -1 : 0;
 }
 
-// Write file
+// Write file, replacing its contents
 int fs_write(const char* name, const char* dirname, const char* data, size_t len) {
-    int dir_idx = 0;
-    if (dirname && dirname[0]) dir_idx = fs_dir_find(dirname);
-    if (dir_idx < 0) dir_idx = 0;
-    int idx = fs_disk_find(name, dir_idx);
+    const char *t = fs_tmp_name(name, dirname);
+    if (t) {
+        int idx = tmpfs_lookup(t);
+        if (tmpfs_truncate(idx, 0) < 0) return -1;
+        return tmpfs_pwrite(idx, 0, data, len) == (int)len ? 0 : -1;
+    }
+    int idx = fs_lookup_file(name, dirname);
+    if (idx < 0 || fs_reserve(idx, len, 0) < 0) return -1;
+    if (fs_io(idx, 0, (uint8_t *)data, len, 0, 1, NULL) < 0) return -1;
+    if (filetable[idx].size != len) {
+        filetable[idx].size = len;
+        fs_mark_file(idx);
+    }
+    return 0;
+}
+
+int fs_pwrite(const char* name, const char* dirname, uint32_t off, const char* data, size_t len) {
+    const char *t = fs_tmp_name(name, dirname);
+    if (t) return tmpfs_pwrite(tmpfs_lookup(t), off, data, len);
+    int idx = fs_lookup_file(name, dirname);
     if (idx < 0) return -1;
-    uint32_t to_write = len > FS_MAX_FILESIZE ? FS_MAX_FILESIZE : len;
-    uint32_t sectors = (to_write + FS_DISK_BLOCK_SIZE - 1) / FS_DISK_BLOCK_SIZE;
-    disk_write(filetable[idx].block, (const uint8_t *)data, sectors);
-    filetable[idx].size = to_write;
-    fs_disk_save_table();
+    return fs_pwrite_idx(idx, off, data, len, NULL);
+}
+
+// Append to the end of the file; a log line costs one sector write, or
+// none while the file is still small enough to be inline
+int fs_append(const char* name, const char* dirname, const char* data, size_t len) {
+    const char *t = fs_tmp_name(name, dirname);
+    if (t) {
+        int idx = tmpfs_lookup(t);
+        return tmpfs_pwrite(idx, fs_tmp_size(idx), data, len);
+    }
+    int idx = fs_lookup_file(name, dirname);
+    if (idx < 0) return -1;
+    return fs_pwrite_idx(idx, filetable[idx].size, data, len, NULL);
+}
+
+int fs_pread(const char* name, const char* dirname, uint32_t off, char* out, size_t len) {
+    const char *t = fs_tmp_name(name, dirname);
+    if (t) return tmpfs_pread(tmpfs_lookup(t), off, out, len);
+    int idx = fs_lookup_file(name, dirname);
+    if (idx < 0) return -1;
+    return fs_pread_idx(idx, off, out, len, NULL);
+}
+
+// Delete a file or an empty directory
+int fs_delete(const char* name, const char* dirname) {
+    const char *t = fs_tmp_name(name, dirname);
+    if (t) {
+        int idx = tmpfs_lookup(t);
+        if (tmpfs_delete(idx) < 0) return -1;
+        for (int i = 0; i < FS_MAX_OPEN; i++)
+            if (fs_handles[i].used && (fs_handles[i].flags & FS_H_TMP) && fs_handles[i].idx == idx)
+                fs_handles[i].idx = -1;
+        return 0;
+    }
+    const char *leaf;
+    uint32_t len;
+    int parent = fs_split(name, dirname, &leaf, &len);
+    if (parent < 0 || !len) return -1;
+    int idx = fs_dir_lookup(parent, leaf, len);
+    if (idx < 0 || idx == FS_ROOT_INO || idx == parent) return -1;
+    if (filetable[idx].type == FS_TYPE_DIR) {
+        struct fs_dnode *n = &fs_node;
+        if (fs_btree_first(idx, n) < 0) return -1;
+        for (;;) {
+            if (n->count) return -1;
+            if (!n->next || fs_dnode_read(idx, n->next, n) < 0) break;
+        }
+    }
+    if (fs_btree_remove(parent, fs_hash(leaf, len), idx) < 0) return -1;
+    fs_dcache_drop(parent, leaf, len);
+    fs_resize(idx, 0);
+    filetable[idx].used = 0;
+    fs_mark_file(idx);
+    for (int i = 0; i < FS_MAX_OPEN; i++)
+        if (fs_handles[i].used && !(fs_handles[i].flags & FS_H_TMP) && fs_handles[i].idx == idx)
+            fs_handles[i].idx = -1;
+    for (int i = 0; i < FS_MAX_OPENDIR; i++)
+        if (fs_dirhandles[i].used && !fs_dirhandles[i].tmp && fs_dirhandles[i].dir == idx)
+            fs_dirhandles[i].dir = -1;
     return 0;
 }
 
-// Read file
+// Turn compression of a file on or off, converting what it holds
+int fs_compress(const char* name, const char* dirname, int enable) {
+    const char *t = fs_tmp_name(name, dirname);
+    if (t) return tmpfs_lookup(t) < 0 ? -1 : 0;    // Pages are never compressed
+    int idx = fs_lookup_file(name, dirname);
+    if (idx < 0) return -1;
+    if (!(filetable[idx].flags & FS_FILE_LZ4) == !enable) return 0;
+    return fs_zconvert(idx, enable);
+}
+
+// Read file from the start
 int fs_read(const char* name, const char* dirname, char* out, size_t maxlen) {
-    int dir_idx = 0;
-    if (dirname && dirname[0]) dir_idx = fs_dir_find(dirname);
-    if (dir_idx < 0) dir_idx = 0;
-    int idx = fs_disk_find(name, dir_idx);
+    return fs_pread(name, dirname, 0, out, maxlen);
+}
+
+// Open a file, resolving it once for the life of the handle
+int fs_open(const char* name, const char* dirname, int flags) {
+    const char *t = fs_tmp_name(name, dirname);
+    int idx = t ? tmpfs_lookup(t) : fs_lookup_file(name, dirname);
+    if (idx < 0 && (flags & FS_O_CREATE))
+        idx = t ? tmpfs_create(t) : fs_make(name, dirname, FS_TYPE_FILE);
     if (idx < 0) return -1;
-    uint32_t to_read = filetable[idx].size > maxlen ? maxlen : filetable[idx].size;
-    uint32_t sectors = (to_read + FS_DISK_BLOCK_SIZE - 1) / FS_DISK_BLOCK_SIZE;
-    disk_read(filetable[idx].block, (uint8_t*)out, sectors);
-    return to_read;
+
+    int fd = 0;
+    while (fd < FS_MAX_OPEN && fs_handles[fd].used) fd++;
+    if (fd == FS_MAX_OPEN) return -1;
+
+    if (t) {
+        if (flags & FS_O_TRUNC) tmpfs_truncate(idx, 0);
+        flags |= FS_H_TMP;
+    } else if ((flags & FS_O_TRUNC) && filetable[idx].size) {
+        fs_reserve(idx, 0, 0);
+        filetable[idx].size = 0;
+        fs_mark_file(idx);
+    }
+    struct fs_handle *h = &fs_handles[fd];
+    h->used = 1;
+    h->flags = flags;
+    h->idx = idx;
+    h->pos = 0;
+    h->cur.gen = t ? 0 : fs_extgen[idx];
+    h->cur.ext = 0;
+    h->cur.sec = 0;
+    h->ra_next = 0;
+    h->ra_window = 0;
+    h->ra_end = 0;
+    return fd;
+}
+
+static struct fs_handle *fs_handle_get(int fd) {
+    if (fd < 0 || fd >= FS_MAX_OPEN || !fs_handles[fd].used || fs_handles[fd].idx < 0)
+        return NULL;
+    return &fs_handles[fd];
+}
+
+int fs_close(int fd) {
+    if (fd < 0 || fd >= FS_MAX_OPEN || !fs_handles[fd].used) return -1;
+    fs_handles[fd].used = 0;
+    return 0;
+}
+
+// Returns the new position, or -1 if it would be negative
+int fs_seek(int fd, int32_t off, int whence) {
+    struct fs_handle *h = fs_handle_get(fd);
+    if (!h) return -1;
+    int32_t base = 0;
+    if (whence == FS_SEEK_CUR) base = h->pos;
+    else if (whence == FS_SEEK_END)
+        base = h->flags & FS_H_TMP ? fs_tmp_size(h->idx) : filetable[h->idx].size;
+    if (base + off < 0) return -1;
+    h->pos = base + off;
+    return h->pos;
+}
+
+// Queue the next `ra_window` sectors from `sec` into the cache without
+// waiting, one request per extent run; a copy of the cursor is used so
+// the reader's own position in the extent map stays put
+static void fs_readahead(struct fs_handle *h, uint32_t sec) {
+    uint32_t size = filetable[h->idx].size;
+    uint32_t end = sec + h->ra_window;
+    uint32_t last = (size + FS_DISK_BLOCK_SIZE - 1) / FS_DISK_BLOCK_SIZE;
+    struct fs_extcur c = h->cur;
+    if (end > last) end = last;
+    if (sec < h->ra_end) sec = h->ra_end;
+    if (filetable[h->idx].flags & FS_FILE_LZ4) {
+        // Whole clusters, and only the sectors each one occupies
+        for (uint32_t cl = sec / FS_CLUSTER_SECTORS; cl * FS_CLUSTER_SECTORS < end; cl++) {
+            uint32_t run, lba = fs_map(h->idx, cl * FS_CLUSTER_SECTORS, &run, &c);
+            if (!run) break;
+            uint32_t zs = fs_extmap_get(h->idx, 0)->zsectors[cl];
+            if (zs) bcache_readahead(lba, zs);
+            sec = (cl + 1) * FS_CLUSTER_SECTORS;
+        }
+    } else {
+        while (sec < end) {
+            uint32_t run, lba = fs_map(h->idx, sec, &run, &c);
+            if (!run) break;
+            if (run > end - sec) run = end - sec;
+            bcache_readahead(lba, run);
+            sec += run;
+        }
+    }
+    if (sec > h->ra_end) h->ra_end = sec;
+}
+
+// Read from the current position. Back-to-back reads grow a readahead
+// window, so a file streamed in small chunks still goes to the disk in
+// large merged requests
+int fs_read_stream(int fd, char* buf, size_t len) {
+    struct fs_handle *h = fs_handle_get(fd);
+    if (!h) return -1;
+    if (h->flags & FS_H_TMP) {
+        int n = tmpfs_pread(h->idx, h->pos, buf, len);
+        if (n > 0) h->pos += n;
+        return n;
+    }
+    if (h->pos == h->ra_next) {
+        h->ra_window = h->ra_window ? h->ra_window * 2 : FS_RA_MIN;
+        if (h->ra_window > FS_RA_MAX) h->ra_window = FS_RA_MAX;
+    } else {
+        h->ra_window = 0;
+        h->ra_end = 0;
+    }
+    int n = fs_pread_idx(h->idx, h->pos, buf, len, &h->cur);
+    if (n < 0) return -1;
+    h->pos += n;
+    h->ra_next = h->pos;
+    if (h->ra_window) fs_readahead(h, h->pos / FS_DISK_BLOCK_SIZE);
+    return n;
+}
+
+// Write at the current position, or at the end with FS_O_APPEND
+int fs_write_stream(int fd, const char* buf, size_t len) {
+    struct fs_handle *h = fs_handle_get(fd);
+    if (!h) return -1;
+    int n;
+    if (h->flags & FS_H_TMP) {
+        if (h->flags & FS_O_APPEND) h->pos = fs_tmp_size(h->idx);
+        n = tmpfs_pwrite(h->idx, h->pos, buf, len);
+    } else {
+        if (h->flags & FS_O_APPEND) h->pos = filetable[h->idx].size;
+        n = fs_pwrite_idx(h->idx, h->pos, buf, len, &h->cur);
+    }
+    if (n < 0) return -1;
+    h->pos += n;
+    return n;
 }
 
 // List all files (in all directories)
 int fs_list(char* out, size_t maxlen) {
     size_t total = 0;
-    for (int i = 0; i < FS_MAX_FILES; i++) {
-        if (filetable[i].used) {
+    for (uint32_t i = 0; i < superblock.sb.inodes; i++) {
+        if (filetable[i].used && filetable[i].type == FS_TYPE_FILE) {
             size_t len = strlen(filetable[i].name);
             if (total + len + 2 < maxlen) {
                 strcpy(out + total, filetable[i].name);
@@ -188,4 +1613,4 @@ int fs_list(char* out, size_t maxlen) {
     }
     out[total] = 0;
     return total;
-}
\ No newline at end of file
+}
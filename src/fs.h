@@ -4,14 +4,69 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#define FS_MAX_FILES 16
+#define FS_MAX_FILES 8192      // Inodes (files and directories) an image can have
 #define FS_MAX_FILENAME 16
-#define FS_MAX_FILESIZE 4096
+#define FS_MAX_OPEN 8
+#define FS_MAX_OPENDIR 4
 
+// Inode types
+#define FS_TYPE_FILE 1
+#define FS_TYPE_DIR  2
+
+// fs_open flags
+#define FS_O_CREATE 1
+#define FS_O_TRUNC  2
+#define FS_O_APPEND 4
+
+// fs_seek whence
+#define FS_SEEK_SET 0
+#define FS_SEEK_CUR 1
+#define FS_SEEK_END 2
+
+// Paths are '/'-separated; relative ones start at `dirname` (a path from
+// the root) or, when that is NULL, at the root. Files directly under /tmp
+// are kept in memory by tmpfs and never reach the disk
 int fs_init();
+int fs_mkdir(const char* dirname);
+int fs_listdir(const char* dirname, char* out, size_t maxlen);
 int fs_create(const char* name, const char* dirname);
 int fs_write(const char* name, const char* dirname, const char* data, size_t len);
-int fs_read(const char* name, char* out, size_t maxlen);
+int fs_read(const char* name, const char* dirname, char* out, size_t maxlen);
+// Byte-range I/O: only the sectors covering [off, off + len) are touched,
+// with read-modify-write for partial edge sectors
+int fs_pread(const char* name, const char* dirname, uint32_t off, char* out, size_t len);
+int fs_pwrite(const char* name, const char* dirname, uint32_t off, const char* data, size_t len);
+int fs_append(const char* name, const char* dirname, const char* data, size_t len);
+int fs_delete(const char* name, const char* dirname);
+// Store a file LZ4-compressed, one 4K cluster at a time; clusters that do
+// not shrink are kept raw. Fails for files over 1 MiB
+int fs_compress(const char* name, const char* dirname, int enable);
 int fs_list(char* out, size_t maxlen);
+// Metadata changes are held in memory until fs_sync() or, once they are
+// FS_FLUSH_TICKS old, the next fs_idle()
+int fs_sync();
+void fs_idle();
+
+// Open-file handles: the name is resolved once, the position is kept per
+// handle, and sequential reads trigger readahead
+int fs_open(const char* name, const char* dirname, int flags);
+int fs_close(int fd);
+int fs_seek(int fd, int32_t off, int whence);
+int fs_read_stream(int fd, char* buf, size_t len);
+int fs_write_stream(int fd, const char* buf, size_t len);
+
+// Directory iteration without copying names: each fs_readdir returns the
+// next entry, or NULL at the end. The struct is reused by the next call;
+// `name` points into the inode table and stays valid until the entry is
+// deleted
+struct fs_stat {
+    const char* name;
+    uint32_t size;
+    uint8_t type;       // FS_TYPE_FILE or FS_TYPE_DIR
+};
+
+int fs_opendir(const char* dirname);
+const struct fs_stat* fs_readdir(int dd);
+int fs_closedir(int dd);
 
 #endif
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "framebuffer.h"
+#include "../mm/paging.h"
 
 #define MULTIBOOT2_TAG_FRAMEBUFFER 8
 
@@ -15,6 +16,8 @@ int framebuffer_init(uint32_t mb2_addr, framebuffer_t *fb) {
             fb->height  = *(uint32_t *)(tag_addr + 20);
             fb->pitch   = *(uint32_t *)(tag_addr + 24);
             fb->bpp     = *(uint8_t *)(tag_addr + 28);
+            // Blits are long runs of writes: let them combine
+            paging_map_wc((uint32_t)fb->address, fb->pitch * fb->height);
             return 0;
         }
         tag_addr += ((tagsize + 7) & ~7);
@@ -1,4 +1,9 @@
 #include "gui.h"
+#include "../cpu/timer.h"
+#include <stddef.h>
+
+#define GUI_FRAME_MS 16         // ~60 frames per second
+#define GUI_MOUSE_POLLS 64      // Status reads per frame to drain the mouse
 
 static mouse_t mouse = {400, 300, 0};
 
@@ -6,10 +11,22 @@ static uint16_t rgb565(uint8_t r, uint8_t g, uint8_t b) {
     return ((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3);
 }
 
+// Colours are kept as RGB565 and widened for 24/32 bpp modes
 static void fb_putpixel(framebuffer_t *fb, int x, int y, uint16_t color) {
     if (x < 0 || y < 0 || x >= (int)fb->width || y >= (int)fb->height) return;
-    uint16_t *pixel = (uint16_t *)(fb->address + y * fb->pitch + x * 2);
-    *pixel = color;
+    uint8_t *row = fb->address + y * fb->pitch;
+    if (fb->bpp == 16) {
+        ((uint16_t *)row)[x] = color;
+        return;
+    }
+    uint32_t rgb = ((color & 0xF800) << 8) | ((color & 0x07E0) << 5) | ((color & 0x001F) << 3);
+    if (fb->bpp == 32) {
+        ((uint32_t *)row)[x] = rgb;
+    } else {
+        row[x * 3] = rgb;
+        row[x * 3 + 1] = rgb >> 8;
+        row[x * 3 + 2] = rgb >> 16;
+    }
 }
 
 static void fb_clear(framebuffer_t *fb, uint16_t color) {
@@ -31,6 +48,7 @@ static void draw_mouse_cursor(framebuffer_t *fb, mouse_t *mouse) {
         fb_putpixel(fb, mouse->x, mouse->y + dy, rgb565(255, 0, 0));
 }
 
+extern void terminal_write(const char *str);
 extern void ps2_mouse_init();
 extern int ps2_mouse_poll(int *dx, int *dy, int *buttons);
 
@@ -53,9 +71,14 @@ void gui_main(framebuffer_t *fb) {
     int win_w = fb->width > 400 ? 400 : fb->width - 20;
     int win_h = fb->height > 300 ? 300 : fb->height - 20;
     int win_x = 10, win_y = 10;
+    struct timer frame;
+    timer_setup(&frame, NULL, NULL);
+    timer_start(&frame, GUI_FRAME_MS, GUI_FRAME_MS);
     while (running) {
-        int dx = 0, dy = 0, btns = 0;
-        if (ps2_mouse_poll(&dx, &dy, &btns)) {
+        // Take every packet that arrived during the last frame
+        for (int i = 0; i < GUI_MOUSE_POLLS; i++) {
+            int dx = 0, dy = 0, btns = 0;
+            if (!ps2_mouse_poll(&dx, &dy, &btns)) continue;
             mouse.x += dx;
             mouse.y += dy;
             if (mouse.x < 0) mouse.x = 0;
@@ -76,6 +99,7 @@ void gui_main(framebuffer_t *fb) {
             mouse.y > btn_y && mouse.y < btn_y+btn_h && (mouse.buttons & 1)) {
             fb_rect(fb, btn_x, btn_y, btn_w, btn_h, rgb565(255,100,100));
         }
-        for (volatile int i = 0; i < 100000; i++);
+        timer_wait(&frame);
     }
+    timer_cancel(&frame);
 }
\ No newline at end of file
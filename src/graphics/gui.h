@@ -2,15 +2,7 @@
 #define GUI_H
 
 #include <stdint.h>
-
-// Simple framebuffer structure for 32bpp mode
-typedef struct {
-    uint32_t width;
-    uint32_t height;
-    uint32_t pitch;      // bytes per row
-    uint32_t bpp;        // bits per pixel
-    uint8_t *address;    // pointer to framebuffer
-} framebuffer_t;
+#include "framebuffer.h"
 
 // Mouse state
 typedef struct {
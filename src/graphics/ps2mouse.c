@@ -29,7 +29,8 @@ void ps2_mouse_init() {
 
 // Poll mouse (returns 1 if movement detected)
 int ps2_mouse_poll(int *dx, int *dy, int *buttons) {
-    if (inb(MOUSE_STATUS_PORT) & 1) {
+    // Only take mouse bytes (bit 5); keyboard bytes belong to IRQ1
+    if ((inb(MOUSE_STATUS_PORT) & 0x21) == 0x21) {
         uint8_t data = inb(MOUSE_DATA_PORT);
         mouse_bytes[mouse_cycle++] = data;
         if (mouse_cycle == 3) {
@@ -3,11 +3,10 @@
 #include "fs.h"
 #include "disk/diskio.h"
 #include "graphics/framebuffer.h"
+#include "cpu/kbd.h"
 
 extern void terminal_clear();
 extern void terminal_write(const char *str);
-extern uint8_t inb(uint16_t port);
-extern const char kbdus[128];
 
 // Simple boot sector (stub): JMP, OEM name, magic number
 uint8_t boot_sector[512] = {
@@ -26,23 +25,12 @@ void installer_run()
     terminal_write("This will erase and install PulseOS to your hard disk.\n");
     terminal_write("Press Y to continue, any other key to abort.\n");
     // Wait for user confirmation
-    while (1)
+    kbd_flush();
+    int c = kbd_getc();
+    if (c != 'Y' && c != 'y')
     {
-        if (inb(0x64) & 0x01)
-        {
-            uint8_t sc = inb(0x60);
-            char c = kbdus[sc];
-            if (!(sc & 0x80))
-            {
-                if (c == 'Y' || c == 'y')
-                    break;
-                else
-                {
-                    terminal_write("Aborted installation.\n");
-                    return;
-                }
-            }
-        }
+        terminal_write("Aborted installation.\n");
+        return;
     }
     terminal_write("Formatting disk...\n");
     disk_write(0, boot_sector, 1);
@@ -53,9 +41,13 @@ void installer_run()
     disk_write(2, _binary_kernel_bin_start, sectors);
 
     terminal_write("Writing system files...\n");
-    fs_init();
-    fs_create("README.txt", NULL);
-    fs_write("README.txt", NULL, "Welcome to PulseOS!\n", 20);
+    if (fs_init() == 0) {
+        fs_create("README.txt", NULL);
+        fs_write("README.txt", NULL, "Welcome to PulseOS!\n", 20);
+        fs_sync();
+    } else {
+        terminal_write("Could not create the filesystem.\n");
+    }
 
     terminal_write("Installation complete!\n");
     terminal_write("Please reboot and boot from your hard disk.\n");
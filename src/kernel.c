@@ -4,7 +4,19 @@
 #include "apps/calc.h"
 #include "apps/notepad.h"
 #include "graphics/framebuffer.h"
+#include "graphics/gui.h"
 #include "fs.h"
+#include "disk/diskio.h"
+#include "disk/bcache.h"
+#include "disk/blkq.h"
+#include "cpu/idt.h"
+#include "cpu/pit.h"
+#include "cpu/kbd.h"
+#include "cpu/timer.h"
+#include "mm/page.h"
+#include "mm/paging.h"
+#include "lib/mem.h"
+#include "mm/slab.h"
 #include "net/wifi.h"
 // ============ VGA Terminal =============
 
@@ -73,31 +85,24 @@ void terminal_write(const char *str)
     }
 }
 
+void terminal_write_uint(uint32_t n)
+{
+    char buf[11];
+    int i = 10;
+    buf[10] = 0;
+    do
+    {
+        buf[--i] = '0' + (n % 10);
+        n /= 10;
+    } while (n);
+    terminal_write(&buf[i]);
+}
+
 void prompt()
 {
     terminal_write("\n$ ");
 }
 
-// ============ Keyboard Tables =============
-
-const char kbdus[128] = {
-    /* 0x00 */ 0, 27, '1', '2', '3', '4', '5', '6', '7', '8', '9', '0', '-', '=', '\b',
-    /* 0x0F */ '\t', 'q', 'w', 'e', 'r', 't', 'y', 'u', 'i', 'o', 'p', '[', ']', '\n',
-    /* 0x1D */ 0, 'a', 's', 'd', 'f', 'g', 'h', 'j', 'k', 'l', ';', '\'', '`',
-    /* 0x2A */ 0, '\\', 'z', 'x', 'c', 'v', 'b', 'n', 'm', ',', '.', '/', 0,
-    '*', 0, ' ', 0,
-    /* 0x39 - 0x7F */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-
-const char kbdus_shift[128] = {
-    /* 0x00 */ 0, 27, '!', '@', '#', '$', '%', '^', '&', '*', '(', ')', '_', '+', '\b',
-    /* 0x0F */ '\t', 'Q', 'W', 'E', 'R', 'T', 'Y', 'U', 'I', 'O', 'P', '{', '}', '\n',
-    /* 0x1D */ 0, 'A', 'S', 'D', 'F', 'G', 'H', 'J', 'K', 'L', ':', '"', '~',
-    /* 0x2A */ 0, '|', 'Z', 'X', 'C', 'V', 'B', 'N', 'M', '<', '>', '?', 0,
-    '*', 0, ' ', 0,
-    /* 0x39 - 0x7F */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-
-volatile int shift_pressed = 0;
-
 // ============ Port I/O =============
 
 uint8_t inb(uint16_t port)
@@ -109,29 +114,58 @@ uint8_t inb(uint16_t port)
 
 // ============ String functions =============
 
-int strcmp(const char *a, const char *b)
+// Implemented in lib/mem.c, dispatched on the CPU's features
+extern int strcmp(const char *a, const char *b);
+extern int strncmp(const char *s1, const char *s2, size_t n);
+
+// ============ Memory benchmark =============
+
+// TSC cycles per call of each variant the CPU supports, by buffer size
+static void membench()
 {
-    while (*a && *b && *a == *b)
+    static const char *ops[3] = {"memcpy", "memset", "strlen"};
+    static const uint32_t sizes[4] = {64, 512, 4096, 65536};
+    uint32_t count;
+    const struct mem_impl *impls = mem_impls(&count);
+    uint8_t *src = page_alloc(4), *dst = page_alloc(4);
+    if (!src || !dst)
     {
-        a++;
-        b++;
+        terminal_write("\nOut of memory.\n");
+        page_free(src);
+        page_free(dst);
+        return;
     }
-    return (unsigned char)*a - (unsigned char)*b;
-}
-
-int strncmp(const char *s1, const char *s2, size_t n)
-{
-    while (n && *s1 && (*s1 == *s2))
+    terminal_write("\nCycles per call. In use:");
+    for (int op = 0; op < 3; op++)
     {
-        ++s1;
-        ++s2;
-        --n;
+        terminal_write(" ");
+        terminal_write(ops[op]);
+        terminal_write("=");
+        terminal_write(mem_active(op)->name);
     }
-    if (n == 0)
+    terminal_write("\n");
+    for (int op = 0; op < 3; op++)
     {
-        return 0;
+        for (int s = 0; s < 4; s++)
+        {
+            terminal_write(ops[op]);
+            terminal_write(" ");
+            terminal_write_uint(sizes[s]);
+            terminal_write(":");
+            for (uint32_t i = 0; i < count; i++)
+            {
+                if ((impls[i].needs & mem_cpu_features()) != impls[i].needs)
+                    continue;
+                terminal_write("  ");
+                terminal_write(impls[i].name);
+                terminal_write(" ");
+                terminal_write_uint(mem_bench(&impls[i], op, dst, src, sizes[s]));
+            }
+            terminal_write("\n");
+        }
     }
-    return (*(unsigned char *)s1) - (*(unsigned char *)s2);
+    page_free(src);
+    page_free(dst);
 }
 
 // ============ Command Processing =============
@@ -155,6 +189,16 @@ void process_command(const char *cmd)
         terminal_write("  help        - Show this help\n");
         terminal_write("  clear       - Clear screen\n");
         terminal_write("  about       - System info\n");
+        terminal_write("  diskstat    - Disk wait counters\n");
+        terminal_write("  cachestat   - Block cache counters\n");
+        terminal_write("  sync        - Write cached blocks to disk\n");
+        terminal_write("  mem         - Physical memory usage\n");
+        terminal_write("  slabinfo    - Kernel object caches\n");
+        terminal_write("  membench    - Compare memcpy/memset/strlen variants\n");
+        terminal_write("  clock       - Clock source, uptime and timers\n");
+        terminal_write("  ls [dir]    - List a directory\n");
+        terminal_write("  mkdir <dir> - Create a directory\n");
+        terminal_write("  rm <path>   - Remove a file or empty directory\n");
         terminal_write("  run <app>   - Run an application\n");
         terminal_write("\nAvailable apps: snake, calc, notepad\n");
         prompt();
@@ -166,24 +210,178 @@ void process_command(const char *cmd)
         terminal_write("Version: 0.2\n");
         prompt();
     }
-    else if (!strcmp(cmd, "ls"))
+    else if (!strcmp(cmd, "diskstat"))
     {
-        char out[1024];
-        fs_listdir(cmd, out, sizeof(out));
-        terminal_write("\nFiles & Dirs:\n");
-        terminal_write(out);
+        struct disk_stats st;
+        disk_get_stats(&st);
+        // Cycle counts in units of 2^20 to stay in 32-bit arithmetic
+        terminal_write("\nSpin wait (Mcycles):  ");
+        terminal_write_uint((uint32_t)(st.spin_cycles >> 20));
+        terminal_write("\nSleep wait (Mcycles): ");
+        terminal_write_uint((uint32_t)(st.sleep_cycles >> 20));
+        terminal_write("\nIRQs: ");
+        terminal_write_uint(st.irqs);
+        terminal_write("  Timeouts: ");
+        terminal_write_uint(st.timeouts);
+        terminal_write("  Errors: ");
+        terminal_write_uint(st.errors);
+        terminal_write("\n");
+        prompt();
+    }
+    else if (!strcmp(cmd, "cachestat"))
+    {
+        struct bcache_stats st;
+        bcache_get_stats(&st);
+        terminal_write("\nHits: ");
+        terminal_write_uint(st.hits);
+        terminal_write("  Misses: ");
+        terminal_write_uint(st.misses);
+        terminal_write("\nWritebacks: ");
+        terminal_write_uint(st.writebacks);
+        terminal_write("  Evictions: ");
+        terminal_write_uint(st.evictions);
+        terminal_write("\nReadahead: ");
+        terminal_write_uint(st.readaheads);
+        terminal_write("\n");
+        prompt();
+    }
+    else if (!strcmp(cmd, "mem"))
+    {
+        struct page_stats st;
+        page_get_stats(&st);
+        terminal_write("\nTotal: ");
+        terminal_write_uint(st.total_pages * (PAGE_SIZE / 1024));
+        terminal_write(" KiB  Free: ");
+        terminal_write_uint(st.free_pages * (PAGE_SIZE / 1024));
+        terminal_write(" KiB  Used: ");
+        terminal_write_uint((st.total_pages - st.free_pages) * (PAGE_SIZE / 1024));
+        terminal_write(" KiB\nReserved at boot: ");
+        terminal_write_uint(st.reserved_pages * (PAGE_SIZE / 1024));
+        terminal_write(" KiB\nFree blocks by order:");
+        for (uint32_t o = 0; o <= PAGE_MAX_ORDER; o++)
+        {
+            terminal_write(" ");
+            terminal_write_uint(st.free_blocks[o]);
+        }
+        terminal_write("\n");
+        prompt();
+    }
+    else if (!strcmp(cmd, "slabinfo"))
+    {
+        terminal_write("\ncache           size  active/total  slabs\n");
+        for (const struct slab_cache *c = slab_cache_next(NULL); c; c = slab_cache_next(c))
+        {
+            size_t n = 0;
+            while (c->name[n])
+                n++;
+            terminal_write(c->name);
+            while (n++ < 16)
+                terminal_write(" ");
+            terminal_write_uint(c->size);
+            terminal_write("  ");
+            terminal_write_uint(c->active);
+            terminal_write("/");
+            terminal_write_uint(c->total);
+            terminal_write("  ");
+            terminal_write_uint(c->slabs);
+            terminal_write("\n");
+        }
+        prompt();
+    }
+    else if (!strcmp(cmd, "membench"))
+    {
+        membench();
+        prompt();
+    }
+    else if (!strcmp(cmd, "clock"))
+    {
+        struct timer_info info;
+        timer_get_info(&info);
+        terminal_write("\nSource: ");
+        terminal_write(info.source);
+        terminal_write("  TSC: ");
+        terminal_write_uint(info.tsc_khz / 1000);
+        terminal_write(" MHz");
+        if (info.hpet_period_fs)
+        {
+            terminal_write("  HPET tick: ");
+            terminal_write_uint(info.hpet_period_fs / 1000);
+            terminal_write(" ps");
+        }
+        uint32_t ticks = pit_ticks;
+        terminal_write("\nUptime: ");
+        terminal_write_uint(ticks / PIT_HZ);
+        terminal_write(" s ");
+        terminal_write_uint(ticks % PIT_HZ * 1000 / PIT_HZ);
+        terminal_write(" ms\nTimers pending: ");
+        terminal_write_uint(info.pending);
+        terminal_write("  Fired: ");
+        terminal_write_uint(info.fired);
+        terminal_write("\n");
+        prompt();
+    }
+    else if (!strcmp(cmd, "sync"))
+    {
+        if (fs_sync() == 0)
+            terminal_write("\nSynced.\n");
+        else
+            terminal_write("\nSync failed.\n");
+        prompt();
+    }
+    else if (!strcmp(cmd, "ls") || !strncmp(cmd, "ls ", 3))
+    {
+        int dd = fs_opendir(cmd[2] ? cmd + 3 : "/");
+        if (dd < 0)
+            terminal_write("\nNo such directory.\n");
+        else
+        {
+            const struct fs_stat *st;
+            terminal_write("\nFiles & Dirs:\n");
+            while ((st = fs_readdir(dd)))
+            {
+                terminal_write(st->name);
+                if (st->type == FS_TYPE_DIR)
+                    terminal_write("/");
+                else
+                {
+                    terminal_write("  ");
+                    terminal_write_uint(st->size);
+                }
+                terminal_write("\n");
+            }
+            fs_closedir(dd);
+        }
         prompt();
     }
     
     else if (!strncmp(cmd, "mkdir ", 6))
     {
         const char *arg = cmd + 6;
-        if (fs_mkdir(cmd, arg) == 0)
+        if (fs_mkdir(arg) == 0)
             terminal_write("\nDirectory created.\n");
         else
             terminal_write("\nFailed to create directory.\n");
         prompt();
     }
+    else if (!strncmp(cmd, "rm ", 3))
+    {
+        if (fs_delete(cmd + 3, NULL) == 0)
+            terminal_write("\nFile removed.\n");
+        else
+        {
+            // Only empty directories can go; say why a directory stayed
+            int dd = fs_opendir(cmd + 3);
+            if (dd < 0)
+                terminal_write("\nNo such file.\n");
+            else if (fs_readdir(dd))
+                terminal_write("\nDirectory not empty.\n");
+            else
+                terminal_write("\nCannot remove.\n");
+            if (dd >= 0)
+                fs_closedir(dd);
+        }
+        prompt();
+    }
     else if (!strncmp(cmd, "run ", 4))
     {
         // Parse: run <app> [options]
@@ -206,6 +404,7 @@ void process_command(const char *cmd)
         else if (!strcmp(appname, "calc"))
         {
             calc_app(terminal_clear, terminal_write);
+            fs_sync();
             prompt();
         }
         else if (!strcmp(appname, "notepad"))
@@ -231,6 +430,7 @@ void process_command(const char *cmd)
                     read_mode = 1;
             }
             notepad_app(terminal_clear, terminal_write, read_mode, filename);
+            fs_sync();
             prompt();
         }
         else
@@ -270,11 +470,7 @@ void splash_screen()
 
 void sleep_5_seconds()
 {
-    // Calibrate this for your hardware; example for ~5 seconds:
-    for (volatile unsigned long i = 0; i < 200000000; ++i)
-    {
-        __asm__ volatile("nop");
-    }
+    msleep(5000);
 }
 
 void main_input_loop()
@@ -283,54 +479,98 @@ void main_input_loop()
     cmd_len = 0;
     while (1)
     {
-        if (inb(0x64) & 0x01)
+        int c = kbd_poll();
+        if (c < 0)
         {
-            uint8_t sc = inb(0x60);
-
-            // Shift key logic
-            if (sc == 0x2A || sc == 0x36)
-            { // Shift press
-                shift_pressed = 1;
-                continue;
-            }
-            if (sc == 0xAA || sc == 0xB6)
-            { // Shift release
-                shift_pressed = 0;
-                continue;
+            fs_idle();
+            blk_idle();
+            kbd_wait();
+            continue;
+        }
+        if (c == '\b')
+        {
+            if (cmd_len > 0)
+            {
+                cmd_len--;
+                terminal_putchar('\b');
             }
+        }
+        else if (c == '\n')
+        {
+            cmd_buffer[cmd_len] = '\0';
+            terminal_write("\n");
+            process_command(cmd_buffer);
+            cmd_len = 0;
+        }
+        else if (cmd_len < CMD_BUF_SIZE - 1)
+        {
+            cmd_buffer[cmd_len++] = c;
+            char out[2] = {c, '\0'};
+            terminal_write(out);
+        }
+    }
+}
 
-            if (!(sc & 0x80))
-            { // Key press
-                char c = shift_pressed ? kbdus_shift[sc] : kbdus[sc];
-                if (c == '\b' && cmd_len > 0)
-                {
-                    cmd_len--;
-                    terminal_putchar('\b');
-                }
-                else if (c == '\n')
-                {
-                    cmd_buffer[cmd_len] = '\0';
-                    terminal_write("\n");
-                    process_command(cmd_buffer);
-                    cmd_len = 0;
-                }
-                else if (c && cmd_len < CMD_BUF_SIZE - 1)
-                {
-                    cmd_buffer[cmd_len++] = c;
-                    char out[2] = {c, '\0'};
-                    terminal_write(out);
-                }
-            }
+// ============ Kernel Command Line =============
+
+#define MULTIBOOT2_TAG_CMDLINE 1
+
+// Command line passed by the bootloader, "" if there is none
+static const char *mb2_cmdline(uint32_t mb2_addr)
+{
+    uint32_t size = *(uint32_t *)mb2_addr;
+    uint32_t tag_addr = mb2_addr + 8;
+    while (tag_addr < mb2_addr + size)
+    {
+        uint32_t type = *(uint32_t *)tag_addr;
+        uint32_t tagsize = *(uint32_t *)(tag_addr + 4);
+        if (type == MULTIBOOT2_TAG_CMDLINE)
+            return (const char *)(tag_addr + 8);
+        if (type == 0)
+            break;
+        tag_addr += ((tagsize + 7) & ~7);
+    }
+    return "";
+}
+
+// Size given as key=<n>[K|M] (MiB without a suffix), in bytes; 0 if absent
+static uint32_t cmdline_size(const char *cmdline, const char *key)
+{
+    size_t klen = 0;
+    while (key[klen])
+        klen++;
+    const char *p = cmdline;
+    while (*p)
+    {
+        if (!strncmp(p, key, klen) && p[klen] == '=')
+        {
+            uint32_t n = 0;
+            p += klen + 1;
+            while (*p >= '0' && *p <= '9')
+                n = n * 10 + (*p++ - '0');
+            return (*p == 'K' || *p == 'k') ? n * 1024 : n * 1024 * 1024;
         }
-        for (volatile int i = 0; i < 50000; i++)
-            ; // Small delay
+        while (*p && *p != ' ')
+            p++;
+        while (*p == ' ')
+            p++;
     }
+    return 0;
 }
 
 // ============ Kernel Entry Point =============
 
 void kernel_main(uint32_t mb2_addr)
 {
+    page_init(mb2_addr);
+    paging_init();
+    mem_init();
+    idt_init();
+    pit_init(PIT_HZ);
+    kbd_init();
+    __asm__ volatile("sti");
+    timer_init(mb2_addr);
+
     splash_screen();
     sleep_5_seconds();
     terminal_clear();
@@ -346,23 +586,11 @@ void kernel_main(uint32_t mb2_addr)
     // Wait for user input (single key)
 
     int choice = 0;
-    while (1)
-    {
-        if (inb(0x64) & 0x01)
-        {
-            uint8_t sc = inb(0x60);
-            char c = kbdus[sc];
-            if (!(sc & 0x80) && (c == '1' || c == '2' || c == '3'))
-            {
-                choice = c - '0';
-                char out[4] = {c, '\n', 0};
-                terminal_write(out);
-                break;
-            }
-        }
-        for (volatile int i = 0; i < 50000; i++)
-            ;
-    }
+    kbd_flush();
+    while (choice < 1 || choice > 3)
+        choice = kbd_getc() - '0';
+    char out[3] = {'0' + choice, '\n', 0};
+    terminal_write(out);
     if (choice == 3)
     {
         terminal_write("Launching Installer...\n");
@@ -447,7 +675,7 @@ void kernel_main(uint32_t mb2_addr)
             }
 
             if (fb.bpp == 16 || fb.bpp == 24 || fb.bpp == 32)
-                terminal_write("GUI working !!!");
+                gui_main(&fb);
             else
             {
                 terminal_write("Framebuffer bpp not supported!\n");
@@ -468,18 +696,21 @@ void kernel_main(uint32_t mb2_addr)
         terminal_clear();
         terminal_setcolor(0x1F); // Bright white on blue
         terminal_write("PulseOS Terminal\nType 'help' for options.\n");
+        // ramdisk=<size> keeps the whole filesystem in memory for this boot
+        uint32_t ramdisk = cmdline_size(mb2_cmdline(mb2_addr), "ramdisk");
+        if (ramdisk && disk_use_ramdisk(ramdisk / 512) == 0)
+            terminal_write("Using ramdisk instead of disk.\n");
         terminal_write("Loading Disk Drive...\n");
-        fs_init();
-        terminal_write("Loaded Disk Drive...\n");
+        if (fs_init() == 0)
+            terminal_write("Loaded Disk Drive...\n");
+        else
+            terminal_write("No usable filesystem on the disk; files will not be saved.\n");
         main_input_loop();
     }
 }
 
 // ============ Externs for apps =============
 
-const char kbdus[128];
-const char kbdus_shift[128];
-volatile int shift_pressed;
 uint8_t inb(uint16_t port);
 void terminal_clear();
 void terminal_write(const char *str);
\ No newline at end of file
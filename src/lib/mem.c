@@ -0,0 +1,331 @@
+#include "mem.h"
+#include "../cpu/cpu.h"
+
+#define MEM_SSE_MIN     64          // Shorter copies are not worth the setup
+#define MEM_NT_MIN      (256 * 1024)  // Copies this long bypass the cache
+#define MEM_BENCH_RUNS  5
+#define MEM_BENCH_BYTES 65536       // Repeat short calls up to about this much work
+
+#define CPUID1_EDX_FXSR (1u << 24)
+#define CPUID1_EDX_SSE  (1u << 25)
+#define CPUID1_EDX_SSE2 (1u << 26)
+#define CPUID7_EBX_ERMS (1u << 9)
+#define CR0_MP          (1u << 1)
+#define CR0_EM          (1u << 2)
+#define CR0_TS          (1u << 3)
+#define CR4_OSFXSR      (1u << 9)
+#define CR4_OSXMMEXCPT  (1u << 10)
+
+// Set for isr.s: interrupt stubs save the SSE registers around handlers
+extern uint32_t isr_fxsave;
+
+typedef uint32_t __attribute__((may_alias)) mem_word_t;
+typedef uint32_t __attribute__((vector_size(16))) mem_vec_t;
+
+static uint32_t mem_features = 0;
+
+// ---- Byte loops: the reference, and the fallback on any CPU ----
+
+// Kept as loops: the compiler would otherwise turn them back into calls
+#define MEM_NO_BUILTIN __attribute__((optimize("no-tree-loop-distribute-patterns")))
+
+static MEM_NO_BUILTIN void *mem_copy_byte(void *d, const void *s, size_t n) {
+    uint8_t *dd = d;
+    const uint8_t *ss = s;
+    for (size_t i = 0; i < n; i++) dd[i] = ss[i];
+    return d;
+}
+
+static MEM_NO_BUILTIN void *mem_set_byte(void *d, int c, size_t n) {
+    uint8_t *dd = d;
+    for (size_t i = 0; i < n; i++) dd[i] = c;
+    return d;
+}
+
+static size_t mem_len_byte(const char *s) {
+    size_t i = 0;
+    while (s[i]) i++;
+    return i;
+}
+
+// ---- String instructions ----
+
+static void *mem_copy_movsd(void *d, const void *s, size_t n) {
+    uint32_t d0, d1, d2;
+    __asm__ volatile ("rep movsl\n\t"
+                      "mov %4, %%ecx\n\t"
+                      "rep movsb"
+                      : "=&D"(d0), "=&S"(d1), "=&c"(d2)
+                      : "0"(d), "r"(n & 3), "1"(s), "2"(n >> 2) : "memory");
+    return d;
+}
+
+static void *mem_set_stosd(void *d, int c, size_t n) {
+    uint32_t d0, d1, v = (uint8_t)c * 0x01010101u;
+    __asm__ volatile ("rep stosl\n\t"
+                      "mov %3, %%ecx\n\t"
+                      "rep stosb"
+                      : "=&D"(d0), "=&c"(d1)
+                      : "a"(v), "r"(n & 3), "0"(d), "1"(n >> 2) : "memory");
+    return d;
+}
+
+static void *mem_copy_erms(void *d, const void *s, size_t n) {
+    uint32_t d0, d1, d2;
+    __asm__ volatile ("rep movsb" : "=&D"(d0), "=&S"(d1), "=&c"(d2)
+                      : "0"(d), "1"(s), "2"(n) : "memory");
+    return d;
+}
+
+static void *mem_set_erms(void *d, int c, size_t n) {
+    uint32_t d0, d1;
+    __asm__ volatile ("rep stosb" : "=&D"(d0), "=&c"(d1)
+                      : "a"(c), "0"(d), "1"(n) : "memory");
+    return d;
+}
+
+// A word at a time: (w - 0x01..) & ~w & 0x80.. is non-zero iff a byte of w
+// is zero. Aligned words never cross into an unmapped page
+static size_t mem_len_word(const char *s) {
+    const char *p = s;
+    for (; (uintptr_t)p & 3; p++)
+        if (!*p) return p - s;
+    const mem_word_t *w = (const mem_word_t *)p;
+    while (!((*w - 0x01010101u) & ~*w & 0x80808080u)) w++;
+    for (p = (const char *)w; *p; p++);
+    return p - s;
+}
+
+// ---- SSE2: 16 bytes per instruction. isr.s saves the registers ----
+
+// The kernel is built without SSE; these functions alone may use it
+#define MEM_SSE2 __attribute__((target("sse2")))
+
+// The first and last 16 bytes go unaligned, which covers the ragged ends;
+// everything between is stored aligned, overlapping them
+static MEM_SSE2 void *mem_copy_sse2(void *d, const void *s, size_t n) {
+    if (n < MEM_SSE_MIN) return mem_copy_movsd(d, s, n);
+    uint8_t *dp = d;
+    const uint8_t *sp = s;
+    __asm__ volatile ("movdqu (%0), %%xmm0\n\t"
+                      "movdqu -16(%0,%2), %%xmm1\n\t"
+                      "movdqu %%xmm0, (%1)\n\t"
+                      "movdqu %%xmm1, -16(%1,%2)"
+                      : : "r"(sp), "r"(dp), "r"(n) : "memory", "xmm0", "xmm1");
+    size_t head = (16 - ((uintptr_t)dp & 15)) & 15;
+    dp += head;
+    sp += head;
+    n -= head;
+    int nt = n >= MEM_NT_MIN;
+    for (; n >= 64; n -= 64, dp += 64, sp += 64) {
+        if (nt)
+            __asm__ volatile ("movdqu (%0), %%xmm0\n\t"
+                              "movdqu 16(%0), %%xmm1\n\t"
+                              "movdqu 32(%0), %%xmm2\n\t"
+                              "movdqu 48(%0), %%xmm3\n\t"
+                              "movntdq %%xmm0, (%1)\n\t"
+                              "movntdq %%xmm1, 16(%1)\n\t"
+                              "movntdq %%xmm2, 32(%1)\n\t"
+                              "movntdq %%xmm3, 48(%1)"
+                              : : "r"(sp), "r"(dp) : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+        else
+            __asm__ volatile ("movdqu (%0), %%xmm0\n\t"
+                              "movdqu 16(%0), %%xmm1\n\t"
+                              "movdqu 32(%0), %%xmm2\n\t"
+                              "movdqu 48(%0), %%xmm3\n\t"
+                              "movdqa %%xmm0, (%1)\n\t"
+                              "movdqa %%xmm1, 16(%1)\n\t"
+                              "movdqa %%xmm2, 32(%1)\n\t"
+                              "movdqa %%xmm3, 48(%1)"
+                              : : "r"(sp), "r"(dp) : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+    }
+    if (nt) __asm__ volatile ("sfence" : : : "memory");
+    for (; n >= 16; n -= 16, dp += 16, sp += 16)
+        __asm__ volatile ("movdqu (%0), %%xmm0\n\t"
+                          "movdqa %%xmm0, (%1)"
+                          : : "r"(sp), "r"(dp) : "memory", "xmm0");
+    return d;
+}
+
+static MEM_SSE2 void *mem_set_sse2(void *d, int c, size_t n) {
+    if (n < MEM_SSE_MIN) return mem_set_stosd(d, c, n);
+    uint8_t *dp = d;
+    uint32_t v = (uint8_t)c * 0x01010101u;
+    // Handed to each asm as an operand, so the compiler keeps it live
+    mem_vec_t x;
+    __asm__ ("movd %1, %0\n\t"
+             "pshufd $0, %0, %0"
+             : "=x"(x) : "r"(v));
+    __asm__ volatile ("movdqu %2, (%0)\n\t"
+                      "movdqu %2, -16(%0,%1)"
+                      : : "r"(dp), "r"(n), "x"(x) : "memory");
+    size_t head = (16 - ((uintptr_t)dp & 15)) & 15;
+    dp += head;
+    n -= head;
+    for (; n >= 64; n -= 64, dp += 64)
+        __asm__ volatile ("movdqa %1, (%0)\n\t"
+                          "movdqa %1, 16(%0)\n\t"
+                          "movdqa %1, 32(%0)\n\t"
+                          "movdqa %1, 48(%0)"
+                          : : "r"(dp), "x"(x) : "memory");
+    for (; n >= 16; n -= 16, dp += 16)
+        __asm__ volatile ("movdqa %1, (%0)" : : "r"(dp), "x"(x) : "memory");
+    return d;
+}
+
+// Bit i set where byte i of the aligned 16 bytes at p is zero
+static MEM_SSE2 inline uint32_t mem_zero_mask16(uintptr_t p) {
+    uint32_t mask;
+    __asm__ volatile ("pxor %%xmm0, %%xmm0\n\t"
+                      "pcmpeqb (%1), %%xmm0\n\t"
+                      "pmovmskb %%xmm0, %0"
+                      : "=r"(mask) : "r"(p) : "memory", "xmm0");
+    return mask;
+}
+
+static MEM_SSE2 size_t mem_len_sse2(const char *s) {
+    uintptr_t p = (uintptr_t)s & ~15u;
+    uint32_t mask = mem_zero_mask16(p) & (0xFFFFu << ((uintptr_t)s & 15));
+    while (!mask) {
+        p += 16;
+        mask = mem_zero_mask16(p);
+    }
+    return p + __builtin_ctz(mask) - (uintptr_t)s;
+}
+
+static const struct mem_impl mem_table[] = {
+    { "byte",  0,            mem_copy_byte,  mem_set_byte,  mem_len_byte },
+    { "movsd", 0,            mem_copy_movsd, mem_set_stosd, mem_len_word },
+    { "sse2",  MEM_CPU_SSE2, mem_copy_sse2,  mem_set_sse2,  mem_len_sse2 },
+    { "erms",  MEM_CPU_ERMS, mem_copy_erms,  mem_set_erms,  mem_len_word },
+};
+#define MEM_IMPLS (sizeof(mem_table) / sizeof(mem_table[0]))
+
+// What runs until mem_init has looked at the CPU
+static const struct mem_impl *mem_use[3] = { &mem_table[1], &mem_table[1], &mem_table[1] };
+
+void mem_init() {
+    uint32_t a, b, c, d, max;
+    cpuid(0, &max, &b, &c, &d);
+    cpuid(1, &a, &b, &c, &d);
+    if ((d & CPUID1_EDX_FXSR) && (d & CPUID1_EDX_SSE) && (d & CPUID1_EDX_SSE2)) {
+        uint32_t cr0, cr4;
+        __asm__ volatile ("mov %%cr0, %0" : "=r"(cr0));
+        __asm__ volatile ("mov %0, %%cr0" : : "r"((cr0 & ~(CR0_EM | CR0_TS)) | CR0_MP));
+        __asm__ volatile ("mov %%cr4, %0" : "=r"(cr4));
+        __asm__ volatile ("mov %0, %%cr4" : : "r"(cr4 | CR4_OSFXSR | CR4_OSXMMEXCPT));
+        __asm__ volatile ("fninit");
+        isr_fxsave = 1;
+        mem_features |= MEM_CPU_SSE2;
+    }
+    if (max >= 7) {
+        cpuid(7, &a, &b, &c, &d);
+        if (b & CPUID7_EBX_ERMS) mem_features |= MEM_CPU_ERMS;
+    }
+    // Fast strings beat an SSE loop for copies and fills once the CPU
+    // advertises them; SSE2 always wins at scanning
+    const struct mem_impl *block = &mem_table[1];
+    if (mem_features & MEM_CPU_SSE2) block = &mem_table[2];
+    if (mem_features & MEM_CPU_ERMS) block = &mem_table[3];
+    mem_use[MEM_OP_COPY] = block;
+    mem_use[MEM_OP_SET] = block;
+    mem_use[MEM_OP_STRLEN] = (mem_features & MEM_CPU_SSE2) ? &mem_table[2] : &mem_table[1];
+}
+
+uint32_t mem_cpu_features() {
+    return mem_features;
+}
+
+const struct mem_impl *mem_impls(uint32_t *count) {
+    *count = MEM_IMPLS;
+    return mem_table;
+}
+
+const struct mem_impl *mem_active(int op) {
+    return mem_use[op];
+}
+
+uint32_t mem_bench(const struct mem_impl *impl, int op, void *dst, void *src, uint32_t size) {
+    uint32_t loops = size < MEM_BENCH_BYTES ? MEM_BENCH_BYTES / size : 1;
+    uint32_t best = 0xFFFFFFFF;
+    if (op == MEM_OP_STRLEN) {
+        mem_set_stosd(src, 'x', size - 1);
+        ((char *)src)[size - 1] = 0;
+    }
+    for (uint32_t r = 0; r < MEM_BENCH_RUNS; r++) {
+        uint64_t t0 = rdtsc();
+        for (uint32_t i = 0; i < loops; i++) {
+            if (op == MEM_OP_COPY) impl->copy(dst, src, size);
+            else if (op == MEM_OP_SET) impl->set(dst, i, size);
+            else impl->len(src);
+        }
+        uint32_t t = (uint32_t)(rdtsc() - t0) / loops;
+        if (t < best) best = t;
+    }
+    return best;
+}
+
+// ---- The exported functions ----
+
+void *memcpy(void *d, const void *s, size_t n) {
+    return mem_use[MEM_OP_COPY]->copy(d, s, n);
+}
+
+void *memset(void *d, int c, size_t n) {
+    return mem_use[MEM_OP_SET]->set(d, c, n);
+}
+
+size_t strlen(const char *s) {
+    return mem_use[MEM_OP_STRLEN]->len(s);
+}
+
+// Equal words cannot hold the terminator unless it is in both, so compare
+// a word at a time while the strings share an alignment
+int strcmp(const char *a, const char *b) {
+    if (!(((uintptr_t)a ^ (uintptr_t)b) & 3)) {
+        for (; (uintptr_t)a & 3; a++, b++)
+            if (*a != *b || !*a) return (unsigned char)*a - (unsigned char)*b;
+        const mem_word_t *wa = (const mem_word_t *)a, *wb = (const mem_word_t *)b;
+        while (*wa == *wb && !((*wa - 0x01010101u) & ~*wa & 0x80808080u)) {
+            wa++;
+            wb++;
+        }
+        a = (const char *)wa;
+        b = (const char *)wb;
+    }
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return (unsigned char)*a - (unsigned char)*b;
+}
+
+int strncmp(const char *a, const char *b, size_t n) {
+    if (!(((uintptr_t)a ^ (uintptr_t)b) & 3)) {
+        for (; n && ((uintptr_t)a & 3); a++, b++, n--)
+            if (*a != *b || !*a) return (unsigned char)*a - (unsigned char)*b;
+        const mem_word_t *wa = (const mem_word_t *)a, *wb = (const mem_word_t *)b;
+        while (n >= 4 && *wa == *wb && !((*wa - 0x01010101u) & ~*wa & 0x80808080u)) {
+            wa++;
+            wb++;
+            n -= 4;
+        }
+        a = (const char *)wa;
+        b = (const char *)wb;
+    }
+    for (; n; a++, b++, n--)
+        if (*a != *b || !*a) return (unsigned char)*a - (unsigned char)*b;
+    return 0;
+}
+
+char *strcpy(char *d, const char *s) {
+    return mem_use[MEM_OP_COPY]->copy(d, s, strlen(s) + 1);
+}
+
+char *strncpy(char *d, const char *s, size_t n) {
+    size_t len = 0;
+    while (len < n && s[len]) len++;
+    mem_use[MEM_OP_COPY]->copy(d, s, len);
+    mem_use[MEM_OP_SET]->set(d + len, 0, n - len);
+    return d;
+}
@@ -0,0 +1,39 @@
+#ifndef MEM_H
+#define MEM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// memcpy, memset, strlen and friends for the kernel. The block functions
+// come in several variants; mem_init picks the fastest one the CPU has
+// (after turning SSE on) and the exported functions dispatch to it
+
+#define MEM_CPU_SSE2    0x01
+#define MEM_CPU_ERMS    0x02    // Enhanced rep movsb/stosb
+
+struct mem_impl {
+    const char *name;
+    uint32_t needs;             // MEM_CPU_* the variant requires
+    void *(*copy)(void *d, const void *s, size_t n);
+    void *(*set)(void *d, int c, size_t n);
+    size_t (*len)(const char *s);
+};
+
+#define MEM_OP_COPY     0
+#define MEM_OP_SET      1
+#define MEM_OP_STRLEN   2
+
+// Probe the CPU, enable SSE if present and choose the variants. Call
+// before interrupts are enabled
+void mem_init();
+uint32_t mem_cpu_features();
+// All variants, supported or not; `count` gets the table size
+const struct mem_impl *mem_impls(uint32_t *count);
+// Variants in use for each MEM_OP_*
+const struct mem_impl *mem_active(int op);
+// TSC cycles per call of one variant's `op` on `size` bytes, best of a few
+// runs. `dst` and `src` must hold `size` bytes; src is overwritten for
+// MEM_OP_STRLEN
+uint32_t mem_bench(const struct mem_impl *impl, int op, void *dst, void *src, uint32_t size);
+
+#endif
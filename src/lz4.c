@@ -0,0 +1,125 @@
+#include "lz4.h"
+#include <stddef.h>
+
+#define LZ4_HASH_BITS     10
+#define LZ4_MIN_MATCH     4
+#define LZ4_LAST_LITERALS 5     // The block must end in at least this many literals
+#define LZ4_MFLIMIT       12    // ... and no match may start closer to the end than this
+#define LZ4_MAX_OFFSET    65535
+
+// Position + 1 of the last 4-byte sequence with each hash, 0 if none
+static uint16_t lz4_table[1 << LZ4_HASH_BITS];
+
+static inline uint32_t lz4_read32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t lz4_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+// Length continuation bytes for the part of a length past the token's 15
+static uint8_t *lz4_put_len(uint8_t *op, uint8_t *oend, uint32_t n) {
+    for (;;) {
+        if (op >= oend) return NULL;
+        if (n < 255) break;
+        *op++ = 255;
+        n -= 255;
+    }
+    *op++ = n;
+    return op;
+}
+
+// One sequence: literals, then a match of `mlen` bytes at `off` back
+// (mlen 0 for the final, literal-only sequence)
+static uint8_t *lz4_emit(uint8_t *op, uint8_t *oend, const uint8_t *lit, uint32_t nlit,
+                         uint32_t off, uint32_t mlen) {
+    if (op >= oend) return NULL;
+    uint8_t *token = op++;
+    *token = (nlit < 15 ? nlit : 15) << 4;
+    if (nlit >= 15 && !(op = lz4_put_len(op, oend, nlit - 15))) return NULL;
+    if ((uint32_t)(oend - op) < nlit) return NULL;
+    for (uint32_t i = 0; i < nlit; i++) *op++ = lit[i];
+    if (!mlen) return op;
+
+    if (oend - op < 2) return NULL;
+    *op++ = off;
+    *op++ = off >> 8;
+    mlen -= LZ4_MIN_MATCH;
+    *token |= mlen < 15 ? mlen : 15;
+    if (mlen >= 15 && !(op = lz4_put_len(op, oend, mlen - 15))) return NULL;
+    return op;
+}
+
+// Greedy single-probe matcher: fast and good enough for text
+uint32_t lz4_compress(const uint8_t *src, uint32_t len, uint8_t *dst, uint32_t cap) {
+    const uint8_t *ip = src, *anchor = src, *end = src + len;
+    const uint8_t *mlimit = len > LZ4_MFLIMIT ? end - LZ4_MFLIMIT : src;
+    const uint8_t *matchend = end - LZ4_LAST_LITERALS;
+    uint8_t *op = dst, *oend = dst + cap;
+    if (len > LZ4_MAX_OFFSET) return 0;
+    for (uint32_t i = 0; i < (1 << LZ4_HASH_BITS); i++) lz4_table[i] = 0;
+
+    while (ip < mlimit) {
+        uint32_t v = lz4_read32(ip), h = lz4_hash(v);
+        const uint8_t *ref = lz4_table[h] ? src + lz4_table[h] - 1 : NULL;
+        lz4_table[h] = ip - src + 1;
+        if (!ref || lz4_read32(ref) != v) {
+            ip++;
+            continue;
+        }
+        const uint8_t *m = ip + LZ4_MIN_MATCH, *r = ref + LZ4_MIN_MATCH;
+        while (m < matchend && *m == *r) {
+            m++;
+            r++;
+        }
+        while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+            ip--;
+            ref--;
+        }
+        op = lz4_emit(op, oend, anchor, ip - anchor, ip - ref, m - ip);
+        if (!op) return 0;
+        ip = anchor = m;
+    }
+    op = lz4_emit(op, oend, anchor, end - anchor, 0, 0);
+    return op ? (uint32_t)(op - dst) : 0;
+}
+
+int lz4_decompress(const uint8_t *src, uint32_t len, uint8_t *dst, uint32_t cap) {
+    const uint8_t *ip = src, *iend = src + len;
+    uint8_t *op = dst, *oend = dst + cap;
+    while (ip < iend) {
+        uint32_t token = *ip++;
+        uint32_t n = token >> 4;
+        if (n == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                n += b;
+            } while (b == 255);
+        }
+        if ((uint32_t)(iend - ip) < n || (uint32_t)(oend - op) < n) return -1;
+        for (uint32_t i = 0; i < n; i++) *op++ = *ip++;
+        if (ip == iend) break;      // Final sequence has no match
+
+        if (iend - ip < 2) return -1;
+        uint32_t off = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (!off || off > (uint32_t)(op - dst)) return -1;
+        n = (token & 15) + LZ4_MIN_MATCH;
+        if ((token & 15) == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                n += b;
+            } while (b == 255);
+        }
+        if ((uint32_t)(oend - op) < n) return -1;
+        // Byte at a time: the match may overlap what it produces
+        const uint8_t *r = op - off;
+        while (n--) *op++ = *r++;
+    }
+    return op - dst;
+}
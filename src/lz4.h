@@ -0,0 +1,16 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stdint.h>
+
+// LZ4 block format (no frame header). Inputs are limited to 64 KiB so
+// match positions fit the 16-bit hash table
+
+// Compress `len` bytes of `src` into at most `cap` bytes of `dst`; returns
+// the compressed size, or 0 if it does not fit
+uint32_t lz4_compress(const uint8_t *src, uint32_t len, uint8_t *dst, uint32_t cap);
+// Decompress a block into at most `cap` bytes; returns the size produced,
+// or -1 if the block is malformed or too large
+int lz4_decompress(const uint8_t *src, uint32_t len, uint8_t *dst, uint32_t cap);
+
+#endif
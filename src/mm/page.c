@@ -0,0 +1,237 @@
+#include "page.h"
+#include <stddef.h>
+
+#define MULTIBOOT2_TAG_END      0
+#define MULTIBOOT2_TAG_MODULE   3
+#define MULTIBOOT2_TAG_MMAP     6
+#define MULTIBOOT2_MEMORY_AVAILABLE 1
+
+#define PAGE_LOW_LIMIT  0x100000    // Real-mode memory, BIOS data, VGA
+#define PAGE_NONE       0xFFFFFFFF  // End of a free list
+#define PAGE_MAX_RESERVED 16
+
+// Page flags
+#define PAGE_FREE       0x01        // Heads a free block of `order`
+#define PAGE_USED       0x02        // Heads an allocated block of `order`
+
+// One per page frame up to the top of RAM; only block heads carry state
+struct page {
+    uint32_t next;      // Free list links, as page frame numbers
+    uint32_t prev;
+    void *owner;        // Set by page_set_owner on every page of the block
+    uint8_t order;
+    uint8_t flags;
+    uint16_t reserved;
+};
+
+struct page_range {
+    uint32_t start;
+    uint32_t end;
+};
+
+extern char _kernel_start[], _kernel_end[];    // From linker.ld
+
+static struct page *page_array = NULL;
+static uint32_t page_count = 0;                 // Frames covered by page_array
+static uint32_t page_free_head[PAGE_MAX_ORDER + 1];
+static struct page_stats page_counters;
+static struct page_range page_reserved[PAGE_MAX_RESERVED];
+static uint32_t page_nreserved = 0;
+static uint32_t page_top = 0;                   // End of the highest usable range
+static uint32_t page_array_bytes = 0;
+static uint32_t page_array_at = 0;
+
+static void page_reserve(uint32_t start, uint32_t end) {
+    if (page_nreserved < PAGE_MAX_RESERVED && end > start) {
+        page_reserved[page_nreserved].start = start & ~(PAGE_SIZE - 1);
+        page_reserved[page_nreserved].end = end;
+        page_nreserved++;
+    }
+}
+
+static int page_is_reserved(uint32_t start, uint32_t end) {
+    for (uint32_t i = 0; i < page_nreserved; i++)
+        if (start < page_reserved[i].end && page_reserved[i].start < end) return 1;
+    return 0;
+}
+
+static void page_list_push(uint32_t pfn, uint32_t order) {
+    struct page *pg = &page_array[pfn];
+    pg->order = order;
+    pg->flags = PAGE_FREE;
+    pg->prev = PAGE_NONE;
+    pg->next = page_free_head[order];
+    if (pg->next != PAGE_NONE) page_array[pg->next].prev = pfn;
+    page_free_head[order] = pfn;
+    page_counters.free_blocks[order]++;
+}
+
+static void page_list_remove(uint32_t pfn) {
+    struct page *pg = &page_array[pfn];
+    if (pg->prev != PAGE_NONE) page_array[pg->prev].next = pg->next;
+    else page_free_head[pg->order] = pg->next;
+    if (pg->next != PAGE_NONE) page_array[pg->next].prev = pg->prev;
+    pg->flags = 0;
+    page_counters.free_blocks[pg->order]--;
+}
+
+// Free a block, merging it with its buddy for as long as that is free too
+static void page_free_block(uint32_t pfn, uint32_t order) {
+    page_counters.free_pages += 1u << order;
+    while (order < PAGE_MAX_ORDER) {
+        uint32_t buddy = pfn ^ (1u << order);
+        if (buddy >= page_count || page_array[buddy].flags != PAGE_FREE || page_array[buddy].order != order)
+            break;
+        page_list_remove(buddy);
+        pfn &= ~(1u << order);
+        order++;
+    }
+    page_list_push(pfn, order);
+}
+
+// Hand frames [start, end) to the free lists in the largest aligned blocks
+static void page_free_range(uint32_t start, uint32_t end) {
+    while (start < end) {
+        uint32_t order = 0;
+        while (order < PAGE_MAX_ORDER && !(start & (1u << order)) && start + (2u << order) <= end)
+            order++;
+        page_free_block(start, order);
+        start += 1u << order;
+    }
+}
+
+// Address ranges of the usable RAM in the memory map, clipped to 32 bits.
+// Calls `fn` per range; returns the number of ranges
+static uint32_t page_walk_mmap(uint32_t mb2_addr, void (*fn)(uint32_t start, uint32_t end)) {
+    uint32_t size = *(uint32_t *)mb2_addr;
+    uint32_t tag_addr = mb2_addr + 8, ranges = 0;
+    while (tag_addr < mb2_addr + size) {
+        uint32_t type = *(uint32_t *)tag_addr;
+        uint32_t tagsize = *(uint32_t *)(tag_addr + 4);
+        if (type == MULTIBOOT2_TAG_END) break;
+        if (type == MULTIBOOT2_TAG_MMAP) {
+            uint32_t entsize = *(uint32_t *)(tag_addr + 8);
+            for (uint32_t e = tag_addr + 16; entsize && e + entsize <= tag_addr + tagsize; e += entsize) {
+                uint64_t base = *(uint64_t *)e;
+                uint64_t len = *(uint64_t *)(e + 8);
+                uint32_t etype = *(uint32_t *)(e + 16);
+                if (etype != MULTIBOOT2_MEMORY_AVAILABLE || base >= 0x100000000ull) continue;
+                uint64_t end = base + len > 0x100000000ull ? 0x100000000ull : base + len;
+                // Whole pages only
+                uint32_t s = ((uint32_t)base + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+                uint32_t t = end == 0x100000000ull ? 0xFFFFF000 : (uint32_t)end & ~(PAGE_SIZE - 1);
+                if (s < PAGE_LOW_LIMIT) s = PAGE_LOW_LIMIT;
+                if (s >= t) continue;
+                if (fn) fn(s, t);
+                ranges++;
+            }
+        }
+        tag_addr += ((tagsize + 7) & ~7);
+    }
+    return ranges;
+}
+
+static void page_find_top(uint32_t start, uint32_t end) {
+    (void)start;
+    if (end > page_top) page_top = end;
+}
+
+// First place in usable RAM the page array fits without covering anything
+// reserved
+static void page_place_array(uint32_t start, uint32_t end) {
+    for (uint32_t at = start; !page_array_at && at + page_array_bytes <= end && at + page_array_bytes > at;
+         at += PAGE_SIZE) {
+        if (!page_is_reserved(at, at + page_array_bytes)) page_array_at = at;
+    }
+}
+
+static void page_add_range(uint32_t start, uint32_t end) {
+    uint32_t run = 0, in_run = 0;
+    for (uint32_t a = start; a < end; a += PAGE_SIZE) {
+        if (page_is_reserved(a, a + PAGE_SIZE)) {
+            page_counters.reserved_pages++;
+            if (in_run) page_free_range(run / PAGE_SIZE, a / PAGE_SIZE);
+            in_run = 0;
+        } else if (!in_run) {
+            run = a;
+            in_run = 1;
+        }
+    }
+    if (in_run) page_free_range(run / PAGE_SIZE, end / PAGE_SIZE);
+    page_counters.total_pages += (end - start) / PAGE_SIZE;
+}
+
+int page_init(uint32_t mb2_addr) {
+    for (uint32_t o = 0; o <= PAGE_MAX_ORDER; o++) page_free_head[o] = PAGE_NONE;
+    page_reserve((uint32_t)_kernel_start, (uint32_t)_kernel_end);
+    page_reserve(mb2_addr, mb2_addr + *(uint32_t *)mb2_addr);
+
+    // Boot modules stay where GRUB put them
+    uint32_t size = *(uint32_t *)mb2_addr;
+    for (uint32_t tag_addr = mb2_addr + 8; tag_addr < mb2_addr + size; ) {
+        uint32_t type = *(uint32_t *)tag_addr;
+        uint32_t tagsize = *(uint32_t *)(tag_addr + 4);
+        if (type == MULTIBOOT2_TAG_END) break;
+        if (type == MULTIBOOT2_TAG_MODULE)
+            page_reserve(*(uint32_t *)(tag_addr + 8), *(uint32_t *)(tag_addr + 12));
+        tag_addr += ((tagsize + 7) & ~7);
+    }
+
+    if (!page_walk_mmap(mb2_addr, page_find_top)) return -1;
+    page_count = page_top / PAGE_SIZE;
+    page_array_bytes = (page_count * sizeof(struct page) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    page_walk_mmap(mb2_addr, page_place_array);
+    if (!page_array_at) return -1;
+    page_reserve(page_array_at, page_array_at + page_array_bytes);
+    page_array = (struct page *)page_array_at;
+
+    uint32_t *w = (uint32_t *)page_array;
+    for (uint32_t i = 0; i < page_array_bytes / 4; i++) w[i] = 0;
+    page_walk_mmap(mb2_addr, page_add_range);
+    return 0;
+}
+
+void *page_alloc(uint32_t order) {
+    if (order > PAGE_MAX_ORDER) return NULL;
+    uint32_t o = order;
+    while (o <= PAGE_MAX_ORDER && page_free_head[o] == PAGE_NONE) o++;
+    if (o > PAGE_MAX_ORDER) return NULL;
+
+    uint32_t pfn = page_free_head[o];
+    page_list_remove(pfn);
+    // Split, keeping the lower half and freeing the upper one each time
+    while (o > order) {
+        o--;
+        page_list_push(pfn + (1u << o), o);
+    }
+    page_array[pfn].order = order;
+    page_array[pfn].flags = PAGE_USED;
+    page_counters.free_pages -= 1u << order;
+    return (void *)(pfn * PAGE_SIZE);
+}
+
+void page_free(void *p) {
+    uint32_t pfn = (uint32_t)p / PAGE_SIZE;
+    if (!p || (uint32_t)p % PAGE_SIZE || pfn >= page_count || page_array[pfn].flags != PAGE_USED) return;
+    for (uint32_t i = 0; i < (1u << page_array[pfn].order); i++) page_array[pfn + i].owner = NULL;
+    page_free_block(pfn, page_array[pfn].order);
+}
+
+void page_set_owner(void *p, void *owner) {
+    uint32_t pfn = (uint32_t)p / PAGE_SIZE;
+    if (pfn >= page_count || page_array[pfn].flags != PAGE_USED) return;
+    for (uint32_t i = 0; i < (1u << page_array[pfn].order); i++) page_array[pfn + i].owner = owner;
+}
+
+void *page_owner(const void *p) {
+    uint32_t pfn = (uint32_t)p / PAGE_SIZE;
+    return pfn < page_count ? page_array[pfn].owner : NULL;
+}
+
+void page_get_stats(struct page_stats *out) {
+    *out = page_counters;
+}
+
+uint32_t page_memory_top() {
+    return page_top;
+}
@@ -0,0 +1,32 @@
+#ifndef PAGE_H
+#define PAGE_H
+
+#include <stdint.h>
+
+#define PAGE_SIZE       4096
+#define PAGE_MAX_ORDER  10          // Largest block: 2^10 pages, 4 MiB
+
+struct page_stats {
+    uint32_t total_pages;           // RAM handed to the allocator
+    uint32_t free_pages;
+    uint32_t reserved_pages;        // Usable RAM kept back: kernel, boot info, modules, page array
+    uint32_t free_blocks[PAGE_MAX_ORDER + 1];
+};
+
+// Build the free lists from the Multiboot2 memory map; RAM above 4 GiB and
+// below 1 MiB is left alone. -1 if there is no memory map
+int page_init(uint32_t mb2_addr);
+// 2^order physically contiguous pages, aligned to their size; NULL if none
+void *page_alloc(uint32_t order);
+// Return a block from page_alloc; its order is remembered
+void page_free(void *p);
+// Tag every page of an allocated block, so any address inside it leads
+// back to `owner` (the slab allocator keeps its slab header there). Blocks
+// start out untagged; page_owner gives NULL for those
+void page_set_owner(void *p, void *owner);
+void *page_owner(const void *p);
+void page_get_stats(struct page_stats *out);
+// End of the highest RAM the allocator manages; device memory lies above
+uint32_t page_memory_top();
+
+#endif
@@ -0,0 +1,157 @@
+#include "paging.h"
+#include "page.h"
+#include "../cpu/cpu.h"
+
+// Page directory entry bits
+#define PDE_PRESENT     0x001
+#define PDE_WRITE       0x002
+#define PDE_PWT         0x008
+#define PDE_PCD         0x010
+#define PDE_LARGE       0x080       // PS: maps 4 MiB directly
+#define PDE_PAT_LARGE   0x1000      // PAT bit of a 4 MiB entry
+#define PDE_CACHE_MASK  (PDE_PWT | PDE_PCD | PDE_PAT_LARGE)
+
+// With PAT entry 1 reprogrammed to WC, the PAT/PCD/PWT index picks
+#define PDE_CACHE_WB    0                       // PAT 0: write-back
+#define PDE_CACHE_WC    PDE_PWT                 // PAT 1: write-combining
+#define PDE_CACHE_UC    (PDE_PCD | PDE_PWT)     // PAT 3: uncached
+
+#define CPUID1_EDX_PSE  (1u << 3)
+#define CPUID1_EDX_MTRR (1u << 12)
+#define CPUID1_EDX_PAT  (1u << 16)
+
+#define CR0_NW          (1u << 29)
+#define CR0_CD          (1u << 30)
+#define CR0_PG          (1u << 31)
+#define CR4_PSE         (1u << 4)
+
+#define MSR_MTRRCAP         0xFE
+#define MSR_MTRR_PHYSBASE0  0x200
+#define MSR_MTRR_PHYSMASK0  0x201
+#define MSR_MTRR_DEF_TYPE   0x2FF
+#define MSR_PAT             0x277
+#define MTRRCAP_WC          (1u << 10)
+#define MTRR_DEF_ENABLE     (1u << 11)
+#define MTRR_MASK_VALID     (1u << 11)
+#define MTRR_TYPE_WC        1
+
+#define PAT_TYPE_WC     0x01
+#define PAT_DEFAULT     0x0007040600070406ull   // WB, WT, UC-, UC, repeated
+
+static uint32_t paging_dir[1024] __attribute__((aligned(4096)));
+static int paging_on = 0;
+static uint32_t paging_features = 0;        // CPUID leaf 1 EDX
+
+static inline uint32_t read_cr0() {
+    uint32_t v;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr0(uint32_t v) {
+    __asm__ volatile ("mov %0, %%cr0" : : "r"(v) : "memory");
+}
+
+static inline uint32_t read_cr4() {
+    uint32_t v;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr4(uint32_t v) {
+    __asm__ volatile ("mov %0, %%cr4" : : "r"(v) : "memory");
+}
+
+static inline void flush_tlb() {
+    uint32_t v;
+    __asm__ volatile ("mov %%cr3, %0; mov %0, %%cr3" : "=r"(v) : : "memory");
+}
+
+static inline void invlpg(uint32_t addr) {
+    __asm__ volatile ("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+int paging_init() {
+    uint32_t a, b, c;
+    cpuid(1, &a, &b, &c, &paging_features);
+    if (!(paging_features & CPUID1_EDX_PSE)) return -1;
+
+    for (uint32_t i = 0; i < 1024; i++)
+        paging_dir[i] = (i * PAGING_LARGE_SIZE) | PDE_LARGE | PDE_WRITE | PDE_PRESENT;
+    // Entry 1 becomes write-combining; no mapping uses it yet
+    if (paging_features & CPUID1_EDX_PAT)
+        wrmsr(MSR_PAT, (PAT_DEFAULT & ~0xFF00ull) | ((uint64_t)PAT_TYPE_WC << 8));
+
+    write_cr4(read_cr4() | CR4_PSE);
+    __asm__ volatile ("mov %0, %%cr3" : : "r"(paging_dir) : "memory");
+    write_cr0(read_cr0() | CR0_PG);
+    paging_on = 1;
+    return 0;
+}
+
+int paging_enabled() {
+    return paging_on;
+}
+
+// Set the caching of every 4 MiB page the range touches; -1 if that would
+// take in RAM
+static int paging_set_cache(uint32_t phys, uint32_t size, uint32_t cache) {
+    if (!size || phys < page_memory_top()) return -1;
+    uint32_t last = (phys + size - 1) < phys ? 1023 : (phys + size - 1) / PAGING_LARGE_SIZE;
+    for (uint32_t i = phys / PAGING_LARGE_SIZE; i <= last; i++) {
+        paging_dir[i] = (paging_dir[i] & ~PDE_CACHE_MASK) | cache;
+        invlpg(i * PAGING_LARGE_SIZE);
+    }
+    return 0;
+}
+
+void *mmio_map(uint32_t phys, uint32_t size) {
+    if (paging_on) paging_set_cache(phys, size, PDE_CACHE_UC);
+    return (void *)phys;
+}
+
+// Program a free variable-range MTRR as write-combining, following the
+// SDM's update sequence: caches off and flushed, MTRRs off while changed
+static int paging_mtrr_wc(uint32_t phys, uint32_t size) {
+    if (!(paging_features & CPUID1_EDX_MTRR) || phys < page_memory_top()) return -1;
+    uint64_t cap = rdmsr(MSR_MTRRCAP);
+    if (!(cap & MTRRCAP_WC)) return -1;
+    uint32_t span = 4096;
+    while (span < size && span) span <<= 1;
+    if (!span || phys & (span - 1)) return -1;
+
+    uint32_t a, b, c, d, bits = 36;
+    cpuid(0x80000000, &a, &b, &c, &d);
+    if (a >= 0x80000008) {
+        cpuid(0x80000008, &a, &b, &c, &d);
+        bits = a & 0xFF;
+    }
+    uint64_t mask = (((1ull << bits) - 1) & ~((uint64_t)span - 1)) | MTRR_MASK_VALID;
+
+    uint32_t n = 0, count = cap & 0xFF;
+    while (n < count && (rdmsr(MSR_MTRR_PHYSMASK0 + 2 * n) & MTRR_MASK_VALID)) n++;
+    if (n == count) return -1;
+
+    uint32_t flags;
+    __asm__ volatile ("pushf; pop %0; cli" : "=r"(flags));
+    uint32_t cr0 = read_cr0();
+    write_cr0((cr0 | CR0_CD) & ~CR0_NW);
+    __asm__ volatile ("wbinvd" : : : "memory");
+    flush_tlb();
+    uint64_t def = rdmsr(MSR_MTRR_DEF_TYPE);
+    wrmsr(MSR_MTRR_DEF_TYPE, def & ~(uint64_t)MTRR_DEF_ENABLE);
+    wrmsr(MSR_MTRR_PHYSBASE0 + 2 * n, phys | MTRR_TYPE_WC);
+    wrmsr(MSR_MTRR_PHYSMASK0 + 2 * n, mask);
+    wrmsr(MSR_MTRR_DEF_TYPE, def);
+    __asm__ volatile ("wbinvd" : : : "memory");
+    flush_tlb();
+    write_cr0(cr0);
+    if (flags & 0x200) __asm__ volatile ("sti");
+    return 0;
+}
+
+int paging_map_wc(uint32_t phys, uint32_t size) {
+    if (paging_on && (paging_features & CPUID1_EDX_PAT))
+        return paging_set_cache(phys, size, PDE_CACHE_WC);
+    return paging_mtrr_wc(phys, size);
+}
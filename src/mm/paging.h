@@ -0,0 +1,23 @@
+#ifndef PAGING_H
+#define PAGING_H
+
+#include <stdint.h>
+
+#define PAGING_LARGE_SIZE   0x400000    // One page directory entry, 4 MiB
+
+// Identity-map the 4 GiB address space with 4 MiB pages and turn paging
+// on. RAM is write-back; devices keep what the firmware's MTRRs give them
+// until mapped below. -1 (paging stays off) without PSE
+int paging_init();
+int paging_enabled();
+
+// Map device registers uncached and return the address to use. Caching is
+// set per 4 MiB page, so neighbouring registers share it; ranges inside
+// RAM are left alone
+void *mmio_map(uint32_t phys, uint32_t size);
+// Make a range write-combining (a framebuffer): through PAT when paging
+// is on and the CPU has it, else with a variable MTRR, which needs `phys`
+// aligned to the size rounded up to a power of two. -1 if neither works
+int paging_map_wc(uint32_t phys, uint32_t size);
+
+#endif
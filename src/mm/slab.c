@@ -0,0 +1,168 @@
+#include "slab.h"
+#include "page.h"
+
+#define SLAB_DEFAULT_ALIGN  8
+#define SLAB_MIN_OBJECTS    8       // Grow the slab order until this many fit...
+#define SLAB_MAX_ORDER      3       // ... up to 32 KiB slabs
+#define SLAB_KEEP_EMPTY     1       // Empty slabs a cache holds on to
+#define KMALLOC_CACHES      9       // 8 .. 2048
+
+// Header at the start of every slab; objects follow it
+struct slab {
+    struct slab_cache *cache;
+    struct slab *next, *prev;       // Partial list
+    void *free;                     // First free object; each holds the next
+    uint32_t inuse;
+};
+
+static struct slab_cache kmalloc_caches[KMALLOC_CACHES];
+static struct slab_cache cache_cache;  // Where slab_cache_create gets caches from
+static struct slab_cache *cache_list = NULL, *cache_tail = NULL;
+static int slab_ready = 0;
+
+static void slab_cache_init(struct slab_cache *c, const char *name, uint32_t size, uint32_t align,
+                            void (*ctor)(void *obj)) {
+    uint8_t *b = (uint8_t *)c;
+    for (uint32_t i = 0; i < sizeof(*c); i++) b[i] = 0;
+    for (uint32_t i = 0; i < SLAB_NAME_LEN - 1 && name[i]; i++) c->name[i] = name[i];
+    if (!align) align = SLAB_DEFAULT_ALIGN;
+    if (size < sizeof(void *)) size = sizeof(void *);
+    // A free object holds the free-list link in its first word, unless a
+    // constructor set it up: then the link goes after the object
+    if (ctor) {
+        c->link = (size + sizeof(void *) - 1) / sizeof(void *) * sizeof(void *);
+        size = c->link + sizeof(void *);
+    }
+    c->size = (size + align - 1) / align * align;
+    c->head = (sizeof(struct slab) + align - 1) / align * align;
+    c->ctor = ctor;
+    // Smallest slab that holds a reasonable number of objects
+    while (c->order < SLAB_MAX_ORDER && (((uint32_t)PAGE_SIZE << c->order) - c->head) / c->size < SLAB_MIN_OBJECTS)
+        c->order++;
+    c->per_slab = (((uint32_t)PAGE_SIZE << c->order) - c->head) / c->size;
+
+    if (cache_tail) cache_tail->next = c;
+    else cache_list = c;
+    cache_tail = c;
+}
+
+static void slab_init() {
+    slab_ready = 1;
+    static const char *names[KMALLOC_CACHES] = {
+        "kmalloc-8", "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+        "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048",
+    };
+    for (uint32_t i = 0; i < KMALLOC_CACHES; i++)
+        slab_cache_init(&kmalloc_caches[i], names[i], KMALLOC_MIN << i, 0, NULL);
+    slab_cache_init(&cache_cache, "slab_cache", sizeof(struct slab_cache), 0, NULL);
+}
+
+static void slab_link(struct slab_cache *c, struct slab *s) {
+    s->prev = NULL;
+    s->next = c->partial;
+    if (c->partial) c->partial->prev = s;
+    c->partial = s;
+}
+
+static void slab_unlink(struct slab_cache *c, struct slab *s) {
+    if (s->prev) s->prev->next = s->next;
+    else c->partial = s->next;
+    if (s->next) s->next->prev = s->prev;
+    s->next = s->prev = NULL;
+}
+
+// A new slab with every object constructed and on its free list
+static struct slab *slab_grow(struct slab_cache *c) {
+    struct slab *s = page_alloc(c->order);
+    if (!s) return NULL;
+    page_set_owner(s, s);
+    s->cache = c;
+    s->inuse = 0;
+    s->free = NULL;
+    uint8_t *obj = (uint8_t *)s + c->head;
+    for (uint32_t i = c->per_slab; i-- > 0; ) {
+        uint8_t *o = obj + i * c->size;
+        if (c->ctor) c->ctor(o);
+        *(void **)(o + c->link) = s->free;
+        s->free = o;
+    }
+    slab_link(c, s);
+    c->slabs++;
+    c->empty++;
+    c->total += c->per_slab;
+    return s;
+}
+
+struct slab_cache *slab_cache_create(const char *name, uint32_t size, uint32_t align, void (*ctor)(void *obj)) {
+    if (!slab_ready) slab_init();
+    if (!size || size > ((uint32_t)PAGE_SIZE << SLAB_MAX_ORDER) / 2 || (align & (align - 1))) return NULL;
+    struct slab_cache *c = slab_alloc(&cache_cache);
+    if (c) slab_cache_init(c, name, size, align, ctor);
+    return c;
+}
+
+void *slab_alloc(struct slab_cache *c) {
+    if (!slab_ready) slab_init();
+    struct slab *s = c->partial;
+    if (!s && !(s = slab_grow(c))) return NULL;
+    uint8_t *obj = s->free;
+    s->free = *(void **)(obj + c->link);
+    if (!s->inuse++) c->empty--;
+    if (!s->free) slab_unlink(c, s);
+    c->active++;
+    c->allocs++;
+    return obj;
+}
+
+void slab_free(struct slab_cache *c, void *obj) {
+    struct slab *s = page_owner(obj);
+    if (!obj || !s || s->cache != c) return;
+    if (!s->free) slab_link(c, s);     // Was full
+    *(void **)((uint8_t *)obj + c->link) = s->free;
+    s->free = obj;
+    c->active--;
+    c->frees++;
+    if (--s->inuse) return;
+    // Keep a spare empty slab so a cache at the edge does not thrash
+    if (c->empty < SLAB_KEEP_EMPTY) {
+        c->empty++;
+        return;
+    }
+    slab_unlink(c, s);
+    c->slabs--;
+    c->total -= c->per_slab;
+    page_free(s);
+}
+
+const struct slab_cache *slab_cache_next(const struct slab_cache *c) {
+    if (!slab_ready) slab_init();
+    return c ? c->next : cache_list;
+}
+
+void *kmalloc(size_t size) {
+    if (!slab_ready) slab_init();
+    if (size > KMALLOC_MAX) {
+        uint32_t order = 0;
+        while (order <= PAGE_MAX_ORDER && ((uint32_t)PAGE_SIZE << order) < size) order++;
+        return order <= PAGE_MAX_ORDER ? page_alloc(order) : NULL;
+    }
+    uint32_t i = 0;
+    while ((uint32_t)KMALLOC_MIN << i < size) i++;
+    return slab_alloc(&kmalloc_caches[i]);
+}
+
+void *kzalloc(size_t size) {
+    uint32_t *p = kmalloc(size);
+    if (p)
+        for (uint32_t i = 0; i < (size + 3) / 4; i++) p[i] = 0;
+    return p;
+}
+
+// Slab objects lead back to their slab through the page array; anything
+// else from kmalloc is a whole block from the page allocator
+void kfree(void *p) {
+    if (!p) return;
+    struct slab *s = page_owner(p);
+    if (s) slab_free(s->cache, p);
+    else page_free(p);
+}
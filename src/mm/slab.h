@@ -0,0 +1,48 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SLAB_NAME_LEN   16
+#define KMALLOC_MIN     8
+#define KMALLOC_MAX     2048        // Bigger requests go straight to the page allocator
+
+// A cache hands out objects of one size from slabs: blocks of pages with
+// a header and a free list threaded through the free objects
+struct slab;
+struct slab_cache {
+    char name[SLAB_NAME_LEN];
+    uint32_t size;          // Object stride, rounded up to the alignment
+    uint32_t link;          // Offset of the free-list link in a free object
+    uint32_t head;          // Slab header size, rounded up to the alignment
+    uint32_t order;         // Each slab is 2^order pages
+    uint32_t per_slab;
+    void (*ctor)(void *obj);
+    struct slab *partial;   // Slabs with at least one free object
+    uint32_t empty;         // Slabs on the partial list with nothing in use
+    struct slab_cache *next;
+    // Accounting
+    uint32_t active;        // Objects handed out
+    uint32_t total;         // Objects in all slabs
+    uint32_t slabs;
+    uint32_t allocs;
+    uint32_t frees;
+};
+
+// Create a cache of `size`-byte objects aligned to `align` (0 for the
+// default of 8). `ctor`, if given, runs once per object when its slab is
+// created, not on every allocation: objects must be handed back to
+// slab_free in their constructed state
+struct slab_cache *slab_cache_create(const char *name, uint32_t size, uint32_t align, void (*ctor)(void *obj));
+void *slab_alloc(struct slab_cache *c);
+void slab_free(struct slab_cache *c, void *obj);
+// Walk every cache, the kmalloc ones first: NULL starts, NULL ends
+const struct slab_cache *slab_cache_next(const struct slab_cache *c);
+
+// General-purpose allocation from power-of-two caches of 8..2048 bytes
+void *kmalloc(size_t size);
+void *kzalloc(size_t size);
+void kfree(void *p);
+
+#endif
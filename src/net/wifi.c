@@ -1,4 +1,5 @@
 #include "wifi.h"
+#include "../mm/paging.h"
 
 // Platform-specific I/O port access
 extern uint32_t inl(uint16_t port);
@@ -20,7 +21,7 @@ int wifi_probe(struct wifi_device *dev) {
             uint16_t device = (vendor_dev >> 16) & 0xFFFF;
             if (vendor == WIFI_VENDOR_INTEL && device == WIFI_DEVICE_3945ABG) {
                 uint32_t bar0 = pci_config_read(bus, slot, 0, 0x10);
-                dev->mmio_base = bar0 & 0xFFFFFFF0;
+                dev->mmio_base = (uint32_t)mmio_map(bar0 & 0xFFFFFFF0, WIFI_MMIO_SIZE);
                 dev->bus = bus;
                 dev->slot = slot;
                 dev->func = 0;
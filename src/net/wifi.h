@@ -7,6 +7,7 @@
 // Intel 3945ABG PCI IDs
 #define WIFI_VENDOR_INTEL 0x8086
 #define WIFI_DEVICE_3945ABG 0x4222
+#define WIFI_MMIO_SIZE 0x1000       // BAR0 register window
 
 struct wifi_device {
     uint32_t mmio_base;
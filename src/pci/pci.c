@@ -0,0 +1,92 @@
+#include "pci.h"
+
+// Platform-specific I/O port access
+extern uint32_t inl(uint16_t port);
+extern void outl(uint16_t port, uint32_t value);
+
+static uint32_t pci_address(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
+    return ((uint32_t)bus << 16) | ((uint32_t)slot << 11) |
+           ((uint32_t)func << 8) | (offset & 0xfc) | 0x80000000;
+}
+
+uint32_t pci_config_read(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
+    outl(0xCF8, pci_address(bus, slot, func, offset));
+    return inl(0xCFC);
+}
+
+void pci_config_write(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint32_t value) {
+    outl(0xCF8, pci_address(bus, slot, func, offset));
+    outl(0xCFC, value);
+}
+
+// Walk every bus/slot/function (functions 1-7 only on multi-function
+// devices) and return the first one `match` accepts
+static int pci_scan(int (*match)(uint32_t id, uint32_t cls, uint32_t a, uint32_t b),
+                    uint32_t a, uint32_t b, struct pci_device *dev) {
+    for (int bus = 0; bus < 256; bus++) {
+        for (int slot = 0; slot < 32; slot++) {
+            int nfuncs = 1;
+            for (int func = 0; func < nfuncs; func++) {
+                uint32_t id = pci_config_read(bus, slot, func, PCI_VENDOR_ID);
+                if ((id & 0xFFFF) == 0xFFFF) continue;
+                if (func == 0 && (pci_config_read(bus, slot, 0, PCI_HEADER_TYPE) & 0x00800000))
+                    nfuncs = 8;
+                uint32_t cls = pci_config_read(bus, slot, func, PCI_CLASS);
+                if (match(id, cls, a, b)) {
+                    dev->bus = bus;
+                    dev->slot = slot;
+                    dev->func = func;
+                    dev->vendor = id & 0xFFFF;
+                    dev->device = id >> 16;
+                    dev->class_code = cls >> 24;
+                    dev->subclass = (cls >> 16) & 0xFF;
+                    dev->prog_if = (cls >> 8) & 0xFF;
+                    return 0;
+                }
+            }
+        }
+    }
+    return -1;
+}
+
+static int match_class(uint32_t id, uint32_t cls, uint32_t class_code, uint32_t subclass) {
+    (void)id;
+    return (cls >> 24) == class_code && ((cls >> 16) & 0xFF) == subclass;
+}
+
+static int match_id(uint32_t id, uint32_t cls, uint32_t vendor, uint32_t device) {
+    (void)cls;
+    return (id & 0xFFFF) == vendor && (id >> 16) == device;
+}
+
+int pci_find_class(uint8_t class_code, uint8_t subclass, struct pci_device *dev) {
+    return pci_scan(match_class, class_code, subclass, dev);
+}
+
+int pci_find_device(uint16_t vendor, uint16_t device, struct pci_device *dev) {
+    return pci_scan(match_id, vendor, device, dev);
+}
+
+uint8_t pci_next_capability(const struct pci_device *dev, uint8_t prev) {
+    uint8_t off;
+    if (!prev) {
+        // Status bit 4: capability list present
+        if (!(pci_config_read(dev->bus, dev->slot, dev->func, PCI_COMMAND) & 0x00100000))
+            return 0;
+        off = pci_config_read(dev->bus, dev->slot, dev->func, PCI_CAP_PTR) & 0xFF;
+    } else {
+        off = (pci_config_read(dev->bus, dev->slot, dev->func, prev) >> 8) & 0xFF;
+    }
+    return off & 0xFC;
+}
+
+uint32_t pci_read_bar(const struct pci_device *dev, int bar) {
+    return pci_config_read(dev->bus, dev->slot, dev->func, PCI_BAR0 + bar * 4);
+}
+
+void pci_enable_bus_master(const struct pci_device *dev) {
+    uint32_t cmd = pci_config_read(dev->bus, dev->slot, dev->func, PCI_COMMAND);
+    // Writing the status half back as zero leaves its RW1C bits alone
+    cmd = (cmd & 0xFFFF) | PCI_CMD_IO | PCI_CMD_MEMORY | PCI_CMD_BUS_MASTER;
+    pci_config_write(dev->bus, dev->slot, dev->func, PCI_COMMAND, cmd);
+}
@@ -0,0 +1,36 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+
+// Common config space offsets
+#define PCI_VENDOR_ID       0x00
+#define PCI_COMMAND         0x04
+#define PCI_CLASS           0x08
+#define PCI_HEADER_TYPE     0x0C
+#define PCI_BAR0            0x10
+#define PCI_CAP_PTR         0x34
+
+// Command register bits
+#define PCI_CMD_IO          0x0001
+#define PCI_CMD_MEMORY      0x0002
+#define PCI_CMD_BUS_MASTER  0x0004
+
+struct pci_device {
+    uint8_t bus, slot, func;
+    uint16_t vendor, device;
+    uint8_t class_code, subclass, prog_if;
+};
+
+uint32_t pci_config_read(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset);
+void pci_config_write(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint32_t value);
+
+// Find the first function matching class/subclass; returns 0 if found
+int pci_find_class(uint8_t class_code, uint8_t subclass, struct pci_device *dev);
+int pci_find_device(uint16_t vendor, uint16_t device, struct pci_device *dev);
+// Walk the capability list: pass 0 for the first entry; returns 0 at the end
+uint8_t pci_next_capability(const struct pci_device *dev, uint8_t prev);
+uint32_t pci_read_bar(const struct pci_device *dev, int bar);
+void pci_enable_bus_master(const struct pci_device *dev);
+
+#endif
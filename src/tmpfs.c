@@ -0,0 +1,144 @@
+#include "tmpfs.h"
+#include "fs.h"
+
+#define TMPFS_FILE_PAGES TMPFS_PAGES   // A file may take the whole pool
+
+extern void *memcpy(void *d, const void *s, size_t n);
+extern int strncmp(const char *a, const char *b, size_t n);
+extern size_t strlen(const char *s);
+
+struct tmpfs_file {
+    char name[FS_MAX_FILENAME];
+    uint32_t size;
+    uint8_t used;
+    uint16_t pages[TMPFS_FILE_PAGES];   // Pool index + 1, 0 for a hole (reads as zeros)
+};
+
+static struct tmpfs_file tmpfs_files[TMPFS_MAX_FILES];
+static uint8_t tmpfs_pool[TMPFS_PAGES][TMPFS_PAGE_SIZE] __attribute__((aligned(4096)));
+static uint16_t tmpfs_free[TMPFS_PAGES];    // Stack of free pool indices
+static uint32_t tmpfs_nfree = 0;
+static int tmpfs_ready = 0;
+
+static void tmpfs_init() {
+    for (uint32_t i = 0; i < TMPFS_PAGES; i++) tmpfs_free[i] = TMPFS_PAGES - 1 - i;
+    tmpfs_nfree = TMPFS_PAGES;
+    tmpfs_ready = 1;
+}
+
+static uint8_t *tmpfs_page(struct tmpfs_file *f, uint32_t pg, int alloc) {
+    if (!f->pages[pg]) {
+        if (!alloc || !tmpfs_nfree) return NULL;
+        uint16_t p = tmpfs_free[--tmpfs_nfree];
+        uint32_t *w = (uint32_t *)tmpfs_pool[p];
+        for (uint32_t i = 0; i < TMPFS_PAGE_SIZE / 4; i++) w[i] = 0;
+        f->pages[pg] = p + 1;
+    }
+    return tmpfs_pool[f->pages[pg] - 1];
+}
+
+static struct tmpfs_file *tmpfs_get(int idx) {
+    if (idx < 0 || idx >= TMPFS_MAX_FILES || !tmpfs_files[idx].used) return NULL;
+    return &tmpfs_files[idx];
+}
+
+int tmpfs_lookup(const char* name) {
+    for (int i = 0; i < TMPFS_MAX_FILES; i++)
+        if (tmpfs_files[i].used && !strncmp(tmpfs_files[i].name, name, FS_MAX_FILENAME))
+            return i;
+    return -1;
+}
+
+int tmpfs_create(const char* name) {
+    size_t len = strlen(name);
+    if (!len || len >= FS_MAX_FILENAME) return -1;
+    for (size_t i = 0; i < len; i++)
+        if (name[i] == '/') return -1;
+    int idx = tmpfs_lookup(name);
+    if (idx >= 0) return idx;
+    if (!tmpfs_ready) tmpfs_init();
+    for (int i = 0; i < TMPFS_MAX_FILES; i++) {
+        struct tmpfs_file *f = &tmpfs_files[i];
+        if (f->used) continue;
+        for (size_t j = 0; j < FS_MAX_FILENAME; j++) f->name[j] = j < len ? name[j] : 0;
+        f->size = 0;
+        f->used = 1;
+        return i;
+    }
+    return -1;
+}
+
+int tmpfs_truncate(int idx, uint32_t size) {
+    struct tmpfs_file *f = tmpfs_get(idx);
+    if (!f) return -1;
+    if (size > TMPFS_FILE_PAGES * TMPFS_PAGE_SIZE) return -1;
+    if (size < f->size) {
+        // Pages wholly past the end go back to the pool, the tail of the
+        // last one is cleared so a later extension reads zeros
+        uint32_t keep = (size + TMPFS_PAGE_SIZE - 1) / TMPFS_PAGE_SIZE;
+        for (uint32_t pg = keep; pg < TMPFS_FILE_PAGES; pg++) {
+            if (!f->pages[pg]) continue;
+            tmpfs_free[tmpfs_nfree++] = f->pages[pg] - 1;
+            f->pages[pg] = 0;
+        }
+        uint8_t *p = size % TMPFS_PAGE_SIZE ? tmpfs_page(f, size / TMPFS_PAGE_SIZE, 0) : NULL;
+        if (p)
+            for (uint32_t i = size % TMPFS_PAGE_SIZE; i < TMPFS_PAGE_SIZE; i++) p[i] = 0;
+    }
+    f->size = size;
+    return 0;
+}
+
+int tmpfs_delete(int idx) {
+    if (tmpfs_truncate(idx, 0) < 0) return -1;
+    tmpfs_files[idx].used = 0;
+    return 0;
+}
+
+int tmpfs_pread(int idx, uint32_t off, char* out, size_t len) {
+    struct tmpfs_file *f = tmpfs_get(idx);
+    if (!f) return -1;
+    if (off >= f->size) return 0;
+    if (len > f->size - off) len = f->size - off;
+    for (size_t done = 0; done < len; ) {
+        uint32_t in = (off + done) % TMPFS_PAGE_SIZE;
+        uint32_t n = TMPFS_PAGE_SIZE - in < len - done ? TMPFS_PAGE_SIZE - in : len - done;
+        uint8_t *p = tmpfs_page(f, (off + done) / TMPFS_PAGE_SIZE, 0);
+        if (p) {
+            memcpy(out + done, p + in, n);
+        } else {
+            for (uint32_t i = 0; i < n; i++) out[done + i] = 0;
+        }
+        done += n;
+    }
+    return len;
+}
+
+int tmpfs_pwrite(int idx, uint32_t off, const char* data, size_t len) {
+    struct tmpfs_file *f = tmpfs_get(idx);
+    if (!f) return -1;
+    uint32_t end = off + len;
+    if (end < off || end > TMPFS_FILE_PAGES * TMPFS_PAGE_SIZE) return -1;
+    for (size_t done = 0; done < len; ) {
+        uint32_t in = (off + done) % TMPFS_PAGE_SIZE;
+        uint32_t n = TMPFS_PAGE_SIZE - in < len - done ? TMPFS_PAGE_SIZE - in : len - done;
+        uint8_t *p = tmpfs_page(f, (off + done) / TMPFS_PAGE_SIZE, 1);
+        if (!p) {
+            // Out of pages: keep what fit
+            if (off + done > f->size) f->size = off + done;
+            return done ? (int)done : -1;
+        }
+        memcpy(p + in, data + done, n);
+        done += n;
+    }
+    if (end > f->size) f->size = end;
+    return len;
+}
+
+int tmpfs_stat(int idx, const char** name, uint32_t* size) {
+    struct tmpfs_file *f = tmpfs_get(idx);
+    if (!f) return -1;
+    *name = f->name;
+    *size = f->size;
+    return 0;
+}
@@ -0,0 +1,22 @@
+#ifndef TMPFS_H
+#define TMPFS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TMPFS_MAX_FILES 32
+#define TMPFS_PAGE_SIZE 4096
+#define TMPFS_PAGES     256     // Static pool: 1 MiB shared by all files
+
+// Flat in-memory filesystem: file data lives in pages from a static pool
+// and nothing is ever written to disk. Files are addressed by index
+int tmpfs_lookup(const char* name);
+int tmpfs_create(const char* name);     // Index of the new or existing file
+int tmpfs_delete(int idx);
+int tmpfs_truncate(int idx, uint32_t size);
+int tmpfs_pread(int idx, uint32_t off, char* out, size_t len);
+int tmpfs_pwrite(int idx, uint32_t off, const char* data, size_t len);
+// Name and size of file `idx`; -1 if the slot is unused
+int tmpfs_stat(int idx, const char** name, uint32_t* size);
+
+#endif
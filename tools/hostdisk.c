@@ -0,0 +1,117 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "hostdisk.h"
+#include "disk/diskio.h"
+
+#define SECTOR_SIZE     512
+#define FS_SUPER_LBA    4
+#define FS_FORMAT_LBAS  10      // Old tables, superblock and bitmap
+
+volatile uint32_t pit_ticks = 0;
+
+static int hostdisk_fd = -1;
+static int hostdisk_readonly = 0;
+static uint32_t hostdisk_sectors = 0;
+static struct hostdisk_stats hostdisk_counters;
+
+// Where the fs keeps its tables, from the superblock, so writes can be
+// split into metadata and data
+static struct {
+    uint32_t magic, version, cluster_sectors, clusters, free_clusters;
+    uint32_t bitmap_lba, extmap_lba, data_lba, inode_lba, inodes;
+} hostdisk_sb;
+
+static int hostdisk_is_meta(uint32_t lba) {
+    if (lba < FS_FORMAT_LBAS) return 1;
+    if (hostdisk_sb.inode_lba && lba >= hostdisk_sb.inode_lba && lba < hostdisk_sb.inode_lba + hostdisk_sb.inodes / 16)
+        return 1;
+    return hostdisk_sb.extmap_lba && lba >= hostdisk_sb.extmap_lba && lba < hostdisk_sb.extmap_lba + hostdisk_sb.inodes;
+}
+
+int hostdisk_open(const char *path, uint32_t sectors, int readonly) {
+    hostdisk_fd = open(path, readonly ? O_RDONLY : (sectors ? O_RDWR | O_CREAT : O_RDWR), 0644);
+    if (hostdisk_fd < 0) {
+        perror(path);
+        return -1;
+    }
+    hostdisk_readonly = readonly;
+    if (sectors) {
+        static const uint8_t zero[FS_FORMAT_LBAS * SECTOR_SIZE];
+        if (ftruncate(hostdisk_fd, (off_t)sectors * SECTOR_SIZE) < 0 ||
+            pwrite(hostdisk_fd, zero, sizeof(zero), 0) != (ssize_t)sizeof(zero)) {
+            perror(path);
+            return -1;
+        }
+    }
+    struct stat st;
+    fstat(hostdisk_fd, &st);
+    hostdisk_sectors = st.st_size / SECTOR_SIZE;
+    memset(&hostdisk_sb, 0, sizeof(hostdisk_sb));
+    if (pread(hostdisk_fd, &hostdisk_sb, sizeof(hostdisk_sb), FS_SUPER_LBA * SECTOR_SIZE) < 0)
+        memset(&hostdisk_sb, 0, sizeof(hostdisk_sb));
+    return 0;
+}
+
+void hostdisk_close() {
+    if (hostdisk_fd >= 0) close(hostdisk_fd);
+    hostdisk_fd = -1;
+}
+
+void hostdisk_get_stats(struct hostdisk_stats *out) {
+    *out = hostdisk_counters;
+}
+
+void hostdisk_reset_stats() {
+    memset(&hostdisk_counters, 0, sizeof(hostdisk_counters));
+}
+
+static int hostdisk_rwv(uint32_t lba, const struct disk_iovec *iov, uint32_t iovcnt, int write) {
+    if (write && hostdisk_readonly) return -1;
+    if (write) hostdisk_counters.writes++;
+    else       hostdisk_counters.reads++;
+    for (uint32_t i = 0; i < iovcnt; i++) {
+        uint32_t n = iov[i].sectors;
+        if (lba >= hostdisk_sectors || n > hostdisk_sectors - lba) return -1;
+        off_t off = (off_t)lba * SECTOR_SIZE;
+        ssize_t bytes = (ssize_t)n * SECTOR_SIZE;
+        if (write) {
+            if (pwrite(hostdisk_fd, iov[i].base, bytes, off) != bytes) return -1;
+            hostdisk_counters.sectors_written += n;
+            for (uint32_t s = 0; s < n; s++)
+                if (hostdisk_is_meta(lba + s)) hostdisk_counters.meta_written++;
+            if (lba <= FS_SUPER_LBA && lba + n > FS_SUPER_LBA)
+                memcpy(&hostdisk_sb, iov[i].base + (FS_SUPER_LBA - lba) * SECTOR_SIZE, sizeof(hostdisk_sb));
+        } else {
+            if (pread(hostdisk_fd, iov[i].base, bytes, off) != bytes) return -1;
+            hostdisk_counters.sectors_read += n;
+        }
+        lba += n;
+    }
+    return 0;
+}
+
+int disk_readv(uint32_t lba, const struct disk_iovec *iov, uint32_t iovcnt) {
+    return hostdisk_rwv(lba, iov, iovcnt, 0);
+}
+
+int disk_writev(uint32_t lba, const struct disk_iovec *iov, uint32_t iovcnt) {
+    return hostdisk_rwv(lba, iov, iovcnt, 1);
+}
+
+int disk_read(uint32_t lba, uint8_t *buf, uint32_t sectors) {
+    struct disk_iovec iov = { buf, sectors };
+    return hostdisk_rwv(lba, &iov, 1, 0);
+}
+
+int disk_write(uint32_t lba, const uint8_t *buf, uint32_t sectors) {
+    struct disk_iovec iov = { (uint8_t *)buf, sectors };
+    return hostdisk_rwv(lba, &iov, 1, 1);
+}
+
+uint32_t disk_capacity() {
+    return hostdisk_sectors;
+}
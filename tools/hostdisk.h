@@ -0,0 +1,24 @@
+#ifndef HOSTDISK_H
+#define HOSTDISK_H
+
+#include <stdint.h>
+
+// File-backed stand-in for the kernel's disk layer, so src/fs.c and the
+// block cache can run as a Linux program against a disk image
+
+struct hostdisk_stats {
+    uint64_t reads;             // Commands, as the block queue issued them
+    uint64_t writes;
+    uint64_t sectors_read;
+    uint64_t sectors_written;
+    uint64_t meta_written;      // Sectors written to the fs tables and extent maps
+};
+
+// Open `path`; with `sectors` non-zero the image is created or resized to
+// that many sectors and its first 10 cleared, so fs_init formats it
+int hostdisk_open(const char *path, uint32_t sectors, int readonly);
+void hostdisk_close();
+void hostdisk_get_stats(struct hostdisk_stats *out);
+void hostdisk_reset_stats();
+
+#endif
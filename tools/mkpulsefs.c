@@ -0,0 +1,120 @@
+// mkpulsefs: build a PulseOS disk image on the host
+//
+//   mkpulsefs [-s size] [-z] image [hostfile[=path]]...
+//
+// Formats `image` (created, or resized to -s bytes; K/M suffixes) and
+// copies each host file in, by default under its base name in the root.
+// Directories in `path` are created as needed; -z stores the files
+// LZ4-compressed
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hostdisk.h"
+#include "fs.h"
+
+#define MKPULSEFS_DEFAULT_SIZE  (16u << 20)
+#define MKPULSEFS_CHUNK         65536
+
+static void usage() {
+    fprintf(stderr, "usage: mkpulsefs [-s size] [-z] image [hostfile[=path]]...\n");
+    exit(2);
+}
+
+static uint32_t parse_size(const char *s) {
+    char *end;
+    unsigned long n = strtoul(s, &end, 0);
+    if (*end == 'K' || *end == 'k') n <<= 10;
+    else if (*end == 'M' || *end == 'm') n <<= 20;
+    else if (*end) usage();
+    return n;
+}
+
+// mkdir -p for every directory above the leaf of `path`; ones that exist
+// already just fail, and a real failure shows up when the file is created
+static void make_parents(char *path) {
+    for (char *p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+        *p = 0;
+        fs_mkdir(path);
+        *p = '/';
+    }
+}
+
+static int copy_in(const char *spec, int compress) {
+    static char buf[MKPULSEFS_CHUNK];
+    char host[4096], path[256];
+    const char *eq = strchr(spec, '=');
+    if (eq) {
+        snprintf(host, sizeof(host), "%.*s", (int)(eq - spec), spec);
+        snprintf(path, sizeof(path), "%s", eq + 1);
+    } else {
+        const char *base = strrchr(spec, '/');
+        snprintf(host, sizeof(host), "%s", spec);
+        snprintf(path, sizeof(path), "%s", base ? base + 1 : spec);
+    }
+    if (!strncmp(path + (path[0] == '/'), "tmp", 3) && (!path[3 + (path[0] == '/')] || path[3 + (path[0] == '/')] == '/')) {
+        fprintf(stderr, "mkpulsefs: %s: /tmp is not stored on disk\n", path);
+        return -1;
+    }
+    const char *leaf = strrchr(path, '/');
+    if (strlen(leaf ? leaf + 1 : path) >= FS_MAX_FILENAME) {
+        fprintf(stderr, "mkpulsefs: %s: name longer than %d characters\n", path, FS_MAX_FILENAME - 1);
+        return -1;
+    }
+
+    FILE *in = fopen(host, "rb");
+    if (!in) {
+        perror(host);
+        return -1;
+    }
+    int fd = -1;
+    make_parents(path);
+    if (fs_create(path, NULL) == 0) {
+        if (compress) fs_compress(path, NULL, 1);
+        fd = fs_open(path, NULL, FS_O_TRUNC);
+    }
+    if (fd < 0) {
+        fprintf(stderr, "mkpulsefs: cannot create %s\n", path);
+        fclose(in);
+        return -1;
+    }
+    size_t n, total = 0;
+    int rc = 0;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (fs_write_stream(fd, buf, n) != (int)n) {
+            fprintf(stderr, "mkpulsefs: %s: out of space after %zu bytes\n", path, total);
+            rc = -1;
+            break;
+        }
+        total += n;
+    }
+    fs_close(fd);
+    fclose(in);
+    if (rc == 0) printf("%-32s %8zu bytes\n", path, total);
+    return rc;
+}
+
+int main(int argc, char **argv) {
+    uint32_t size = MKPULSEFS_DEFAULT_SIZE;
+    int compress = 0, i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-s") && i + 1 < argc) size = parse_size(argv[++i]);
+        else if (!strcmp(argv[i], "-z")) compress = 1;
+        else usage();
+    }
+    if (i >= argc || size < (1u << 20)) usage();
+
+    if (hostdisk_open(argv[i], size / 512, 0) < 0) return 1;
+    if (fs_init() < 0) {
+        fprintf(stderr, "mkpulsefs: format failed\n");
+        return 1;
+    }
+    int rc = 0;
+    for (i++; i < argc; i++)
+        if (copy_in(argv[i], compress) < 0) rc = 1;
+    if (fs_sync() < 0) {
+        fprintf(stderr, "mkpulsefs: write failed\n");
+        rc = 1;
+    }
+    hostdisk_close();
+    return rc;
+}
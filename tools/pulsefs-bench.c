@@ -0,0 +1,155 @@
+// pulsefs-bench: time the filesystem's main operations on a disk image
+//
+//   pulsefs-bench [-n files] [-s bytes] [-z] image
+//
+// Formats `image` and runs each phase over `files` files in /bench: create,
+// write `bytes` each, read them back from a cold cache, append to each,
+// list the directory and delete. Every phase ends with fs_sync so its
+// writeback is counted. Reports operations per second, sectors moved per
+// operation and write amplification: sectors written over the payload, and
+// how much of that was metadata (superblock, bitmap, inode table, extent
+// maps; directory blocks count as data)
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hostdisk.h"
+#include "disk/bcache.h"
+#include "fs.h"
+
+#define BENCH_DIR       "bench"
+#define BENCH_APPEND    100         // Bytes added by the append phase
+
+static uint32_t bench_files = 256;
+static uint32_t bench_size = 4096;
+static int bench_lz4 = 0;
+static char *bench_buf;
+
+struct bench_phase {
+    const char *name;
+    int (*run)(uint32_t i);
+    uint32_t payload;               // Bytes of file data written per op
+};
+
+static void bench_name(char *out, uint32_t i) {
+    snprintf(out, 32, "/" BENCH_DIR "/f%05u", i);
+}
+
+static int bench_create(uint32_t i) {
+    char name[32];
+    bench_name(name, i);
+    if (fs_create(name, NULL) < 0) return -1;
+    return bench_lz4 ? fs_compress(name, NULL, 1) : 0;
+}
+
+static int bench_write(uint32_t i) {
+    char name[32];
+    bench_name(name, i);
+    return fs_write(name, NULL, bench_buf, bench_size);
+}
+
+static int bench_read(uint32_t i) {
+    char name[32];
+    bench_name(name, i);
+    return fs_read(name, NULL, bench_buf, bench_size) == (int)bench_size ? 0 : -1;
+}
+
+static int bench_append(uint32_t i) {
+    char name[32];
+    bench_name(name, i);
+    return fs_append(name, NULL, bench_buf, BENCH_APPEND);
+}
+
+// Lists the whole directory once; the op count is the entries seen
+static uint32_t bench_listed;
+static int bench_list(uint32_t i) {
+    if (i) return 0;
+    int dd = fs_opendir("/" BENCH_DIR);
+    if (dd < 0) return -1;
+    while (fs_readdir(dd)) bench_listed++;
+    fs_closedir(dd);
+    return bench_listed == bench_files ? 0 : -1;
+}
+
+static int bench_delete(uint32_t i) {
+    char name[32];
+    bench_name(name, i);
+    return fs_delete(name, NULL);
+}
+
+static double bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage() {
+    fprintf(stderr, "usage: pulsefs-bench [-n files] [-s bytes] [-z] image\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) bench_files = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-s") && i + 1 < argc) bench_size = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "-z")) bench_lz4 = 1;
+        else usage();
+    }
+    if (i + 1 != argc || !bench_files || bench_files >= FS_MAX_FILES - 1) usage();
+
+    // Room for the data twice over plus the tables
+    uint64_t bytes = (uint64_t)bench_files * ((bench_size + BENCH_APPEND) / 4096 + 1) * 4096 * 2 + (8u << 20);
+    if (bytes > (96ull << 20)) bytes = 96ull << 20;
+    if (hostdisk_open(argv[i], bytes / 512, 0) < 0) return 1;
+    if (fs_init() < 0 || fs_mkdir("/" BENCH_DIR) < 0 || fs_sync() < 0) {
+        fprintf(stderr, "pulsefs-bench: format failed\n");
+        return 1;
+    }
+    // Text-like contents, so -z has something to squeeze
+    bench_buf = malloc(bench_size + 1);
+    for (uint32_t b = 0; b < bench_size; b++) bench_buf[b] = "lorem ipsum dolor sit amet, \n"[b % 29] + (b / 977) % 3;
+
+    struct bench_phase phases[] = {
+        { "create", bench_create, 0 },
+        { "write",  bench_write,  bench_size },
+        { "read",   bench_read,   0 },
+        { "append", bench_append, BENCH_APPEND },
+        { "list",   bench_list,   0 },
+        { "delete", bench_delete, 0 },
+    };
+    printf("%u files of %u bytes%s\n", bench_files, bench_size, bench_lz4 ? ", LZ4" : "");
+    printf("%-8s %10s %9s %9s %9s %9s %8s\n", "phase", "ops/s", "rd sec/op", "wr sec/op", "meta/op", "cmds/op", "wr amp");
+    for (uint32_t p = 0; p < sizeof(phases) / sizeof(phases[0]); p++) {
+        struct bench_phase *ph = &phases[p];
+        if (ph->run == bench_read) {
+            // Cold cache: drop every cached sector first
+            bcache_set_budget(1);
+            bcache_set_budget(BCACHE_DEFAULT_BUDGET);
+        }
+        hostdisk_reset_stats();
+        bench_listed = 0;
+        double t0 = bench_now();
+        for (uint32_t f = 0; f < bench_files; f++) {
+            if (ph->run(f) < 0) {
+                fprintf(stderr, "pulsefs-bench: %s failed on file %u\n", ph->name, f);
+                return 1;
+            }
+        }
+        fs_sync();
+        double t = bench_now() - t0;
+
+        struct hostdisk_stats st;
+        hostdisk_get_stats(&st);
+        double ops = ph->run == bench_list ? bench_listed : bench_files;
+        char amp[16] = "-";
+        if (ph->payload)
+            snprintf(amp, sizeof(amp), "%.2f", st.sectors_written * 512.0 / ((double)ph->payload * bench_files));
+        printf("%-8s %10.0f %9.2f %9.2f %9.2f %9.2f %8s\n", ph->name, t > 0 ? ops / t : 0,
+               st.sectors_read / ops, st.sectors_written / ops, st.meta_written / ops,
+               (st.reads + st.writes) / ops, amp);
+    }
+    hostdisk_close();
+    return 0;
+}
@@ -0,0 +1,322 @@
+// pulsefsck: check a PulseOS disk image without modifying it
+//
+//   pulsefsck image
+//
+// Built around the kernel's own fs.c so it reads the image exactly as the
+// kernel would. Checks the superblock, that every cluster is owned by at
+// most one inode and the bitmap agrees, each inode's extent map against
+// its size and flags, and every directory B-tree: node bounds and key
+// order, the leaf chain, and that each used inode is named exactly once.
+// Exits 0 if clean, 1 if errors were found, 2 if the image is unusable
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "hostdisk.h"
+#include "../src/fs.c"
+
+#define FSCK_OWNER_FREE     0xFFFF
+#define FSCK_OWNER_TABLES   0xFFFE      // Inode table and extent map area
+
+static int fsck_errors = 0;
+static int fsck_warnings = 0;
+static uint16_t fsck_owner[FS_CLUSTERS];
+static uint8_t fsck_refs[FS_MAX_FILES];
+static uint8_t fsck_visited[FS_MAX_FILES];     // Directories already walked
+
+static void fsck_error(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    printf("error: ");
+    vprintf(fmt, ap);
+    printf("\n");
+    va_end(ap);
+    fsck_errors++;
+}
+
+static void fsck_warn(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    printf("warning: ");
+    vprintf(fmt, ap);
+    printf("\n");
+    va_end(ap);
+    fsck_warnings++;
+}
+
+static int fsck_super() {
+    struct fs_super *sb = &superblock.sb;
+    uint32_t cap = disk_capacity();
+    int ok = 1;
+    if (sb->cluster_sectors != FS_CLUSTER_SECTORS) {
+        fsck_error("superblock: cluster size %u sectors, expected %u", sb->cluster_sectors, FS_CLUSTER_SECTORS);
+        ok = 0;
+    }
+    if (sb->bitmap_lba != FS_BITMAP_LBA || sb->data_lba != FS_DISK_FILEDATA_START) {
+        fsck_error("superblock: bitmap at %u, data at %u", sb->bitmap_lba, sb->data_lba);
+        ok = 0;
+    }
+    if (!sb->clusters || sb->clusters > FS_CLUSTERS) {
+        fsck_error("superblock: %u clusters, at most %u fit the bitmap", sb->clusters, FS_CLUSTERS);
+        ok = 0;
+    } else if (sb->data_lba + (uint64_t)sb->clusters * FS_CLUSTER_SECTORS > cap) {
+        fsck_error("superblock: %u clusters run past the end of the image (%u sectors)", sb->clusters, cap);
+        ok = 0;
+    }
+    if (!sb->inodes || sb->inodes > FS_MAX_FILES || sb->inodes % FS_INODES_PER_SECTOR) {
+        fsck_error("superblock: %u inodes, expected whole sectors of them up to %u", sb->inodes, FS_MAX_FILES);
+        ok = 0;
+    }
+    if (!ok) return -1;
+    uint32_t end = sb->data_lba + sb->clusters * FS_CLUSTER_SECTORS;
+    if (sb->inode_lba < sb->data_lba || sb->inode_lba + fs_inode_sectors() > end ||
+        (sb->inode_lba - sb->data_lba) % FS_CLUSTER_SECTORS) {
+        fsck_error("superblock: inode table at bad LBA %u", sb->inode_lba);
+        return -1;
+    }
+    if (sb->extmap_lba < sb->data_lba || sb->extmap_lba + sb->inodes > end ||
+        (sb->extmap_lba - sb->data_lba) % FS_CLUSTER_SECTORS) {
+        fsck_error("superblock: extent map area at bad LBA %u", sb->extmap_lba);
+        return -1;
+    }
+    return 0;
+}
+
+// Claim clusters [start, start + count) for `owner`
+static void fsck_claim(uint32_t start, uint32_t count, uint16_t owner, const char *what) {
+    if (start >= superblock.sb.clusters || count > superblock.sb.clusters - start) {
+        fsck_error("%s: extent %u+%u outside the %u data clusters", what, start, count, superblock.sb.clusters);
+        return;
+    }
+    for (uint32_t c = start; c < start + count; c++) {
+        if (fsck_owner[c] == FSCK_OWNER_FREE) {
+            fsck_owner[c] = owner;
+        } else if (fsck_owner[c] == FSCK_OWNER_TABLES) {
+            fsck_error("%s: cluster %u is part of the fs tables", what, c);
+        } else {
+            fsck_error("%s: cluster %u also belongs to inode %u", what, c, fsck_owner[c]);
+        }
+    }
+}
+
+static void fsck_inode(int ino) {
+    struct fs_disk_entry *f = &filetable[ino];
+    char what[48];
+    snprintf(what, sizeof(what), "inode %d (%.*s)", ino, FS_MAX_FILENAME, f->name);
+    if (f->type != FS_TYPE_FILE && f->type != FS_TYPE_DIR) {
+        fsck_error("%s: bad type %u", what, f->type);
+        return;
+    }
+    if (f->name[FS_MAX_FILENAME - 1] || (!f->name[0] && ino != FS_ROOT_INO))
+        fsck_error("%s: bad name", what);
+    if (f->parent >= superblock.sb.inodes || !filetable[f->parent].used || filetable[f->parent].type != FS_TYPE_DIR)
+        fsck_error("%s: parent %u is not a directory", what, f->parent);
+    if (f->block != superblock.sb.extmap_lba + ino)
+        fsck_error("%s: extent map at LBA %u, expected %u", what, f->block, superblock.sb.extmap_lba + ino);
+    if (f->flags & ~(FS_FILE_INLINE | FS_FILE_LZ4))
+        fsck_error("%s: unknown flags 0x%x", what, f->flags);
+    if (f->type == FS_TYPE_DIR && f->flags)
+        fsck_error("%s: directory with file flags 0x%x", what, f->flags);
+
+    struct fs_extmap *m = fs_extmap_get(ino, 0);
+    if (f->flags & FS_FILE_INLINE) {
+        if (f->size > FS_INLINE_MAX) fsck_error("%s: inline file of %u bytes", what, f->size);
+        if (m->count) fsck_error("%s: inline file with %u extents", what, m->count);
+        return;
+    }
+    int z = f->flags & FS_FILE_LZ4;
+    uint32_t max = z ? FS_Z_EXTENTS : FS_MAX_EXTENTS;
+    if (m->count > max) {
+        fsck_error("%s: %u extents, at most %u fit", what, m->count, max);
+        return;
+    }
+    uint32_t have = 0;
+    for (uint32_t i = 0; i < m->count; i++) {
+        if (!m->ext[i].count) fsck_error("%s: empty extent %u", what, i);
+        fsck_claim(m->ext[i].start, m->ext[i].count, ino, what);
+        have += m->ext[i].count;
+    }
+    uint32_t need = (f->size + FS_CLUSTER_SIZE - 1) / FS_CLUSTER_SIZE;
+    if (have < need)
+        fsck_error("%s: %u bytes but only %u clusters", what, f->size, have);
+    else if (have > need)
+        fsck_warn("%s: %u clusters past the end of its %u bytes", what, have - need, f->size);
+    if (f->type == FS_TYPE_DIR && (!f->size || f->size % FS_DNODE_SIZE))
+        fsck_error("%s: directory size %u is not whole blocks", what, f->size);
+    if (z) {
+        if (have > FS_Z_CLUSTERS) fsck_error("%s: compressed file of %u clusters", what, have);
+        for (uint32_t c = 0; c < FS_Z_CLUSTERS; c++) {
+            if (m->zsectors[c] > FS_CLUSTER_SECTORS || (c >= have && m->zsectors[c]))
+                fsck_error("%s: cluster %u has bad compressed size %u", what, c, m->zsectors[c]);
+        }
+    }
+}
+
+// Check one B-tree node and what lies below it; keys must lie in
+// [lo, hi). Leaves are appended to `leaves` in key order
+static void fsck_node(int dir, uint32_t blk, int depth, uint32_t lo_h, uint16_t lo_i,
+                      int has_hi, uint32_t hi_h, uint16_t hi_i,
+                      uint32_t *leaves, uint32_t *nleaves, uint8_t *seen) {
+    struct fs_disk_entry *d = &filetable[dir];
+    uint32_t blocks = d->size / FS_DNODE_SIZE;
+    if (blk >= blocks) {
+        fsck_error("dir %d (%s): block %u past its %u blocks", dir, d->name, blk, blocks);
+        return;
+    }
+    if (seen[blk]) {
+        fsck_error("dir %d (%s): block %u reached twice", dir, d->name, blk);
+        return;
+    }
+    seen[blk] = 1;
+    if (depth >= FS_BTREE_DEPTH) {
+        fsck_error("dir %d (%s): tree deeper than %d", dir, d->name, FS_BTREE_DEPTH);
+        return;
+    }
+    struct fs_dnode n;
+    if (fs_dnode_read(dir, blk, &n) < 0) {
+        fsck_error("dir %d (%s): cannot read block %u", dir, d->name, blk);
+        return;
+    }
+    uint32_t max = n.leaf ? FS_DLEAF_MAX : FS_DINNER_MAX;
+    if (n.count > max || (!n.leaf && !n.count)) {
+        fsck_error("dir %d (%s): block %u holds %u keys", dir, d->name, blk, n.count);
+        return;
+    }
+    for (uint32_t i = 0; i < n.count; i++) {
+        uint32_t h = fs_node_key_hash(&n, i);
+        uint16_t k = fs_node_key_ino(&n, i);
+        int bad = fs_key_cmp(h, k, lo_h, lo_i) < 0 || (has_hi && fs_key_cmp(h, k, hi_h, hi_i) >= 0);
+        if (i && fs_key_cmp(h, k, fs_node_key_hash(&n, i - 1), fs_node_key_ino(&n, i - 1)) <= 0) bad = 1;
+        if (bad) fsck_error("dir %d (%s): block %u key %u out of order", dir, d->name, blk, i);
+    }
+    if (!n.leaf) {
+        for (uint32_t i = 0; i < n.count; i++) {
+            int last = i + 1 == n.count;
+            fsck_node(dir, n.u.keys[i].child, depth + 1, n.u.keys[i].hash, n.u.keys[i].ino,
+                      last ? has_hi : 1, last ? hi_h : n.u.keys[i + 1].hash, last ? hi_i : n.u.keys[i + 1].ino,
+                      leaves, nleaves, seen);
+        }
+        return;
+    }
+
+    leaves[(*nleaves)++] = blk;
+    for (uint32_t i = 0; i < n.count; i++) {
+        struct fs_dirent *e = &n.u.ents[i];
+        char name[FS_MAX_FILENAME + 1];
+        memcpy(name, e->name, FS_MAX_FILENAME);
+        name[FS_MAX_FILENAME] = 0;
+        if (e->ino >= superblock.sb.inodes || e->ino == FS_ROOT_INO || !filetable[e->ino].used) {
+            fsck_error("dir %d (%s): entry %s names unused inode %u", dir, d->name, name, e->ino);
+            continue;
+        }
+        struct fs_disk_entry *f = &filetable[e->ino];
+        if (e->hash != fs_hash(name, strlen(name)))
+            fsck_error("dir %d (%s): entry %s has the wrong hash", dir, d->name, name);
+        if (strncmp(f->name, e->name, FS_MAX_FILENAME) || e->type != f->type || f->parent != dir)
+            fsck_error("dir %d (%s): entry %s does not match inode %u", dir, d->name, name, e->ino);
+        if (fsck_refs[e->ino]++)
+            fsck_error("dir %d (%s): inode %u is named more than once", dir, d->name, e->ino);
+    }
+}
+
+static void fsck_dir(int dir) {
+    static uint32_t leaves[FS_MAX_FILES + FS_BTREE_DEPTH];
+    uint32_t blocks = filetable[dir].size / FS_DNODE_SIZE;
+    uint8_t *seen = calloc(blocks ? blocks : 1, 1);
+    uint32_t nleaves = 0;
+    fsck_visited[dir] = 1;
+    if (blocks > FS_MAX_FILES + FS_BTREE_DEPTH) {
+        // More blocks than the entries could ever need
+        fsck_error("dir %d (%s): %u blocks", dir, filetable[dir].name, blocks);
+    } else {
+        fsck_node(dir, 0, 0, 0, 0, 0, 0, 0, leaves, &nleaves, seen);
+        // The leaf chain must visit the leaves in key order
+        for (uint32_t i = 0; i < nleaves; i++) {
+            struct fs_dnode n;
+            uint32_t next = i + 1 < nleaves ? leaves[i + 1] : 0;
+            if (fs_dnode_read(dir, leaves[i], &n) == 0 && n.next != next)
+                fsck_error("dir %d (%s): leaf %u links to %u, expected %u", dir, filetable[dir].name,
+                           leaves[i], n.next, next);
+        }
+        for (uint32_t b = 0; b < blocks; b++)
+            if (!seen[b]) fsck_warn("dir %d (%s): block %u is unreachable", dir, filetable[dir].name, b);
+    }
+    free(seen);
+
+    for (int i = 0; i < (int)superblock.sb.inodes; i++) {
+        if (filetable[i].used && filetable[i].type == FS_TYPE_DIR && filetable[i].parent == dir &&
+            i != FS_ROOT_INO && fsck_refs[i] && !fsck_visited[i])
+            fsck_dir(i);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: pulsefsck image\n");
+        return 2;
+    }
+    if (hostdisk_open(argv[1], 0, 1) < 0) return 2;
+    bcache_read(FS_SUPER_LBA, superblock.raw, 1);
+    if (superblock.sb.magic != FS_MAGIC) {
+        printf("%s: not a PulseOS filesystem (version 0 or blank)\n", argv[1]);
+        return 2;
+    }
+    if (superblock.sb.version != FS_VERSION) {
+        printf("%s: format version %u, this tool checks version %u\n", argv[1], superblock.sb.version, FS_VERSION);
+        return 2;
+    }
+    if (fsck_super() < 0 || fs_disk_load_table() < 0) return 2;
+
+    struct fs_super *sb = &superblock.sb;
+    for (uint32_t c = 0; c < FS_CLUSTERS; c++) fsck_owner[c] = FSCK_OWNER_FREE;
+    uint32_t tc = (fs_inode_sectors() + FS_CLUSTER_SECTORS - 1) / FS_CLUSTER_SECTORS;
+    fsck_claim((sb->inode_lba - sb->data_lba) / FS_CLUSTER_SECTORS, tc, FSCK_OWNER_TABLES, "inode table");
+    tc = (sb->inodes + FS_CLUSTER_SECTORS - 1) / FS_CLUSTER_SECTORS;
+    fsck_claim((sb->extmap_lba - sb->data_lba) / FS_CLUSTER_SECTORS, tc, FSCK_OWNER_TABLES, "extent map area");
+
+    struct fs_disk_entry *root = &filetable[FS_ROOT_INO];
+    if (!root->used || root->type != FS_TYPE_DIR || root->parent != FS_ROOT_INO) {
+        fsck_error("root inode is not a directory");
+        return 1;
+    }
+    uint32_t files = 0, dirs = 0, inline_files = 0, lz4_files = 0;
+    for (int i = 0; i < (int)sb->inodes; i++) {
+        if (!filetable[i].used) continue;
+        fsck_inode(i);
+        if (filetable[i].type == FS_TYPE_DIR) dirs++;
+        else files++;
+        if (filetable[i].flags & FS_FILE_INLINE) inline_files++;
+        if (filetable[i].flags & FS_FILE_LZ4) lz4_files++;
+    }
+
+    uint32_t used = 0, leaked = 0, unmarked = 0;
+    for (uint32_t c = 0; c < sb->clusters; c++) {
+        int owned = fsck_owner[c] != FSCK_OWNER_FREE, marked = fs_cluster_used(c) != 0;
+        used += marked;
+        if (marked && !owned) leaked++;
+        if (owned && !marked) {
+            if (unmarked++ < 16) fsck_error("cluster %u is in use but free in the bitmap", c);
+        }
+    }
+    if (unmarked > 16) fsck_error("... %u clusters in use but free in the bitmap", unmarked);
+    if (leaked) fsck_warn("%u clusters marked in use but owned by nothing", leaked);
+    for (uint32_t c = sb->clusters; c < FS_CLUSTERS; c++) {
+        if (fs_cluster_used(c)) {
+            fsck_error("bitmap marks cluster %u past the end of the disk", c);
+            break;
+        }
+    }
+    if (sb->free_clusters != sb->clusters - used)
+        fsck_error("superblock: %u free clusters, bitmap has %u", sb->free_clusters, sb->clusters - used);
+
+    fsck_dir(FS_ROOT_INO);
+    for (int i = 1; i < (int)sb->inodes; i++) {
+        if (filetable[i].used && !fsck_refs[i])
+            fsck_error("inode %d (%.*s) is not in any directory", i, FS_MAX_FILENAME, filetable[i].name);
+    }
+
+    printf("%s: %u files (%u inline, %u compressed), %u directories, %u/%u clusters used",
+           argv[1], files, inline_files, lz4_files, dirs, used, sb->clusters);
+    printf(", %d errors, %d warnings\n", fsck_errors, fsck_warnings);
+    hostdisk_close();
+    return fsck_errors ? 1 : 0;
+}